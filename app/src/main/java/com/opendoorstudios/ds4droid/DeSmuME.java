@@ -98,6 +98,10 @@ public class DeSmuME {
 
     static native void restoreState(int slot);
 
+    static native boolean startRecording(String path);
+
+    static native void stopRecording();
+
     static native void loadSettings();
 
     static native void resetVideo();
@@ -1399,7 +1399,7 @@ Render3DError OpenGLES2Renderer::EnableVertexAttributes(const VERTLIST *vertList
 	if (this->isVAOSupported)
 	{
 		glBindVertexArrayOES(OGLRef.vaoMainStatesID);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(VERT) * vertList->count, vertList);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(VERT) * vertList->count, vertList->list);
 		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, vertIndexCount * sizeof(GLushort), indexBuffer);
 	}
 	else
@@ -1408,7 +1408,7 @@ Render3DError OpenGLES2Renderer::EnableVertexAttributes(const VERTLIST *vertList
 		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, vertIndexCount * sizeof(GLushort), indexBuffer);
 
 		glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboVertexID);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(VERT) * vertList->count, vertList);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(VERT) * vertList->count, vertList->list);
 
 		glEnableVertexAttribArray(OGLVertexAttributeID_Position);
 		glEnableVertexAttribArray(OGLVertexAttributeID_TexCoord0);
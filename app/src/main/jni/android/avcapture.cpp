@@ -0,0 +1,796 @@
+/*	avcapture.cpp
+	Copyright (C) 2026 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SPU.h"
+#include "avcapture.h"
+#include "main.h"
+#include "utils/ringbuffer.h"
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <zlib.h>
+#include <new>
+#include <string>
+#include <vector>
+
+#define CAPTURE_WIDTH 256
+#define CAPTURE_HEIGHT 384 //both screens, one above the other
+#define CAPTURE_PIXELS (CAPTURE_WIDTH*CAPTURE_HEIGHT)
+
+//the ds runs at 33513982 / (6*355*263) frames a second: about 59.83
+#define CAPTURE_RATE 33513982
+#define CAPTURE_SCALE (6*355*263)
+
+#define CAPTURE_MAX_SLOTS 64 //frames waiting for the encoder
+#define CAPTURE_MAX_FRAMES 1024 //frames (and their sound) queued in all. past this they are lost
+#define CAPTURE_PACKETS 4 //encoded frames waiting for the writer
+#define CAPTURE_AUDIO_SECONDS 4
+
+//where a file is closed and the next one started, at the next keyframe.
+//AVI files are good for 4GB, but a lot of readers give up at 2
+#define CAPTURE_SEGMENT_BYTES 0x7C000000u
+
+static u32 captureKeyframeInterval = 300;
+static u32 captureBufferFrames = 16;
+static int captureLevel = 1;
+
+void AVCaptureSetup(u32 keyframeInterval, u32 bufferFrames, int compressionLevel)
+{
+	captureKeyframeInterval = std::max<u32>(keyframeInterval, 1);
+	captureBufferFrames = std::min<u32>(std::max<u32>(bufferFrames, 2), CAPTURE_MAX_SLOTS);
+	captureLevel = std::min(std::max(compressionLevel, 1), 9);
+}
+
+//---------------------------------------------------------------
+//a queue for handing things to a thread which sleeps until there is something.
+//the producer never waits (sem_post doesnt), so it can be the emulation thread
+
+template<typename T, u32 CAPACITY>
+class Mailbox
+{
+public:
+	Mailbox() : closed(0) { sem_init(&posted, 0, 0); }
+	~Mailbox() { sem_destroy(&posted); }
+
+	//producer only
+	bool post(const T& item)
+	{
+		if(!ring.push(item)) return false;
+		sem_post(&posted);
+		return true;
+	}
+
+	//producer only. nothing more is coming: once the consumer has taken everything, take() returns false
+	void close()
+	{
+		__atomic_store_n(&closed, 1, __ATOMIC_RELEASE);
+		sem_post(&posted);
+	}
+
+	bool full() const { return ring.size() == CAPACITY; }
+
+	//consumer only. waits for the next item
+	bool take(T& item)
+	{
+		for(;;)
+		{
+			while(sem_wait(&posted) != 0)
+				if(errno != EINTR)
+					return false;
+			if(ring.pop(item)) return true;
+			//every post comes with its own wakeup, so this one was close()'s
+			if(__atomic_load_n(&closed, __ATOMIC_ACQUIRE)) return false;
+		}
+	}
+
+private:
+	SPSCRing<T,CAPACITY> ring;
+	u32 closed;
+	sem_t posted;
+};
+
+//---------------------------------------------------------------
+//ZMBV, the DOSBox capture codec. every frame starts with a flags byte (1 for a keyframe), and keyframes
+//go on with the format: version 0.1, zlib, 15bpp, 16x16 blocks. after that comes one zlib stream
+//(restarted at each keyframe, flushed at the end of every frame) holding, for a keyframe, the picture,
+//and otherwise a motion vector for each block followed by the blocks which changed, xored with the last frame.
+//ds frames dont scroll by whole blocks often enough to be worth searching for, so the vectors are all 0
+
+#define ZMBV_BLOCK 16
+#define ZMBV_BLOCKS_X (CAPTURE_WIDTH/ZMBV_BLOCK)
+#define ZMBV_BLOCKS ((CAPTURE_WIDTH/ZMBV_BLOCK)*(CAPTURE_HEIGHT/ZMBV_BLOCK))
+#define ZMBV_VECTOR_BYTES ((ZMBV_BLOCKS*2+3)&~3)
+#define ZMBV_WORK_BYTES (ZMBV_VECTOR_BYTES + CAPTURE_PIXELS*2)
+#define ZMBV_HEADER_BYTES 7
+
+class ZmbvEncoder
+{
+public:
+	ZmbvEncoder(int level)
+	{
+		memset(&z, 0, sizeof(z));
+		deflateInit(&z, level);
+		work = new u8[ZMBV_WORK_BYTES];
+		cur = new u16[CAPTURE_PIXELS];
+		prev = new u16[CAPTURE_PIXELS];
+		//with a sync flush on top of the worst case for the data
+		maxBytes = ZMBV_HEADER_BYTES + deflateBound(&z, ZMBV_WORK_BYTES) + 64;
+	}
+
+	~ZmbvEncoder()
+	{
+		deflateEnd(&z);
+		delete[] work;
+		delete[] cur;
+		delete[] prev;
+	}
+
+	//converts a frame from the ds's xBBBBBGGGGGRRRRR to ZMBV's xRRRRRGGGGGBBBBB, ready for encode()
+	void load(const u16* screens)
+	{
+		for(int i=0;i<CAPTURE_PIXELS;i++)
+		{
+			const u16 c = screens[i];
+			cur[i] = ((c & 0x1F) << 10) | (c & 0x3E0) | ((c >> 10) & 0x1F);
+		}
+	}
+
+	//encodes the loaded frame into out. returns false, writing nothing, when it isnt a keyframe and nothing changed
+	bool encode(bool key, std::vector<u8>& out)
+	{
+		u32 used;
+		if(key)
+		{
+			memcpy(work, cur, CAPTURE_PIXELS*2);
+			used = CAPTURE_PIXELS*2;
+		}
+		else
+		{
+			u8* vectors = work;
+			memset(vectors, 0, ZMBV_VECTOR_BYTES);
+			used = ZMBV_VECTOR_BYTES;
+			for(int b=0;b<ZMBV_BLOCKS;b++)
+			{
+				const int first = (b / ZMBV_BLOCKS_X) * ZMBV_BLOCK * CAPTURE_WIDTH + (b % ZMBV_BLOCKS_X) * ZMBV_BLOCK;
+				int y = 0;
+				while(y < ZMBV_BLOCK && !memcmp(cur + first + y*CAPTURE_WIDTH, prev + first + y*CAPTURE_WIDTH, ZMBV_BLOCK*2))
+					y++;
+				if(y == ZMBV_BLOCK) continue;
+
+				vectors[b*2] = 1;
+				u16* xored = (u16*)(work + used);
+				for(y=0;y<ZMBV_BLOCK;y++)
+					for(int x=0;x<ZMBV_BLOCK;x++)
+						*xored++ = cur[first + y*CAPTURE_WIDTH + x] ^ prev[first + y*CAPTURE_WIDTH + x];
+				used += ZMBV_BLOCK*ZMBV_BLOCK*2;
+			}
+			if(used == ZMBV_VECTOR_BYTES)
+				return false;
+		}
+
+		out.resize(maxBytes);
+		u8* p = &out[0];
+		*p++ = key ? 1 : 0;
+		if(key)
+		{
+			*p++ = 0; //version 0.1
+			*p++ = 1;
+			*p++ = 1; //zlib
+			*p++ = 5; //15bpp
+			*p++ = ZMBV_BLOCK;
+			*p++ = ZMBV_BLOCK;
+			deflateReset(&z);
+		}
+
+		z.next_in = work;
+		z.avail_in = used;
+		z.next_out = p;
+		z.avail_out = maxBytes - (p - &out[0]);
+		deflate(&z, Z_SYNC_FLUSH);
+		out.resize(maxBytes - z.avail_out);
+
+		std::swap(cur, prev);
+		return true;
+	}
+
+private:
+	z_stream z;
+	u8* work;
+	u16* cur;
+	u16* prev;
+	u32 maxBytes;
+};
+
+//---------------------------------------------------------------
+//AVI (RIFF) with the ZMBV video and 16 bit stereo PCM. the index is kept in a file next to it as it goes,
+//instead of in memory, and copied in at the end
+
+#define AVIF_HASINDEX 0x10
+#define AVIF_ISINTERLEAVED 0x100
+#define AVIIF_KEYFRAME 0x10
+
+static void put16(std::vector<u8>& b, u16 v) { b.push_back(v); b.push_back(v>>8); }
+static void put32(std::vector<u8>& b, u32 v) { put16(b, v); put16(b, v>>16); }
+static void putTag(std::vector<u8>& b, const char* tag) { b.insert(b.end(), tag, tag+4); }
+
+static u32 beginList(std::vector<u8>& b, const char* tag, const char* type)
+{
+	putTag(b, tag);
+	const u32 at = b.size();
+	put32(b, 0);
+	putTag(b, type);
+	return at;
+}
+static void endList(std::vector<u8>& b, u32 at)
+{
+	const u32 size = b.size() - at - 4;
+	for(int i=0;i<4;i++) b[at+i] = size >> (i*8);
+}
+
+class AviWriter
+{
+public:
+	AviWriter() : fp(NULL), idx(NULL) {}
+	~AviWriter() { close(); }
+
+	bool open(const std::string& path)
+	{
+		fp = fopen(path.c_str(), "wb");
+		if(!fp) return false;
+		idxPath = path + ".idx";
+		idx = fopen(idxPath.c_str(), "w+b");
+		if(!idx)
+		{
+			fclose(fp);
+			fp = NULL;
+			return false;
+		}
+		setvbuf(fp, NULL, _IOFBF, 256*1024);
+
+		videoFrames = audioFrames = maxChunk = entries = 0;
+		failed = false;
+
+		std::vector<u8> h;
+		beginList(h, "RIFF", "AVI "); //the size is patched in at the end
+		const u32 hdrl = beginList(h, "LIST", "hdrl");
+
+		putTag(h, "avih"); put32(h, 56);
+		put32(h, (u32)((u64)1000000 * CAPTURE_SCALE / CAPTURE_RATE)); //microseconds per frame
+		put32(h, CAPTURE_PIXELS*2*60 + DESMUME_SAMPLE_RATE*4); //max bytes per second
+		put32(h, 0);
+		put32(h, AVIF_HASINDEX | AVIF_ISINTERLEAVED);
+		ofsTotalFrames = h.size(); put32(h, 0);
+		put32(h, 0); //initial frames
+		put32(h, 2); //streams
+		ofsMaxChunk[0] = h.size(); put32(h, 0);
+		put32(h, CAPTURE_WIDTH);
+		put32(h, CAPTURE_HEIGHT);
+		for(int i=0;i<4;i++) put32(h, 0);
+
+		u32 strl = beginList(h, "LIST", "strl");
+		putTag(h, "strh"); put32(h, 56);
+		putTag(h, "vids"); putTag(h, "ZMBV");
+		put32(h, 0); //flags
+		put16(h, 0); put16(h, 0); //priority, language
+		put32(h, 0); //initial frames
+		put32(h, CAPTURE_SCALE);
+		put32(h, CAPTURE_RATE);
+		put32(h, 0); //start
+		ofsVideoLength = h.size(); put32(h, 0);
+		ofsMaxChunk[1] = h.size(); put32(h, 0);
+		put32(h, 0xFFFFFFFF); //quality
+		put32(h, 0); //sample size
+		put16(h, 0); put16(h, 0); put16(h, CAPTURE_WIDTH); put16(h, CAPTURE_HEIGHT);
+		putTag(h, "strf"); put32(h, 40); //BITMAPINFOHEADER
+		put32(h, 40);
+		put32(h, CAPTURE_WIDTH);
+		put32(h, CAPTURE_HEIGHT);
+		put16(h, 1); //planes
+		put16(h, 16); //bits per pixel
+		putTag(h, "ZMBV");
+		put32(h, CAPTURE_PIXELS*2);
+		for(int i=0;i<4;i++) put32(h, 0);
+		endList(h, strl);
+
+		strl = beginList(h, "LIST", "strl");
+		putTag(h, "strh"); put32(h, 56);
+		putTag(h, "auds"); put32(h, 0);
+		put32(h, 0);
+		put16(h, 0); put16(h, 0);
+		put32(h, 0);
+		put32(h, 1); //a sample at a time
+		put32(h, DESMUME_SAMPLE_RATE);
+		put32(h, 0);
+		ofsAudioLength = h.size(); put32(h, 0);
+		ofsMaxChunk[2] = h.size(); put32(h, 0);
+		put32(h, 0xFFFFFFFF);
+		put32(h, 4); //sample size
+		for(int i=0;i<4;i++) put16(h, 0);
+		putTag(h, "strf"); put32(h, 16); //WAVEFORMATEX, PCM
+		put16(h, 1);
+		put16(h, 2);
+		put32(h, DESMUME_SAMPLE_RATE);
+		put32(h, DESMUME_SAMPLE_RATE*4);
+		put16(h, 4);
+		put16(h, 16);
+		endList(h, strl);
+
+		endList(h, hdrl);
+
+		ofsMovi = beginList(h, "LIST", "movi");
+		moviStart = ofsMovi + 4;
+		end = 0;
+
+		write(&h[0], h.size());
+		return !failed;
+	}
+
+	void close()
+	{
+		if(!fp) return;
+
+		const u32 moviEnd = end;
+		u8 head[8];
+		memcpy(head, "idx1", 4);
+		set32(head+4, entries*16);
+		write(head, 8);
+		rewind(idx);
+		u8 buf[4096];
+		while(size_t n = fread(buf, 1, sizeof(buf), idx))
+			write(buf, n);
+
+		patch(4, end - 8);
+		patch(ofsMovi, moviEnd - moviStart);
+		patch(ofsTotalFrames, videoFrames);
+		patch(ofsVideoLength, videoFrames);
+		patch(ofsAudioLength, audioFrames);
+		for(int i=0;i<3;i++)
+			patch(ofsMaxChunk[i], maxChunk);
+
+		if(fclose(fp) != 0) failed = true;
+		fclose(idx);
+		remove(idxPath.c_str());
+		fp = idx = NULL;
+	}
+
+	bool isOpen() const { return fp != NULL; }
+	bool hasFailed() const { return failed; }
+	u32 size() const { return end; }
+
+	//a repeat of the last frame is a video chunk with nothing in it
+	void addVideo(const u8* data, u32 size, bool key) { addChunk("00dc", data, size, key); videoFrames++; }
+	void addAudio(const s16* stereo, u32 frames) { addChunk("01wb", stereo, frames*4, true); audioFrames += frames; }
+
+private:
+	static void set32(u8* p, u32 v) { for(int i=0;i<4;i++) p[i] = v >> (i*8); }
+
+	void write(const void* data, size_t size)
+	{
+		if(size && fwrite(data, 1, size, fp) != size)
+			failed = true;
+		end += size;
+	}
+
+	void patch(u32 at, u32 v)
+	{
+		u8 b[4];
+		set32(b, v);
+		if(fseek(fp, at, SEEK_SET) != 0 || fwrite(b, 1, 4, fp) != 4)
+			failed = true;
+	}
+
+	void addChunk(const char* tag, const void* data, u32 size, bool key)
+	{
+		u8 entry[16];
+		memcpy(entry, tag, 4);
+		set32(entry+4, key ? AVIIF_KEYFRAME : 0);
+		set32(entry+8, end - moviStart);
+		set32(entry+12, size);
+		if(fwrite(entry, 1, 16, idx) != 16)
+			failed = true;
+		entries++;
+
+		u8 head[8];
+		memcpy(head, tag, 4);
+		set32(head+4, size);
+		write(head, 8);
+		write(data, size);
+		if(size & 1)
+			write("", 1); //chunks are padded to an even size
+		maxChunk = std::max(maxChunk, size);
+	}
+
+	FILE* fp;
+	FILE* idx;
+	std::string idxPath;
+	u32 end; //bytes written
+	u32 moviStart; //where the movi list's contents start, which the index counts from
+	u32 ofsMovi, ofsTotalFrames, ofsVideoLength, ofsAudioLength, ofsMaxChunk[3];
+	u32 videoFrames, audioFrames, maxChunk, entries;
+	bool failed;
+};
+
+//---------------------------------------------------------------
+//the recording
+
+struct CaptureStats
+{
+	u32 frames; //frames recorded
+	u32 repeats; //of those, how many were written as repeats of the one before
+	u32 dropped; //of those, how many were changed but recorded as repeats, for want of a free buffer
+	u32 lost; //frames which didnt fit in the queue at all, because the encoder was that far behind. written as repeats
+	u32 segments; //files written
+	u64 bytes;
+};
+
+struct CaptureFrame
+{
+	s32 slot; //where the pixels are, or -1 when the frame is the same as the last
+	u32 audioFrames; //the sound which came with it, waiting in the audio ring
+	u32 lostBefore; //frames lost just before this one
+};
+
+struct CapturePacket
+{
+	std::vector<u8> video; //empty for a repeated frame
+	bool key;
+	std::vector<s16> audio;
+	u32 repeatsBefore; //repeats to write ahead of it, standing in for lost frames
+	bool hasFrame; //false for the end of a recording: only the repeats and sound left over
+};
+
+struct CaptureSession
+{
+	std::string path;
+	u32 keyframeInterval;
+	int level;
+
+	//emulation thread -> encoder
+	u16* slots;
+	SPSCRing<s32,CAPTURE_MAX_SLOTS> freeSlots; //(the other way)
+	Mailbox<CaptureFrame,CAPTURE_MAX_FRAMES> frames;
+	SPSCStreamRing<s16> audio;
+	u32 pendingAudio; //frames of sound pushed since the last video frame
+	bool needFrame; //the next frame has to be sent whole: none was yet, or the last changed one didnt make it
+	u32 pendingLost; //frames lost since the last one which made it
+	u32 trailingLost, trailingAudio; //what was still pending when the recording was stopped
+
+	//encoder -> writer
+	CapturePacket packets[CAPTURE_PACKETS];
+	Mailbox<CapturePacket*,CAPTURE_PACKETS> queued;
+	Mailbox<CapturePacket*,CAPTURE_PACKETS> done; //(the other way)
+	u32 wantKeyframe; //the writer wants a keyframe, to start a new file with
+	AviWriter avi;
+
+	pthread_t encoderThread, writerThread;
+	u32 writerDone; //set as the writer thread finishes, once everything is written
+	CaptureStats stats;
+};
+
+static pthread_mutex_t captureLock = PTHREAD_MUTEX_INITIALIZER; //held by whoever feeds the current session
+static CaptureSession* captureSession = NULL; //being recorded
+static CaptureSession* captureFinishing = NULL; //stopped, and maybe still being written
+static u32 captureActive = 0;
+
+static void* AVCaptureEncoderThread(void* arg)
+{
+	CaptureSession* s = (CaptureSession*)arg;
+	ZmbvEncoder zmbv(s->level);
+	u32 sinceKey = 0;
+	bool keyed = false;
+
+	CaptureFrame f;
+	while(s->frames.take(f))
+	{
+		CapturePacket* p;
+		if(!s->done.take(p)) break;
+
+		p->audio.resize(f.audioFrames*2);
+		if(f.audioFrames)
+			s->audio.read(&p->audio[0], f.audioFrames*2);
+
+		p->repeatsBefore = f.lostBefore;
+		p->hasFrame = true;
+		p->key = false;
+		p->video.clear();
+		const bool keyDue = !keyed || sinceKey >= s->keyframeInterval || __atomic_load_n(&s->wantKeyframe, __ATOMIC_ACQUIRE);
+		if(f.slot >= 0)
+		{
+			zmbv.load(s->slots + f.slot*CAPTURE_PIXELS);
+			s->freeSlots.push(f.slot);
+			if(zmbv.encode(keyDue, p->video))
+				p->key = keyDue;
+		}
+		if(p->key)
+		{
+			keyed = true;
+			sinceKey = 0;
+			__atomic_store_n(&s->wantKeyframe, 0, __ATOMIC_RELEASE);
+		}
+		else if(p->video.empty())
+			s->stats.repeats++;
+		sinceKey++;
+
+		s->queued.post(p);
+	}
+
+	//the frames lost at the very end, and the sound that came after the last frame
+	CapturePacket* p;
+	if((s->trailingLost || s->trailingAudio) && s->done.take(p))
+	{
+		p->audio.resize(s->trailingAudio*2);
+		if(s->trailingAudio)
+			s->audio.read(&p->audio[0], s->trailingAudio*2);
+		p->repeatsBefore = s->trailingLost;
+		p->hasFrame = false;
+		p->key = false;
+		p->video.clear();
+		s->queued.post(p);
+	}
+
+	s->queued.close();
+	return NULL;
+}
+
+static std::string AVCaptureSegmentPath(const std::string& path, u32 segment)
+{
+	if(segment == 0) return path;
+	char num[16];
+	sprintf(num, ".%u", segment);
+	const size_t dot = path.rfind('.');
+	if(dot == std::string::npos || path.find('/', dot) != std::string::npos)
+		return path + num;
+	return path.substr(0, dot) + num + path.substr(dot);
+}
+
+static void* AVCaptureWriterThread(void* arg)
+{
+	CaptureSession* s = (CaptureSession*)arg;
+	u32 segment = 0;
+	bool splitting = false;
+	bool reported = false;
+
+	CapturePacket* p;
+	while(s->queued.take(p))
+	{
+		if(s->avi.size() >= CAPTURE_SEGMENT_BYTES)
+		{
+			if(p->key)
+			{
+				s->avi.close();
+				if(!s->avi.open(AVCaptureSegmentPath(s->path, ++segment)))
+					LOGW("video capture couldnt start %s", AVCaptureSegmentPath(s->path, segment).c_str());
+				else s->stats.segments++;
+				splitting = false;
+			}
+			else if(!splitting)
+			{
+				__atomic_store_n(&s->wantKeyframe, 1, __ATOMIC_RELEASE);
+				splitting = true;
+			}
+		}
+
+		if(s->avi.isOpen())
+		{
+			//so that the video keeps time with the sound, every frame gets a chunk, even the lost ones
+			for(u32 i=0;i<p->repeatsBefore;i++)
+				s->avi.addVideo(NULL, 0, false);
+			if(p->hasFrame)
+				s->avi.addVideo(p->video.empty() ? NULL : &p->video[0], p->video.size(), p->key);
+			if(!p->audio.empty())
+				s->avi.addAudio(&p->audio[0], p->audio.size()/2);
+			s->stats.bytes += p->video.size() + p->audio.size()*2 + 16 + p->repeatsBefore*8;
+			if(s->avi.hasFailed() && !reported)
+			{
+				LOGW("video capture couldnt write to %s", AVCaptureSegmentPath(s->path, segment).c_str());
+				reported = true;
+			}
+		}
+
+		s->done.post(p);
+	}
+
+	s->avi.close();
+	LOGI("video capture: %u frames (%u repeated, %u of them dropped), %u lost (written as repeats), %u audio overruns, %u files",
+		s->stats.frames, s->stats.repeats, s->stats.dropped, s->stats.lost, s->audio.getOverruns(), s->stats.segments);
+	__atomic_store_n(&s->writerDone, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+//the rings in a session are cache line aligned, which plain new doesnt promise for the session itself
+static CaptureSession* AVCaptureNewSession()
+{
+	void* mem;
+	if(posix_memalign(&mem, __alignof__(CaptureSession), sizeof(CaptureSession)) != 0) return NULL;
+	return new(mem) CaptureSession();
+}
+
+static void AVCaptureFreeSession(CaptureSession* s)
+{
+	delete[] s->slots;
+	s->~CaptureSession();
+	free(s);
+}
+
+//waits for the last recording to be written, and frees it. unless wait is false, in which case
+//it is only freed if it is written already. returns false when it is still being written
+static bool AVCaptureJoin(bool wait)
+{
+	pthread_mutex_lock(&captureLock);
+	CaptureSession* s = captureFinishing;
+	if(s && (wait || __atomic_load_n(&s->writerDone, __ATOMIC_ACQUIRE)))
+		captureFinishing = NULL;
+	else s = NULL;
+	const bool busy = captureFinishing != NULL;
+	pthread_mutex_unlock(&captureLock);
+
+	if(s)
+	{
+		//the writer finishes last, so once it is done these dont have to wait
+		pthread_join(s->encoderThread, NULL);
+		pthread_join(s->writerThread, NULL);
+		AVCaptureFreeSession(s);
+	}
+	return !busy;
+}
+
+bool AVCaptureBegin(const char* path)
+{
+	AVCaptureEnd();
+	if(!AVCaptureJoin(false))
+	{
+		LOGW("video capture couldnt start %s: the last recording is still being written", path);
+		return false;
+	}
+
+	CaptureSession* s = AVCaptureNewSession();
+	if(!s) return false;
+	s->slots = NULL;
+	s->path = path;
+	s->keyframeInterval = captureKeyframeInterval;
+	s->level = captureLevel;
+	if(!s->avi.open(path))
+	{
+		LOGW("video capture couldnt create %s", path);
+		AVCaptureFreeSession(s);
+		return false;
+	}
+
+	s->slots = new u16[captureBufferFrames*CAPTURE_PIXELS];
+	for(u32 i=0;i<captureBufferFrames;i++)
+		s->freeSlots.push(i);
+	s->audio.resize(DESMUME_SAMPLE_RATE*CAPTURE_AUDIO_SECONDS*2);
+	s->pendingAudio = 0;
+	s->needFrame = true;
+	s->pendingLost = s->trailingLost = s->trailingAudio = 0;
+	for(int i=0;i<CAPTURE_PACKETS;i++)
+	{
+		s->done.post(&s->packets[i]);
+	}
+	s->wantKeyframe = 0;
+	s->writerDone = 0;
+	memset(&s->stats, 0, sizeof(s->stats));
+	s->stats.segments = 1;
+
+	bool encoding = pthread_create(&s->encoderThread, NULL, AVCaptureEncoderThread, s) == 0;
+	if(!encoding || pthread_create(&s->writerThread, NULL, AVCaptureWriterThread, s) != 0)
+	{
+		LOGW("video capture couldnt start its threads");
+		if(encoding)
+		{
+			//with nothing coming, the encoder stops straight away
+			s->frames.close();
+			pthread_join(s->encoderThread, NULL);
+		}
+		s->avi.close();
+		remove(path);
+		AVCaptureFreeSession(s);
+		return false;
+	}
+
+	pthread_mutex_lock(&captureLock);
+	captureSession = s;
+	__atomic_store_n(&captureActive, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&captureLock);
+
+	LOGI("video capture started: %s", path);
+	return true;
+}
+
+void AVCaptureEnd()
+{
+	pthread_mutex_lock(&captureLock);
+	CaptureSession* s = captureSession;
+	captureSession = NULL;
+	__atomic_store_n(&captureActive, 0, __ATOMIC_RELEASE);
+	if(s)
+	{
+		//the encoder picks these up once it has taken everything, which follows the close
+		s->trailingLost = s->pendingLost;
+		s->trailingAudio = s->pendingAudio;
+		s->frames.close();
+		captureFinishing = s;
+	}
+	pthread_mutex_unlock(&captureLock);
+}
+
+void AVCaptureShutdown()
+{
+	AVCaptureEnd();
+	AVCaptureJoin(true);
+}
+
+bool AVCaptureIsRecording()
+{
+	return __atomic_load_n(&captureActive, __ATOMIC_ACQUIRE) != 0;
+}
+
+void AVCaptureSound(const s16* stereo, u32 frames)
+{
+	if(!AVCaptureIsRecording()) return;
+
+	pthread_mutex_lock(&captureLock);
+	if(CaptureSession* s = captureSession)
+		s->pendingAudio += s->audio.write(stereo, frames*2) / 2;
+	pthread_mutex_unlock(&captureLock);
+}
+
+void AVCaptureFrame(const u16* screens, bool unchanged)
+{
+	if(!AVCaptureIsRecording()) return;
+
+	pthread_mutex_lock(&captureLock);
+	if(CaptureSession* s = captureSession)
+	{
+		//the sound stays queued, and goes with the next frame which makes it.
+		//whatever changed in a frame which is lost or dropped, the next one has to bring
+		if(s->frames.full())
+		{
+			s->stats.lost++;
+			s->pendingLost++;
+			s->needFrame = true;
+		}
+		else
+		{
+			CaptureFrame f;
+			f.slot = -1;
+			f.audioFrames = s->pendingAudio;
+			f.lostBefore = s->pendingLost;
+			if(!unchanged || s->needFrame)
+			{
+				if(s->freeSlots.pop(f.slot))
+				{
+					memcpy(s->slots + f.slot*CAPTURE_PIXELS, screens, CAPTURE_PIXELS*2);
+					s->needFrame = false;
+				}
+				else
+				{
+					s->stats.dropped++;
+					s->needFrame = true;
+				}
+			}
+			s->frames.post(f);
+			s->pendingAudio = 0;
+			s->pendingLost = 0;
+			s->stats.frames++;
+		}
+	}
+	pthread_mutex_unlock(&captureLock);
+}
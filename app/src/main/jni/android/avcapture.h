@@ -0,0 +1,51 @@
+/*	avcapture.h
+	Copyright (C) 2026 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AVCAPTURE_H
+#define _AVCAPTURE_H
+
+#include "types.h"
+
+//gameplay recording. the emulation thread only copies each frame (both screens) and the sound mixed during it
+//into buffers set aside for them; two threads take it from there. one compresses the video as ZMBV
+//(zlib over the 16x16 blocks which changed since the last frame, with a keyframe every so often so it can be seeked),
+//and the other writes it all out as AVI. the buffers are a fixed number: if the encoder falls behind,
+//frames are recorded as repeats of the one before rather than making the emulator wait.
+
+//frames between keyframes (how far a seek may have to decode from), how many frames may wait for the encoder,
+//and the zlib level (1 is the fastest). takes effect at the next AVCaptureBegin
+void AVCaptureSetup(u32 keyframeInterval, u32 bufferFrames, int compressionLevel);
+
+//starts recording to path (an .avi). recordings too long for one AVI go on in path.1.avi, path.2.avi and so on.
+//fails if an earlier recording is still being written out
+bool AVCaptureBegin(const char* path);
+
+//stops recording. what is queued is written out in the background
+void AVCaptureEnd();
+
+//stops recording and waits for everything to be written. (for exiting)
+void AVCaptureShutdown();
+
+bool AVCaptureIsRecording();
+
+//emulation thread. the core's sound, as it is mixed
+void AVCaptureSound(const s16* stereo, u32 frames);
+
+//emulation thread. the frame just finished (GPU_screen). unchanged means it is the same as the last one
+void AVCaptureFrame(const u16* screens, bool unchanged);
+
+#endif
@@ -93,6 +93,7 @@ u32 ds_write32(u32 b, u32 c)
 		}
 		if ( (b & 0x0F000000ul) == 0x02000000ul)
 		{
+			MMU_MAIN_markDirty(b);
 			*(u32*)(MMU.MAIN_MEM + (b & 0x3FFFFCul)) = c;
 			//return MMU_aluMemAccessCycles<ARMCPU_ARM9, 32,MMU_AD_WRITE>(2,b);
 			return 4;
@@ -105,6 +106,7 @@ u32 ds_write32(u32 b, u32 c)
 	{
 		if ( (b & 0x0F000000ul) == 0x02000000ul)
 		{
+			MMU_MAIN_markDirty(b);
 			*(u32*)(MMU.MAIN_MEM + (b & 0x3FFFFCul)) = c;
 			//return MMU_aluMemAccessCycles<ARMCPU_ARM7, 32,MMU_AD_WRITE>(2,b);
 			return 4;
@@ -44,6 +44,9 @@
 #include "video.h"
 #include "OpenArchive.h"
 #include "sndopensl.h"
+#include "sndring.h"
+#include "avcapture.h"
+#include "driver.h"
 #include "cheatSystem.h"
 
 #define JNI(X,...) Java_com_opendoorstudios_ds4droid_DeSmuME_##X(JNIEnv* env, jclass* clazz, __VA_ARGS__)
@@ -62,6 +65,7 @@ GPU3DInterface *core3DList[] = {
 SoundInterface_struct *SNDCoreList[] = {
 	&SNDDummy,
 	&SNDOpenSL,
+	&SNDRingSink,
 	NULL
 };
 
@@ -93,6 +97,13 @@ bool profiler_end = false;
 #include "android-ndk-profiler/prof.h"
 #endif
 
+#ifdef TEXDECODE_BENCHMARK
+#include "texdecodetest.h"
+#endif
+#ifdef METASPU_BENCHMARK
+#include "metaspubench.h"
+#endif
+
 #ifdef MEASURE_FIRST_FRAMES
 int mff_totalFrames = 0;
 unsigned int mff_totalTime = 0;
@@ -149,6 +160,15 @@ struct MainLoopData
 
 VideoInfo video;
 
+//hands the core's sound to the video capture, and (by saying it is recording) keeps frames from being skipped meanwhile
+class AndroidDriver : public BaseDriver
+{
+public:
+	virtual void AVI_SoundUpdate(void* soundData, int soundLen) { AVCaptureSound((const s16*)soundData, soundLen); }
+	virtual bool AVI_IsRecording() { return AVCaptureIsRecording(); }
+};
+static AndroidDriver androidDriver;
+
 void doBitmapDraw(u8* pixels, u8* dest, int width, int height, int stride, int pixelFormat, int verticalOffset, bool rotate);
 
 extern "C" {
@@ -247,6 +267,9 @@ void NDS_UnPause(bool showMsg = true)
 
 void nds4droid_display()
 {
+	//nothing new: leave the newest buffer as it is, so the frontend doesnt redo its work either
+	if(gpu_frameUnchanged)
+		return;
 
 	if(int diff = (currDisplayBuffer+1)%3 - newestDisplayBuffer)
 		newestDisplayBuffer += diff;
@@ -299,7 +322,10 @@ static void nds4droid_throttle(bool allowSleep = true, int forceFrameSkip = -1)
 	}
 	else if((/*autoframeskipenab && frameskiprate ||*/ FrameLimit) && allowSleep)
 	{
-		SpeedThrottle();
+		if(SNDAudioSyncActive())
+			SNDAudioSyncWait();
+		else
+			SpeedThrottle();
 	}
 
 	if (autoframeskipenab && frameskiprate)
@@ -399,6 +425,7 @@ void nds4droid_core()
 	NDS_beginProcessingInput();
 	NDS_endProcessingInput();
 	NDS_exec<false>();
+	AVCaptureFrame((u16*)GPU_screen, gpu_frameUnchanged);
 	SPU_Emulate_user();
     backup_setManualBackupType(0);
 #ifdef MEASURE_FIRST_FRAMES
@@ -463,8 +490,12 @@ bool nds4droid_loadrom(const char* path)
 	return doRomLoad(path, PhysicalName);
 }
 
+//set when the bitmaps have to be redrawn even if the emulator hasnt produced a new frame
+static bool videoDirty = true;
+
 jint JNI(draw, jobject bitmapMain, jobject bitmapTouch, jboolean rotate)
 {
+	static jboolean lastRotate = JNI_FALSE;
 	int todo;
 	bool alreadyDisplayed;
 
@@ -481,6 +512,12 @@ jint JNI(draw, jobject bitmapMain, jobject bitmapTouch, jboolean rotate)
 		}
 	}
 
+	//the bitmaps still hold this frame
+	if(alreadyDisplayed && !videoDirty && rotate == lastRotate)
+		return ((Hud.fps & 0xFF)<<24)|((Hud.fps3d & 0xFF)<<16)|((Hud.cpuload[0] & 0xFF)<<8)|((Hud.cpuload[1] & 0xFF));
+	videoDirty = false;
+	lastRotate = rotate;
+
 	//convert pixel format to 32bpp for compositing
 	//why do we do this over and over? well, we are compositing to
 	//filteredbuffer32bpp, and it needs to get refreshed each frame..
@@ -528,11 +565,13 @@ void JNI(resize, jobject bitmap)
 		LOGI("bitmapInfo.format == ANDROID_BITMAP_FORMAT_RGBA_8888");
 	else if(bitmapInfo.format == ANDROID_BITMAP_FORMAT_RGB_565)
 		LOGI("bitmapInfo.format == ANDROID_BITMAP_FORMAT_RGB_565");
+	videoDirty = true;
 }
 
 void JNI_NOARGS(resetVideo)
 {
 	video.reset();
+	videoDirty = true;
 }
 
 int JNI_NOARGS(getNativeWidth)
@@ -548,6 +587,7 @@ int JNI_NOARGS(getNativeHeight)
 void JNI(setFilter, int index)
 {
 	video.setfilter(index);
+	videoDirty = true;
 }
 
 
@@ -625,13 +665,25 @@ void loadSettings(JNIEnv* env)
 
     // This is for the sound.
 	CommonSettings.spu_advanced = GetPrivateProfileBool(env,"Sound", "SpuAdvanced", false, IniName);
+	CommonSettings.spu_fixedPoint = GetPrivateProfileBool(env,"Sound", "SpuFixedPoint", false, IniName);
+	CommonSettings.spu_frameBatch = GetPrivateProfileBool(env,"Sound", "SpuFrameBatch", false, IniName);
 	// 0 for no Interpolation, 1 for Sine, 2 for Cosine.
 	CommonSettings.spuInterpolationMode = (SPUInterpolationMode)GetPrivateProfileInt(env, "Sound","SPUInterpolation", 1, IniName);
 	snd_synchmode = GetPrivateProfileInt(env, "Sound","SynchMode",0,IniName);
 	snd_synchmethod = GetPrivateProfileInt(env, "Sound","SynchMethod",0,IniName);
-	sndcoretype = GetPrivateProfileBool(env, "Sound","SoundCore", true, IniName);
+	sndcoretype = GetPrivateProfileInt(env, "Sound","SoundCore", 1, IniName);
 	// The original was 8/60. By decreasing the buffer sample rate, we seem to be getting much better sound.
 	sndbuffersize = GetPrivateProfileInt(env, "Sound","SoundBufferSize", DESMUME_SAMPLE_RATE*8/120, IniName);
+	// How many of those buffers the ring between the emulator and OpenSL holds.
+	SNDOpenSLSetRingDepth(GetPrivateProfileInt(env, "Sound","RingDepth", 3, IniName));
+	// Pace the emulator by the audio output instead of the clock. This needs synchronous mode.
+	const bool audioSync = GetPrivateProfileBool(env, "Sound","AudioSync", false, IniName);
+	SNDAudioSyncSetup(audioSync, GetPrivateProfileInt(env, "Sound","AudioSyncLatency", 32, IniName));
+	AVCaptureSetup(GetPrivateProfileInt(env, "Capture","KeyframeInterval", 300, IniName),
+		GetPrivateProfileInt(env, "Capture","BufferFrames", 16, IniName),
+		GetPrivateProfileInt(env, "Capture","Compression", 1, IniName));
+	if(audioSync)
+		snd_synchmode = ESynchMode_Synchronous;
 
 	// This is for JIT. It only works on x86 and x86_64 devices right now.
 	CommonSettings.advanced_timing = GetPrivateProfileBool(env,"Emulation", "AdvancedTiming", false, IniName);
@@ -646,6 +698,12 @@ void loadSettings(JNIEnv* env)
 	CommonSettings.GFX3D_Texture = GetPrivateProfileBool(env, "3D", "EnableTexture", 1, IniName);
 	CommonSettings.GFX3D_LineHack = GetPrivateProfileBool(env, "3D", "EnableLineHack", 0, IniName);
 	CommonSettings.GFX3D_TXTHack = GetPrivateProfileBool(env, "3D", "EnableTXTHack", 0, IniName);
+	CommonSettings.GFX3D_TexCacheBudgetMB = GetPrivateProfileInt(env, "3D", "TexCacheBudget", 16, IniName);
+	CommonSettings.GFX3D_TexPreDecode = GetPrivateProfileBool(env, "3D", "TexPreDecode", 1, IniName);
+	CommonSettings.GFX3D_GeometryThread = GetPrivateProfileBool(env, "3D", "GeometryThread", 0, IniName);
+	CommonSettings.GFX2D_ReuseLines = GetPrivateProfileBool(env, "2D", "ReuseLines", 1, IniName);
+	CommonSettings.GFX2D_FrameRender = GetPrivateProfileBool(env, "2D", "FrameRender", 0, IniName);
+	CommonSettings.GFX2D_FrameThread = GetPrivateProfileBool(env, "2D", "FrameThread", 0, IniName);
 	fw_config.language = GetPrivateProfileInt(env, "Firmware","Language", 1, IniName);
 
 	// This is the wifi
@@ -738,8 +796,18 @@ void JNI(init, jobject _inst)
 	slot2_Change((NDS_SLOT2_TYPE)slot2_device_type);
 
 
+	driver = &androidDriver;
 	NDS_Init();
 
+#ifdef TEXDECODE_BENCHMARK
+	//needs the color tables which NDS_Init builds
+	texdecodetest();
+#endif
+
+#ifdef METASPU_BENCHMARK
+	metaspubench();
+#endif
+
     // This is for the renderer used. Default is rasterizer.
 	cur3DCore = GetPrivateProfileInt(env, "3D", "Renderer", 2, IniName);
 	NDS_3D_ChangeCore(cur3DCore);
@@ -798,6 +866,20 @@ void JNI(changeSoundSynchMethod, int synchmethod)
 	SPU_SetSynchMode(snd_synchmode,snd_synchmethod = synchmethod);
 }
 
+jboolean JNI(startRecording, jstring path)
+{
+	jboolean isCopy;
+	const char* szPath = env->GetStringUTFChars(path, &isCopy);
+	bool ret = AVCaptureBegin(szPath);
+	env->ReleaseStringUTFChars(path, szPath);
+	return ret ? JNI_TRUE : JNI_FALSE;
+}
+
+void JNI_NOARGS(stopRecording)
+{
+	AVCaptureEnd();
+}
+
 jboolean JNI(loadRom, jstring path)
 {
 	jboolean isCopy;
@@ -916,6 +998,7 @@ void JNI(deleteCheat, jint pos)
 
 void JNI_NOARGS(closeRom)
 {
+	AVCaptureEnd();
 	NDS_FreeROM();
 	execute = false;
 	Hud.resetTransient();
@@ -933,6 +1016,7 @@ void JNI_NOARGS(exit)
 		INFO("profile end\n");
 	}
 #endif
+	AVCaptureShutdown();
 	exit(0);
 }
 
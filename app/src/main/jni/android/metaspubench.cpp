@@ -0,0 +1,101 @@
+/*
+	Copyright (C) 2026 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//times the metaspu synchronizers the way SPU.cpp drives them: a few samples enqueued every hline,
+//and the output side asking for a buffer's worth now and then. the emulation speed wanders
+//(slow frames, skipped frames, fast forward bursts), which is what the synchronizers are there to absorb.
+//build with METASPU_BENCHMARK and the results are logged once at startup.
+
+#include "metaspubench.h"
+#include "metaspu/metaspu.h"
+#include "main.h"
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_FRAMES 6000
+#define HLINES_PER_FRAME 263
+
+//44100hz at 59.8261fps
+#define SAMPLES_PER_HLINE (44100.0 / (59.8261 * HLINES_PER_FRAME))
+
+static unsigned long long nanotime()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static void bench(const char* name, ESynchMethod method)
+{
+	ISynchronizingAudioBuffer* synch = metaspu_construct(method);
+	if(!synch) return;
+
+	static s16 hline[16*2];
+	static s16 out[4096*2];
+	double samples = 0;
+	u32 in = 0, got = 0, phase = 0;
+	unsigned long long enqueueTime = 0, outputTime = 0, worst = 0;
+
+	srand(0);
+	for(u32 frame=0;frame<BENCH_FRAMES;frame++)
+	{
+		//how many emulated frames run before the output side gets a turn:
+		//usually one, sometimes none (a slow frame) and sometimes a burst (catching up or fast forward)
+		const u32 r = rand()%100;
+		u32 burst = 1;
+		if(r < 10) burst = 0;
+		else if(r < 20) burst = 2 + rand()%4;
+		if((frame/1000)&1) burst *= 3; //a stretch of fast forward
+
+		unsigned long long t0 = nanotime();
+		for(u32 f=0;f<burst;f++)
+			for(u32 h=0;h<HLINES_PER_FRAME;h++)
+			{
+				samples += SAMPLES_PER_HLINE;
+				const int n = (int)samples;
+				samples -= n;
+				for(int i=0;i<n*2;i++)
+					hline[i] = (s16)(phase++ * 331);
+				synch->enqueue_samples(hline,n);
+				in += n;
+			}
+		unsigned long long t1 = nanotime();
+
+		//roughly one frame of output, give or take what the sound driver happens to have free
+		const int requested = 600 + rand()%300;
+		got += synch->output_samples(out,requested);
+		unsigned long long t2 = nanotime();
+
+		enqueueTime += t1-t0;
+		outputTime += t2-t1;
+		if(t2-t0 > worst) worst = t2-t0;
+	}
+
+	delete synch;
+
+	LOGI("metaspu %s: %u samples in, %u out. enqueue %.1f ns/sample, output %.1f ns/sample, worst frame %.3f ms",
+		name, in, got,
+		(double)enqueueTime/(in?in:1), (double)outputTime/(got?got:1), worst/1000000.0);
+}
+
+void metaspubench()
+{
+	bench("nitsuja",ESynchMethod_N);
+	bench("zeromus",ESynchMethod_Z);
+	bench("pcsx2",ESynchMethod_P);
+	bench("wsola",ESynchMethod_W);
+}
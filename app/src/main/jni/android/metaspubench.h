@@ -0,0 +1,6 @@
+#ifndef _METASPUBENCH_H
+#define _METASPUBENCH_H
+
+void metaspubench();
+
+#endif
@@ -17,6 +17,7 @@
 
 #include "SPU.h"
 #include "sndopensl.h"
+#include "sndring.h"
 #include "main.h"
 
 #include <SLES/OpenSLES.h>
@@ -42,6 +43,8 @@ SoundInterface_struct SNDOpenSL = {
 	SNDOpenSLUnMuteAudio,
 	SNDOpenSLSetVolume,
 	SNDOpenSLClearAudioBuffer,
+	SNDAudioSyncFetchSamples,
+	NULL,
 };
 
 #define FAILED(X) (X) != SL_RESULT_SUCCESS
@@ -56,52 +59,25 @@ static SLVolumeItf bqPlayerVolume;
 static bool everEnqueued = false;
 
 
-class SoundBuffer
-{
-public:
-	SoundBuffer() : data(NULL)
-	{
-		reset();
-	}
-	~SoundBuffer()
-	{
-		reset();
-	}
-	void reset()
-	{
-		if(data != NULL)
-			delete [] data;
-		data = NULL;
-		avail = true;
-		samples = 0;
-	}
-	s16* data;
-	bool avail;
-	int samples;
-};
-
+//the emulator pushes into the ring, and the player's callback pulls a period out of it into one of the
+//buffers on the player's queue (each stays untouched until the player is done with it and calls back again)
 static const int NUM_BUFFERS = 2;
-SoundBuffer buffers[NUM_BUFFERS];
-SoundBuffer empty;
+static SoundRing ring;
+static s16* buffers[NUM_BUFFERS];
+static int nextBuffer = 0;
+static int ringDepth = 3;
 
 static bool muted = false;
 static bool currentlyPlaying = false;
 static int soundbufsize = 0;
-static int nextSoundBuffer = -1;
 static SLmillibel maxVol;
 
 void bqPlayerCallback(SLAndroidSimpleBufferQueueItf bq, void *context)
 {
-	SLresult result;
-	if(buffers[nextSoundBuffer].avail)
-	{
-		result = (*bqPlayerBufferQueue)->Enqueue(bqPlayerBufferQueue, empty.data, soundbufsize);
-		//LOGI("Returned empty sound buffer");
-		return;
-	}
-	//LOGI("Returned sound buffer %d", nextSoundBuffer);
-	result = (*bqPlayerBufferQueue)->Enqueue(bqPlayerBufferQueue, buffers[nextSoundBuffer].data, buffers[nextSoundBuffer].samples * sizeof(s16) * 2);
-	buffers[nextSoundBuffer == 0 ? 1 : 0].avail = true;
+	s16* buffer = buffers[nextBuffer];
+	nextBuffer = (nextBuffer + 1) % NUM_BUFFERS;
+	ring.pull(buffer);
+	(*bqPlayerBufferQueue)->Enqueue(bqPlayerBufferQueue, buffer, soundbufsize);
 }
 
 int SNDOpenSLInit(int buffersize)
@@ -164,19 +140,17 @@ int SNDOpenSLInit(int buffersize)
     if(FAILED(result = (*bqPlayerPlay)->SetPlayState(bqPlayerPlay, SL_PLAYSTATE_PLAYING)))
 		return -1;
 		
-	buffers[0].reset();
-	buffers[1].reset();
 	soundbufsize = buffersize;
-	if ((buffers[0].data = new s16[soundbufsize / sizeof(s16)]) == NULL)
-		return -1;
-	if ((buffers[1].data = new s16[soundbufsize / sizeof(s16)]) == NULL)
-		return -1;
-	if ((empty.data = new s16[soundbufsize / sizeof(s16)]) == NULL)
-		return -1;
+	for(int i = 0 ; i < NUM_BUFFERS ; ++i)
+	{
+		delete[] buffers[i];
+		buffers[i] = new s16[soundbufsize / sizeof(s16)];
+		memset(buffers[i], 0, soundbufsize);
+	}
+	ring.init(soundbufsize / (sizeof(s16) * 2), ringDepth);
+	nextBuffer = 0;
+	SNDAudioSyncAttach(&ring);
 
-	memset(buffers[0].data, 0, soundbufsize);
-	memset(buffers[1].data, 0, soundbufsize);
-	memset(empty.data, 0, soundbufsize);
 	muted = false;
 	currentlyPlaying = false;
 	LOGI("OpenSL created (for audio output)");
@@ -185,9 +159,12 @@ int SNDOpenSLInit(int buffersize)
 
 void SNDOpenSLDeInit()
 {
+	SNDAudioSyncAttach(NULL);
+
 	if (bqPlayerObject != NULL) {
         (*bqPlayerObject)->Destroy(bqPlayerObject);
 		bqPlayerObject = NULL;
+		LOGI("OpenSL destroyed after %u underruns and %u overruns", ring.underruns(), ring.overruns());
 	}
 	
 	if (outputMixObject != NULL) {
@@ -203,36 +180,24 @@ void SNDOpenSLDeInit()
 
 void SNDOpenSLUpdateAudio(s16 *buffer, u32 num_samples)
 {
-	for(int i = 0 ; i < NUM_BUFFERS ; ++i)
+	ring.push(buffer, num_samples);
+	if(!currentlyPlaying)
 	{
-		if(buffers[i].avail)
+		//start the player off with silence in every buffer; from then on, each callback pulls from the ring
+		(*bqPlayerBufferQueue)->Clear(bqPlayerBufferQueue);
+		nextBuffer = 0;
+		for(int i = 0 ; i < NUM_BUFFERS ; ++i)
 		{
-			memcpy(buffers[i].data, buffer, sizeof(s16) * 2 * num_samples);
-			int currentSoundBuffer = nextSoundBuffer;
-			buffers[i].samples = num_samples;
-			buffers[i].avail = false;
-			nextSoundBuffer = i;
-			if(!currentlyPlaying)
-			{
-				(*bqPlayerBufferQueue)->Clear(bqPlayerBufferQueue);
-				bqPlayerCallback(bqPlayerBufferQueue, NULL);
-				currentlyPlaying = true;
-			}
-			//LOGI("Copied %d samples to buffer %d", num_samples, nextSoundBuffer);
-			return;
+			memset(buffers[i], 0, soundbufsize);
+			(*bqPlayerBufferQueue)->Enqueue(bqPlayerBufferQueue, buffers[i], soundbufsize);
 		}
+		currentlyPlaying = true;
 	}
-	//should never get here...
 }
 
 u32 SNDOpenSLGetAudioSpace()
 {
-	for(int i = 0 ; i < NUM_BUFFERS ; ++i)
-	{
-		if(buffers[i].avail)
-			return soundbufsize / (sizeof(s16) * 2);
-	}
-	return 0;
+	return ring.space();
 }
 
 void SNDOpenSLMuteAudio()
@@ -257,8 +222,7 @@ void SNDOpenSLSetVolume(int volume)
 
 void SNDOpenSLClearAudioBuffer()
 {
-	for(int i = 0 ; i < NUM_BUFFERS ; ++i)
-		memset(buffers[i].data, 0, soundbufsize);
+	ring.requestFlush();
 }
 
 void SNDOpenSLPaused(bool paused)
@@ -267,3 +231,14 @@ void SNDOpenSLPaused(bool paused)
 		return;
 	(*bqPlayerPlay)->SetPlayState(bqPlayerPlay, paused ? SL_PLAYSTATE_STOPPED : SL_PLAYSTATE_PLAYING);
 }
+
+void SNDOpenSLSetRingDepth(int periods)
+{
+	ringDepth = periods;
+}
+
+void SNDOpenSLGetStats(u32* underruns, u32* overruns)
+{
+	*underruns = ring.underruns();
+	*overruns = ring.overruns();
+}
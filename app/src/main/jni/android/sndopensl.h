@@ -24,4 +24,12 @@ extern SoundInterface_struct SNDOpenSL;
 
 void SNDOpenSLPaused(bool paused);
 
+//how many periods (of the buffer size given to Init) the ring between the emulator and the player holds.
+//takes effect at the next Init
+void SNDOpenSLSetRingDepth(int periods);
+
+//how often the player had to play silence for want of audio (underruns), and how often the emulator
+//pushed more than fit (overruns)
+void SNDOpenSLGetStats(u32* underruns, u32* overruns);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,315 @@
+/*	sndring.cpp
+	Copyright (C) 2026 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SPU.h"
+#include "sndring.h"
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+
+void SoundRing::init(u32 periodFrames, u32 depthPeriods)
+{
+	if(depthPeriods < 2) depthPeriods = 2;
+	period = periodFrames;
+	ring.resize(periodFrames * depthPeriods * 2);
+	flush = 0;
+}
+
+void SoundRing::pull(s16* out)
+{
+	if(__atomic_exchange_n(&flush, 0, __ATOMIC_ACQUIRE))
+		ring.discard();
+
+	const u32 want = period * 2;
+	const u32 got = ring.read(out, want);
+	if(got < want)
+		memset(out + got, 0, (want - got) * sizeof(s16));
+
+	sem_post(&pulled);
+}
+
+bool SoundRing::waitForPull(u32 timeoutMs)
+{
+	timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += timeoutMs / 1000;
+	ts.tv_nsec += (timeoutMs % 1000) * 1000000;
+	if(ts.tv_nsec >= 1000000000)
+	{
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	while(sem_timedwait(&pulled, &ts) != 0)
+		if(errno != EINTR)
+			return false;
+	return true;
+}
+
+//---------------------------------------------------------------
+//audio clock pacing
+
+//the most the ratio moves away from 1, and how quickly it follows
+#define AUDIOSYNC_MAX_DELTA 0.005
+#define AUDIOSYNC_SMOOTHING 0.1
+//samples the core spu mixes in a frame, rounded up
+#define AUDIOSYNC_FRAME_SAMPLES 736
+
+static bool syncEnabled = false;
+static u32 syncTargetMs = 32;
+static SoundRing* syncRing = NULL;
+static u32 syncTarget = 0; //frames
+static bool syncSynchronous = false; //whether the last FetchSamples came in synchronous mode
+static double syncRatio = 1.0;
+static double syncPos = 0; //where the next output frame falls between syncLast and the next input frame
+static s32 syncLast[2];
+
+static void SNDAudioSyncReset()
+{
+	syncRatio = 1.0;
+	syncPos = 0;
+	syncLast[0] = syncLast[1] = 0;
+	if(syncRing)
+	{
+		//leave room for a frame of emulation on top of the target, with some to spare.
+		//and since a wait ends a whole period below the target at worst, keep the target at least a period
+		//and a frame up, so that a frame's worth is always waiting when the next one starts
+		const u32 room = syncRing->capacityFrames();
+		syncTarget = std::min(syncTargetMs * DESMUME_SAMPLE_RATE / 1000, room > 1024 ? room - 1024 : room / 2);
+		syncTarget = std::min(std::max(syncTarget, syncRing->periodFrames() + AUDIOSYNC_FRAME_SAMPLES), room);
+	}
+}
+
+void SNDAudioSyncSetup(bool enabled, u32 targetMs)
+{
+	syncEnabled = enabled;
+	syncTargetMs = targetMs;
+	SNDAudioSyncReset();
+}
+
+void SNDAudioSyncAttach(SoundRing* ring)
+{
+	syncRing = ring;
+	SNDAudioSyncReset();
+}
+
+bool SNDAudioSyncActive()
+{
+	return syncEnabled && syncRing && syncSynchronous;
+}
+
+void SNDAudioSyncFetchSamples(s16 *sampleBuffer, size_t sampleCount, ESynchMode synchMode, ISynchronizingAudioBuffer *theSynchronizer)
+{
+	syncSynchronous = (synchMode == ESynchMode_Synchronous);
+	if(!syncEnabled || !syncRing || !syncSynchronous)
+	{
+		SPU_DefaultFetchSamples(sampleBuffer, sampleCount, synchMode, theSynchronizer);
+		return;
+	}
+
+	//linear interpolation is plenty for a ratio this close to 1
+	static s16 out[(256+8)*2];
+	const double step = 1.0 / syncRatio;
+
+	//a block the core mixed as silence, following silence, resamples to silence: only how much of it is worked out
+	const bool silent = sampleBuffer == SPU_core->outbuf && SPU_core->silent && syncLast[0] == 0 && syncLast[1] == 0;
+	while(sampleCount)
+	{
+		const u32 n = std::min<u32>(sampleCount, 256);
+		u32 done = 0;
+		if(silent)
+		{
+			//output frames fall at syncPos, syncPos+step, ... up to the end of these n input frames
+			if(syncPos < n)
+				done = (u32)ceil((n - syncPos) / step);
+			syncPos += done * step - n;
+			memset(out, 0, done * 2 * sizeof(s16));
+		}
+		else for(u32 i=0;i<n;i++)
+		{
+			const s32 l = sampleBuffer[i*2], r = sampleBuffer[i*2+1];
+			while(syncPos < 1.0)
+			{
+				out[done*2] = (s16)(syncLast[0] + (s32)((l - syncLast[0]) * syncPos));
+				out[done*2+1] = (s16)(syncLast[1] + (s32)((r - syncLast[1]) * syncPos));
+				done++;
+				syncPos += step;
+			}
+			syncPos -= 1.0;
+			syncLast[0] = l;
+			syncLast[1] = r;
+		}
+		syncRing->push(out, done);
+		sampleBuffer += n*2;
+		sampleCount -= n;
+	}
+}
+
+void SNDAudioSyncWait()
+{
+	if(!SNDAudioSyncActive()) return;
+
+	//a pull is due every period. if none comes in a few, the output has stopped (paused, say), so dont hang on it.
+	//pulls posted while the frame was running are stale; the fill already shows them
+	const u32 timeoutMs = 4 * syncRing->periodFrames() * 1000 / DESMUME_SAMPLE_RATE + 1;
+	syncRing->drainPulls();
+	while(syncRing->fill() > syncTarget)
+		if(!syncRing->waitForPull(timeoutMs))
+			break;
+
+	//what is waiting now is what the next frame starts from. when the emulator keeps up, the wait leaves it
+	//within a period below the target; further below that the emulator is behind, so stretch the audio a little to make up
+	const u32 fill = syncRing->fill();
+	const u32 floor = syncTarget > syncRing->periodFrames() ? syncTarget - syncRing->periodFrames() : 0;
+	double wanted = 1.0;
+	if(fill < floor)
+		wanted = 1.0 + AUDIOSYNC_MAX_DELTA * (double)(floor - fill) / floor;
+	syncRatio += (wanted - syncRatio) * AUDIOSYNC_SMOOTHING;
+}
+
+double SNDAudioSyncRatio()
+{
+	return syncRatio;
+}
+
+//---------------------------------------------------------------
+//the stand-in sink
+
+int SNDRingSinkInit(int buffersize);
+void SNDRingSinkDeInit();
+void SNDRingSinkUpdateAudio(s16 *buffer, u32 num_samples);
+u32 SNDRingSinkGetAudioSpace();
+void SNDRingSinkMuteAudio();
+void SNDRingSinkUnMuteAudio();
+void SNDRingSinkSetVolume(int volume);
+void SNDRingSinkClearAudioBuffer();
+
+SoundInterface_struct SNDRingSink = {
+	SNDCORE_RINGSINK,
+	"Ring Buffer Stand-in Sink",
+	SNDRingSinkInit,
+	SNDRingSinkDeInit,
+	SNDRingSinkUpdateAudio,
+	SNDRingSinkGetAudioSpace,
+	SNDRingSinkMuteAudio,
+	SNDRingSinkUnMuteAudio,
+	SNDRingSinkSetVolume,
+	SNDRingSinkClearAudioBuffer,
+	SNDAudioSyncFetchSamples,
+	NULL,
+};
+
+static SoundRing sinkRing;
+static s16* sinkPeriod = NULL;
+static pthread_t sinkThread;
+static bool sinkRunning = false;
+static u32 sinkStop = 0;
+static void (*sinkOutput)(const s16* stereo, u32 frames) = NULL;
+static u32 sinkRate = DESMUME_SAMPLE_RATE;
+
+static u64 sinkNanotime()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+//pulls a period every period's worth of time, the way the device would call back
+static void* sinkProc(void*)
+{
+	const u64 periodNanos = (u64)sinkRing.periodFrames() * 1000000000ULL / sinkRate;
+	u64 due = sinkNanotime();
+	while(!__atomic_load_n(&sinkStop, __ATOMIC_ACQUIRE))
+	{
+		sinkRing.pull(sinkPeriod);
+		if(sinkOutput) sinkOutput(sinkPeriod, sinkRing.periodFrames());
+
+		//keep to the schedule rather than to the time each sleep took, so that it doesnt drift
+		due += periodNanos;
+		const u64 now = sinkNanotime();
+		if(due > now) usleep((useconds_t)((due - now) / 1000));
+		else due = now;
+	}
+	return NULL;
+}
+
+int SNDRingSinkInit(int buffersize)
+{
+	SNDRingSinkDeInit();
+
+	//buffersize is in bytes of stereo s16, as for the OpenSL sink
+	const u32 periodFrames = buffersize / (sizeof(s16) * 2);
+	sinkRing.init(periodFrames, 4);
+	sinkPeriod = new s16[periodFrames * 2];
+	SNDAudioSyncAttach(&sinkRing);
+
+	sinkStop = 0;
+	if(pthread_create(&sinkThread, NULL, &sinkProc, NULL) != 0)
+		return -1;
+	sinkRunning = true;
+	return 0;
+}
+
+void SNDRingSinkDeInit()
+{
+	if(sinkRunning)
+	{
+		__atomic_store_n(&sinkStop, 1, __ATOMIC_RELEASE);
+		pthread_join(sinkThread, NULL);
+		sinkRunning = false;
+		SNDAudioSyncAttach(NULL);
+	}
+	delete[] sinkPeriod;
+	sinkPeriod = NULL;
+}
+
+void SNDRingSinkUpdateAudio(s16 *buffer, u32 num_samples)
+{
+	sinkRing.push(buffer, num_samples);
+}
+
+u32 SNDRingSinkGetAudioSpace()
+{
+	return sinkRing.space();
+}
+
+void SNDRingSinkMuteAudio() {}
+void SNDRingSinkUnMuteAudio() {}
+void SNDRingSinkSetVolume(int volume) {}
+
+void SNDRingSinkClearAudioBuffer()
+{
+	sinkRing.requestFlush();
+}
+
+void SNDRingSinkSetOutput(void (*output)(const s16* stereo, u32 frames))
+{
+	sinkOutput = output;
+}
+
+void SNDRingSinkGetStats(u32* underruns, u32* overruns)
+{
+	*underruns = sinkRing.underruns();
+	*overruns = sinkRing.overruns();
+}
+
+void SNDRingSinkSetRate(u32 hz)
+{
+	sinkRate = hz;
+}
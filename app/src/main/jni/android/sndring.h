@@ -0,0 +1,107 @@
+/*	sndring.h
+	Copyright (C) 2026 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _SNDRING_H
+#define _SNDRING_H
+
+#include <semaphore.h>
+#include <stddef.h>
+#include "types.h"
+#include "utils/ringbuffer.h"
+#include "metaspu/metaspu.h"
+
+struct SoundInterface_struct;
+
+//audio on its way from the emulator to the output device. the emulation thread pushes whatever it mixed,
+//and the output's callback pulls a period at a time, without either one ever waiting on the other.
+//nothing here depends on OpenSL, so it can be driven by the stand-in sink below as well
+class SoundRing
+{
+public:
+	SoundRing() : period(0), flush(0) { sem_init(&pulled, 0, 0); }
+	~SoundRing() { sem_destroy(&pulled); }
+
+	//only while neither side is running. the ring holds depthPeriods periods
+	void init(u32 periodFrames, u32 depthPeriods);
+
+	//emulation thread. returns how many frames fit; the rest are dropped (and counted as an overrun)
+	u32 push(const s16* stereo, u32 frames) { return ring.write(stereo, frames*2) / 2; }
+
+	//emulation thread. frames that can be pushed right now
+	u32 space() const { return ring.space() / 2; }
+
+	//emulation thread. has the output throw away whatever is waiting, the next time it pulls
+	void requestFlush() { __atomic_store_n(&flush, 1, __ATOMIC_RELEASE); }
+
+	//output thread. fills out with a whole period. if not enough was pushed (an underrun) the rest is silence
+	void pull(s16* out);
+
+	//emulation thread. frames waiting to be pulled, and how many fit in all
+	u32 fill() const { return ring.size() / 2; }
+	u32 capacityFrames() const { return ring.getCapacity() / 2; }
+
+	//emulation thread. waits (up to timeoutMs) for the output to pull a period. returns false on timeout
+	bool waitForPull(u32 timeoutMs);
+
+	//emulation thread. forgets the pulls which came before now, so the next waitForPull waits for a new one
+	void drainPulls() { while(sem_trywait(&pulled) == 0) {} }
+
+	u32 periodFrames() const { return period; }
+	u32 underruns() const { return ring.getUnderruns(); }
+	u32 overruns() const { return ring.getOverruns(); }
+
+private:
+	SPSCStreamRing<s16> ring; //interleaved stereo
+	u32 period;
+	u32 flush;
+	sem_t pulled; //posted by every pull (sem_post is safe from the output's callback)
+};
+
+//a stand-in for the OpenSL output, for running the sound path where there is no OpenSL (such as a desktop build
+//of the core): it pulls periods out of a SoundRing on its own thread at the output rate, and hands them to
+//an optional callback instead of a device
+#define SNDCORE_RINGSINK 2
+
+extern SoundInterface_struct SNDRingSink;
+
+void SNDRingSinkSetOutput(void (*output)(const s16* stereo, u32 frames));
+void SNDRingSinkGetStats(u32* underruns, u32* overruns);
+
+//the rate the stand-in pulls at, by its own clock. a little off DESMUME_SAMPLE_RATE simulates a device clock
+//which drifts against the emulator's. takes effect at the next Init
+void SNDRingSinkSetRate(u32 hz);
+
+//audio clock pacing (ini Sound/AudioSync). the core spu's output goes straight into the sound core's ring,
+//and the emulator, instead of sleeping to the clock in SpeedThrottle, waits for the output to drain the ring
+//down to a target fill. so the output device's clock sets the emulation speed, and the two cant drift apart.
+//when the emulator falls behind (the ring is over a period below the target when a frame starts), the audio is resampled
+//by up to half a percent more samples to build the ring back up, like dynamic rate control.
+//it needs the core spu mixing, ie synchronous mode
+void SNDAudioSyncSetup(bool enabled, u32 targetMs);
+
+//the sound cores with a SoundRing attach it at Init (and detach it with NULL at DeInit), and use this as FetchSamples
+void SNDAudioSyncAttach(SoundRing* ring);
+void SNDAudioSyncFetchSamples(s16 *sampleBuffer, size_t sampleCount, ESynchMode synchMode, ISynchronizingAudioBuffer *theSynchronizer);
+
+//true when the emulator should pace itself with SNDAudioSyncWait instead of SpeedThrottle
+bool SNDAudioSyncActive();
+void SNDAudioSyncWait();
+
+//the current resampling ratio (output samples per input sample)
+double SNDAudioSyncRatio();
+
+#endif
@@ -0,0 +1,170 @@
+/*
+	Copyright (C) 2026 The nds4droid Team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//checks the texture decoders in texdecode.cpp against their reference versions and times them.
+//build with TEXDECODE_BENCHMARK and the results are logged once at startup.
+
+#include "texdecodetest.h"
+#include "texdecode.h"
+#include "main.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//big enough for a 1024x1024 texture
+#define TEST_TEXELS (1024*1024)
+#define TEST_REPEATS 8
+
+#define SRC_SIZE (TEST_TEXELS*2+16)
+#define OUT_SIZE ((TEST_TEXELS+16)*4)
+
+//allocated only while the test runs
+static u8* srcData;
+static u16* indexData;
+static u16* palData;
+static u32* refOut;
+static u32* fastOut;
+
+static unsigned long long nanotime()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static void randomize()
+{
+	for(u32 i=0;i<SRC_SIZE;i++)
+		srcData[i] = (u8)rand();
+	for(u32 i=0;i<TEST_TEXELS/16;i++)
+		indexData[i] = (u16)rand();
+	for(u32 i=0;i<0x8000;i++)
+		palData[i] = (u16)rand();
+}
+
+//compares both outputs (plus a guard area, to catch overruns) and logs the result and timing
+static void report(const char* name, int texels, unsigned long long refTime, unsigned long long fastTime)
+{
+	bool match = !memcmp(refOut,fastOut,(texels+16)*4);
+	LOGI("%-12s %8d texels: %s, reference %6llu us, fast %6llu us (%.2fx)",
+		name, texels, match ? "ok" : "MISMATCH",
+		refTime/1000, fastTime/1000, fastTime ? (double)refTime/fastTime : 0.0);
+}
+
+#define TIME_DECODER(out,call) \
+	do { \
+		memset(out,0xCD,OUT_SIZE); \
+		const unsigned long long start = nanotime(); \
+		for(int r=0;r<TEST_REPEATS;r++) call; \
+		elapsed = nanotime()-start; \
+	} while(0)
+
+template<TexCache_TexFormat TEXFORMAT>
+static void testPaletted(const char* name, u32 texelsPerByte, u32 len, u8 palZeroAlpha,
+	u32* (*ref)(const u8*, u32, const u16*, u8, u32*), u32* (*fast)(const u8*, u32, const u16*, u8, u32*))
+{
+	unsigned long long elapsed, refTime;
+	TIME_DECODER(refOut, ref(srcData,len,palData,palZeroAlpha,refOut));
+	refTime = elapsed;
+	TIME_DECODER(fastOut, fast(srcData,len,palData,palZeroAlpha,fastOut));
+	report(name,len*texelsPerByte,refTime,elapsed);
+}
+
+template<TexCache_TexFormat TEXFORMAT>
+static void testTranslucent(const char* name, u32 len,
+	u32* (*ref)(const u8*, u32, const u16*, u32*), u32* (*fast)(const u8*, u32, const u16*, u32*))
+{
+	unsigned long long elapsed, refTime;
+	TIME_DECODER(refOut, ref(srcData,len,palData,refOut));
+	refTime = elapsed;
+	TIME_DECODER(fastOut, fast(srcData,len,palData,fastOut));
+	report(name,len,refTime,elapsed);
+}
+
+template<TexCache_TexFormat TEXFORMAT>
+static void test16bpp(u32 len)
+{
+	unsigned long long elapsed, refTime;
+	TIME_DECODER(refOut, TexDecode_16bpp_Reference<TEXFORMAT>(srcData,len,refOut));
+	refTime = elapsed;
+	TIME_DECODER(fastOut, TexDecode_16bpp<TEXFORMAT>(srcData,len,fastOut));
+	report("16bpp",len/2,refTime,elapsed);
+}
+
+template<TexCache_TexFormat TEXFORMAT>
+static void test4x4(u32 sizeX, u32 sizeY, u32 limit)
+{
+	//the palette slots are 16KB each, and the decoder can address 8 of them
+	u8* palSlots[8];
+	for(int i=0;i<8;i++)
+		palSlots[i] = (u8*)palData + (i&3)*0x4000;
+
+	unsigned long long elapsed, refTime;
+	TIME_DECODER(refOut, TexDecode_4x4_Reference<TEXFORMAT>((u32*)srcData,indexData,limit,sizeX,sizeY,0x100,palSlots,refOut));
+	refTime = elapsed;
+	TIME_DECODER(fastOut, TexDecode_4x4<TEXFORMAT>((u32*)srcData,indexData,limit,sizeX,sizeY,0x100,palSlots,fastOut));
+	report("4x4",sizeX*sizeY,refTime,elapsed);
+}
+
+template<TexCache_TexFormat TEXFORMAT>
+static void testFormat()
+{
+	//odd lengths exercise the scalar tails
+	const u32 lengths[] = { 1, 7, 33, 1023, 64*64, TEST_TEXELS/4 };
+	for(u32 i=0;i<sizeof(lengths)/sizeof(lengths[0]);i++)
+	{
+		const u32 len = lengths[i];
+		for(int z=0;z<2;z++)
+		{
+			const u8 palZeroAlpha = z ? ((TEXFORMAT == TexFormat_32bpp) ? 0xFF : 0x1F) : 0;
+			testPaletted<TEXFORMAT>("I2",4,len,palZeroAlpha,TexDecode_I2_Reference<TEXFORMAT>,TexDecode_I2<TEXFORMAT>);
+			testPaletted<TEXFORMAT>("I4",2,len,palZeroAlpha,TexDecode_I4_Reference<TEXFORMAT>,TexDecode_I4<TEXFORMAT>);
+			testPaletted<TEXFORMAT>("I8",1,len,palZeroAlpha,TexDecode_I8_Reference<TEXFORMAT>,TexDecode_I8<TEXFORMAT>);
+		}
+		testTranslucent<TEXFORMAT>("A3I5",len,TexDecode_A3I5_Reference<TEXFORMAT>,TexDecode_A3I5<TEXFORMAT>);
+		testTranslucent<TEXFORMAT>("A5I3",len,TexDecode_A5I3_Reference<TEXFORMAT>,TexDecode_A5I3<TEXFORMAT>);
+		test16bpp<TEXFORMAT>(len*2);
+	}
+
+	test4x4<TEXFORMAT>(8,8,4);
+	test4x4<TEXFORMAT>(64,32,128);
+	test4x4<TEXFORMAT>(128,128,512); //overruns its slot
+	test4x4<TEXFORMAT>(1024,1024,TEST_TEXELS/16);
+}
+
+void texdecodetest()
+{
+	srcData = (u8*)malloc(SRC_SIZE);
+	indexData = (u16*)malloc(TEST_TEXELS/16*2);
+	palData = (u16*)malloc(0x8000*2);
+	refOut = (u32*)malloc(OUT_SIZE);
+	fastOut = (u32*)malloc(OUT_SIZE);
+
+	srand(0);
+	randomize();
+
+	LOGI("texture decoders, 6665:");
+	testFormat<TexFormat_15bpp>();
+	LOGI("texture decoders, 8888:");
+	testFormat<TexFormat_32bpp>();
+
+	free(srcData);
+	free(indexData);
+	free(palData);
+	free(refOut);
+	free(fastOut);
+}
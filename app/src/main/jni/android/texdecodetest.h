@@ -0,0 +1,6 @@
+#ifndef _TEXDECODETEST_H
+#define _TEXDECODETEST_H
+
+void texdecodetest();
+
+#endif
@@ -38,6 +38,11 @@
 #include "readwrite.h"
 #include "matrix.h"
 #include "emufile.h"
+#include "utils/task.h"
+
+#ifdef ENABLE_NEON
+	#include <arm_neon.h>
+#endif
 
 #ifdef FASTBUILD
 	#undef FORCEINLINE
@@ -51,12 +56,11 @@ NDS_Screen MainScreen;
 NDS_Screen SubScreen;
 
 //instantiate static instance
-GPU::MosaicLookup GPU::mosaicLookup;
+GPU::MosaicTable GPU::mosaicTable;
 
 //#define DEBUG_TRI
 
 CACHE_ALIGN u8 GPU_screen[4*256*192];
-CACHE_ALIGN u8 sprWin[256];
 
 
 u16			gpu_angle = 0;
@@ -230,8 +234,11 @@ void GPU_Reset(GPU *g, u8 l)
 	}
 }
 
+static void GPU_freeFrameLog();
+
 void GPU_DeInit(GPU * gpu)
 {
+	GPU_freeFrameLog();
 	if(gpu==&GPU_main || gpu==&GPU_sub) return;
 	free(gpu);
 }
@@ -312,6 +319,208 @@ FORCEINLINE u16 GPU::blend(u16 colA, u16 colB)
 	return _blend(colA, colB, blendTable);
 }
 
+//whole line versions of the fadeInColors/fadeOutColors/gpuBlendTable555 lookups, doing the same arithmetic 8 pixels at a time.
+//bit 15 of the result is bit 15 of the source masked with topMask.
+//these must stay bit-exact with the tables (see GPU_InitFadeColors)
+
+#if defined(ENABLE_SSE2)
+#define GPU_LINE_SPLIT(c) \
+	const __m128i c##r = _mm_and_si128(c,channelMask); \
+	const __m128i c##g = _mm_and_si128(_mm_srli_epi16(c,5),channelMask); \
+	const __m128i c##b = _mm_and_si128(_mm_srli_epi16(c,10),channelMask);
+#define GPU_LINE_JOIN(r,g,b,c) \
+	_mm_or_si128(_mm_or_si128(r,_mm_slli_epi16(g,5)),_mm_or_si128(_mm_slli_epi16(b,10),_mm_and_si128(c,top)))
+#elif defined(ENABLE_NEON)
+#define GPU_LINE_SPLIT(c) \
+	const uint16x8_t c##r = vandq_u16(c,channelMask); \
+	const uint16x8_t c##g = vandq_u16(vshrq_n_u16(c,5),channelMask); \
+	const uint16x8_t c##b = vandq_u16(vshrq_n_u16(c,10),channelMask);
+#define GPU_LINE_JOIN(r,g,b,c) \
+	vorrq_u16(vorrq_u16(r,vshlq_n_u16(g,5)),vorrq_u16(vshlq_n_u16(b,10),vandq_u16(c,top)))
+#endif
+
+//c + (31-c)*evy/16 for each channel
+static void GPU_fadeInLine(u16 * dst, const u16 * src, int evy, u16 topMask)
+{
+	int i=0;
+#if defined(ENABLE_SSE2)
+	const __m128i channelMask = _mm_set1_epi16(0x1F);
+	const __m128i top = _mm_set1_epi16(topMask);
+	const __m128i factor = _mm_set1_epi16(evy);
+	for(;i<256;i+=8)
+	{
+		const __m128i c = _mm_load_si128((const __m128i*)(src+i));
+		GPU_LINE_SPLIT(c)
+		const __m128i r = _mm_add_epi16(cr,_mm_srli_epi16(_mm_mullo_epi16(_mm_sub_epi16(channelMask,cr),factor),4));
+		const __m128i g = _mm_add_epi16(cg,_mm_srli_epi16(_mm_mullo_epi16(_mm_sub_epi16(channelMask,cg),factor),4));
+		const __m128i b = _mm_add_epi16(cb,_mm_srli_epi16(_mm_mullo_epi16(_mm_sub_epi16(channelMask,cb),factor),4));
+		_mm_store_si128((__m128i*)(dst+i),GPU_LINE_JOIN(r,g,b,c));
+	}
+#elif defined(ENABLE_NEON)
+	const uint16x8_t channelMask = vdupq_n_u16(0x1F);
+	const uint16x8_t top = vdupq_n_u16(topMask);
+	for(;i<256;i+=8)
+	{
+		const uint16x8_t c = vld1q_u16(src+i);
+		GPU_LINE_SPLIT(c)
+		const uint16x8_t r = vaddq_u16(cr,vshrq_n_u16(vmulq_n_u16(vsubq_u16(channelMask,cr),evy),4));
+		const uint16x8_t g = vaddq_u16(cg,vshrq_n_u16(vmulq_n_u16(vsubq_u16(channelMask,cg),evy),4));
+		const uint16x8_t b = vaddq_u16(cb,vshrq_n_u16(vmulq_n_u16(vsubq_u16(channelMask,cb),evy),4));
+		vst1q_u16(dst+i,GPU_LINE_JOIN(r,g,b,c));
+	}
+#endif
+	for(;i<256;i++)
+		dst[i] = fadeInColors[evy][src[i]&0x7FFF] | (src[i]&topMask);
+}
+
+//c - c*evy/16 for each channel
+static void GPU_fadeOutLine(u16 * dst, const u16 * src, int evy, u16 topMask)
+{
+	int i=0;
+#if defined(ENABLE_SSE2)
+	const __m128i channelMask = _mm_set1_epi16(0x1F);
+	const __m128i top = _mm_set1_epi16(topMask);
+	const __m128i factor = _mm_set1_epi16(evy);
+	for(;i<256;i+=8)
+	{
+		const __m128i c = _mm_load_si128((const __m128i*)(src+i));
+		GPU_LINE_SPLIT(c)
+		const __m128i r = _mm_sub_epi16(cr,_mm_srli_epi16(_mm_mullo_epi16(cr,factor),4));
+		const __m128i g = _mm_sub_epi16(cg,_mm_srli_epi16(_mm_mullo_epi16(cg,factor),4));
+		const __m128i b = _mm_sub_epi16(cb,_mm_srli_epi16(_mm_mullo_epi16(cb,factor),4));
+		_mm_store_si128((__m128i*)(dst+i),GPU_LINE_JOIN(r,g,b,c));
+	}
+#elif defined(ENABLE_NEON)
+	const uint16x8_t channelMask = vdupq_n_u16(0x1F);
+	const uint16x8_t top = vdupq_n_u16(topMask);
+	for(;i<256;i+=8)
+	{
+		const uint16x8_t c = vld1q_u16(src+i);
+		GPU_LINE_SPLIT(c)
+		const uint16x8_t r = vsubq_u16(cr,vshrq_n_u16(vmulq_n_u16(cr,evy),4));
+		const uint16x8_t g = vsubq_u16(cg,vshrq_n_u16(vmulq_n_u16(cg,evy),4));
+		const uint16x8_t b = vsubq_u16(cb,vshrq_n_u16(vmulq_n_u16(cb,evy),4));
+		vst1q_u16(dst+i,GPU_LINE_JOIN(r,g,b,c));
+	}
+#endif
+	for(;i<256;i++)
+		dst[i] = fadeOutColors[evy][src[i]&0x7FFF] | (src[i]&topMask);
+}
+
+//min(31, (a*eva + b*evb)/16) for each channel, where select is 0xFFFF. elsewhere dst gets a unchanged
+static void GPU_blendLine(u16 * dst, const u16 * srcA, const u16 * srcB, const u16 * select, int eva, int evb, u16 topMask)
+{
+	int i=0;
+#if defined(ENABLE_SSE2)
+	const __m128i channelMask = _mm_set1_epi16(0x1F);
+	const __m128i top = _mm_set1_epi16(topMask);
+	const __m128i factorA = _mm_set1_epi16(eva);
+	const __m128i factorB = _mm_set1_epi16(evb);
+	for(;i<256;i+=8)
+	{
+		const __m128i a = _mm_load_si128((const __m128i*)(srcA+i));
+		const __m128i b = _mm_load_si128((const __m128i*)(srcB+i));
+		const __m128i sel = _mm_load_si128((const __m128i*)(select+i));
+		GPU_LINE_SPLIT(a)
+		GPU_LINE_SPLIT(b)
+		const __m128i r = _mm_min_epi16(channelMask,_mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(ar,factorA),_mm_mullo_epi16(br,factorB)),4));
+		const __m128i g = _mm_min_epi16(channelMask,_mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(ag,factorA),_mm_mullo_epi16(bg,factorB)),4));
+		const __m128i bl = _mm_min_epi16(channelMask,_mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(ab,factorA),_mm_mullo_epi16(bb,factorB)),4));
+		const __m128i blended = GPU_LINE_JOIN(r,g,bl,a);
+		_mm_store_si128((__m128i*)(dst+i),_mm_or_si128(_mm_and_si128(sel,blended),_mm_andnot_si128(sel,a)));
+	}
+#elif defined(ENABLE_NEON)
+	const uint16x8_t channelMask = vdupq_n_u16(0x1F);
+	const uint16x8_t top = vdupq_n_u16(topMask);
+	for(;i<256;i+=8)
+	{
+		const uint16x8_t a = vld1q_u16(srcA+i);
+		const uint16x8_t b = vld1q_u16(srcB+i);
+		GPU_LINE_SPLIT(a)
+		GPU_LINE_SPLIT(b)
+		const uint16x8_t r = vminq_u16(channelMask,vshrq_n_u16(vmlaq_n_u16(vmulq_n_u16(ar,eva),br,evb),4));
+		const uint16x8_t g = vminq_u16(channelMask,vshrq_n_u16(vmlaq_n_u16(vmulq_n_u16(ag,eva),bg,evb),4));
+		const uint16x8_t bl = vminq_u16(channelMask,vshrq_n_u16(vmlaq_n_u16(vmulq_n_u16(ab,eva),bb,evb),4));
+		vst1q_u16(dst+i,vbslq_u16(vld1q_u16(select+i),GPU_LINE_JOIN(r,g,bl,a),a));
+	}
+#endif
+	for(;i<256;i++)
+		dst[i] = select[i] ? (_blend(srcA[i],srcB[i],&gpuBlendTable555[eva][evb]) | (srcA[i]&topMask)) : srcA[i];
+}
+
+//display capture kernels. these write straight into the capture bank, which has no alignment guarantees,
+//and count is always 128 or 256
+
+//dst = src | orMask
+static void GPU_captureCopyLine(u16 * dst, const u16 * src, int count, u16 orMask)
+{
+	int i=0;
+#if defined(ENABLE_SSE2)
+	const __m128i bits = _mm_set1_epi16(orMask);
+	for(;i<count;i+=8)
+		_mm_storeu_si128((__m128i*)(dst+i),_mm_or_si128(_mm_loadu_si128((const __m128i*)(src+i)),bits));
+#elif defined(ENABLE_NEON)
+	const uint16x8_t bits = vdupq_n_u16(orMask);
+	for(;i<count;i+=8)
+		vst1q_u16(dst+i,vorrq_u16(vld1q_u16(src+i),bits));
+#endif
+	for(;i<count;i++)
+		dst[i] = src[i] | orMask;
+}
+
+//min(31, (a*eva + b*evb)/16) for each channel, where a pixel without its alpha bit counts as black.
+//the result has the alpha bit if either source pixel does
+static void GPU_captureBlendLine(u16 * dst, const u16 * srcA, const u16 * srcB, int count, int eva, int evb)
+{
+	int i=0;
+#if defined(ENABLE_SSE2)
+	const __m128i channelMask = _mm_set1_epi16(0x1F);
+	const __m128i top = _mm_set1_epi16(0x8000);
+	const __m128i factorA = _mm_set1_epi16(eva);
+	const __m128i factorB = _mm_set1_epi16(evb);
+	for(;i<count;i+=8)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(srcA+i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(srcB+i));
+		const __m128i alpha = _mm_or_si128(a,b);
+		a = _mm_and_si128(a,_mm_srai_epi16(a,15));
+		b = _mm_and_si128(b,_mm_srai_epi16(b,15));
+		GPU_LINE_SPLIT(a)
+		GPU_LINE_SPLIT(b)
+		const __m128i r = _mm_min_epi16(channelMask,_mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(ar,factorA),_mm_mullo_epi16(br,factorB)),4));
+		const __m128i g = _mm_min_epi16(channelMask,_mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(ag,factorA),_mm_mullo_epi16(bg,factorB)),4));
+		const __m128i bl = _mm_min_epi16(channelMask,_mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(ab,factorA),_mm_mullo_epi16(bb,factorB)),4));
+		_mm_storeu_si128((__m128i*)(dst+i),GPU_LINE_JOIN(r,g,bl,alpha));
+	}
+#elif defined(ENABLE_NEON)
+	const uint16x8_t channelMask = vdupq_n_u16(0x1F);
+	const uint16x8_t top = vdupq_n_u16(0x8000);
+	for(;i<count;i+=8)
+	{
+		uint16x8_t a = vld1q_u16(srcA+i);
+		uint16x8_t b = vld1q_u16(srcB+i);
+		const uint16x8_t alpha = vorrq_u16(a,b);
+		a = vandq_u16(a,vreinterpretq_u16_s16(vshrq_n_s16(vreinterpretq_s16_u16(a),15)));
+		b = vandq_u16(b,vreinterpretq_u16_s16(vshrq_n_s16(vreinterpretq_s16_u16(b),15)));
+		GPU_LINE_SPLIT(a)
+		GPU_LINE_SPLIT(b)
+		const uint16x8_t r = vminq_u16(channelMask,vshrq_n_u16(vmlaq_n_u16(vmulq_n_u16(ar,eva),br,evb),4));
+		const uint16x8_t g = vminq_u16(channelMask,vshrq_n_u16(vmlaq_n_u16(vmulq_n_u16(ag,eva),bg,evb),4));
+		const uint16x8_t bl = vminq_u16(channelMask,vshrq_n_u16(vmlaq_n_u16(vmulq_n_u16(ab,eva),bb,evb),4));
+		vst1q_u16(dst+i,GPU_LINE_JOIN(r,g,bl,alpha));
+	}
+#endif
+	for(;i<count;i++)
+	{
+		const u16 a = (srcA[i] & 0x8000) ? srcA[i] : 0;
+		const u16 b = (srcB[i] & 0x8000) ? srcB[i] : 0;
+		const u16 r = std::min(31, ((a & 0x1F) * eva + (b & 0x1F) * evb) >> 4);
+		const u16 g = std::min(31, (((a >> 5) & 0x1F) * eva + ((b >> 5) & 0x1F) * evb) >> 4);
+		const u16 bl = std::min(31, (((a >> 10) & 0x1F) * eva + ((b >> 10) & 0x1F) * evb) >> 4);
+		dst[i] = ((a | b) & 0x8000) | (bl << 10) | (g << 5) | r;
+	}
+}
+
 
 void GPU_setMasterBrightness (GPU *gpu, u16 val)
 {
@@ -823,10 +1032,10 @@ FORCEINLINE void GPU::___setFinalColorBck(u16 color, const u32 x, const int opaq
 	else color &= 0x7FFF;
 
 	//due to the early out, enabled must always be true
-	//x_int = enabled ? GPU::mosaicLookup.width[x].trunc : x;
-	x_int = GPU::mosaicLookup.width[x].trunc;
+	//x_int = enabled ? mosaicLookup.width[x].trunc : x;
+	x_int = mosaicLookup.width[x].trunc;
 
-	if(GPU::mosaicLookup.width[x].begin && GPU::mosaicLookup.height[currLine].begin) {}
+	if(mosaicLookup.width[x].begin && mosaicLookup.height[currLine].begin) {}
 	else color = mosaicColors.bg[currBgNum][x_int];
 	mosaicColors.bg[currBgNum][x] = color;
 
@@ -897,11 +1106,11 @@ static void mosaicSpriteLinePixel(GPU * gpu, int x, u16 l, u8 * dst, u8 * dst_al
 	objColor.alpha = dst_alpha[x];
 	objColor.opaque = opaque;
 
-	x_int = enabled ? GPU::mosaicLookup.width[x].trunc : x;
+	x_int = enabled ? gpu->mosaicLookup.width[x].trunc : x;
 
 	if(enabled)
 	{
-		if(GPU::mosaicLookup.width[x].begin && GPU::mosaicLookup.height[y].begin) {}
+		if(gpu->mosaicLookup.width[x].begin && gpu->mosaicLookup.height[y].begin) {}
 		else objColor = gpu->mosaicColors.obj[x_int];
 	}
 	gpu->mosaicColors.obj[x] = objColor;
@@ -955,6 +1164,147 @@ template<bool MOSAIC> void lineLarge8bpp(GPU * gpu)
 /*****************************************************************************/
 //			BACKGROUND RENDERING -TEXT-
 /*****************************************************************************/
+
+//text BG lines are decoded into palette indices for the whole width of the BG and cached, so that the
+//tile map and tile data only get looked at again when the vram they come from changes (or scrolling brings a
+//different BG line into view). horizontal scrolling is free, since it only moves where we start reading the line.
+//for 16 color BGs an index holds the tile's palette number in the upper nibble and the color in the lower one,
+//so it can be used on the palette directly. for 256 color BGs the palette numbers are kept per tile.
+struct TextBGCachedLine
+{
+	//what this line was decoded from. lg==0 for nothing
+	u32 map, tile;
+	u16 y, lg;
+	bool is256;
+
+	//the vram pages it was decoded from (through the mapping at that time) and their generations
+	u8 numPages;
+	u8 pages[6];
+	u32 pageGens[6];
+
+	u8 indices[512];
+	u8 palettes[64];
+};
+
+#define TEXTBG_CACHE_LINES 256
+static TextBGCachedLine* textBGLineCache[2][4];
+
+//looks up the vram pages which a text BG line depends on: its map row and all of the BG's tile data
+static int GPU_textBGPages(u32 map, u32 tile, u16 lg, bool is256, u8* pages)
+{
+	int n = 0;
+	pages[n++] = MMU_VRAM_page((u8*)MMU_gpu_map(map));
+	if(lg > 256) pages[n++] = MMU_VRAM_page((u8*)MMU_gpu_map(map + 32*32*2));
+	const u32 tileBytes = is256 ? 1024*0x40 : 1024*0x20;
+	for(u32 ofs=0;ofs<tileBytes;ofs+=ADDRESS_STEP_16KB)
+		pages[n++] = MMU_VRAM_page((u8*)MMU_gpu_map(tile + ofs));
+	return n;
+}
+
+//expands one row of a 16 color tile (4 bytes, left pixel in the low nibble) into 8 indices, with the palette number on top
+static FORCEINLINE void GPU_expandTileRow4bpp(u8* dst, const u8* src, u8 palette, bool hflip)
+{
+#if defined(ENABLE_SSE2)
+	const __m128i packed = _mm_cvtsi32_si128(T1ReadLong((u8*)src,0));
+	const __m128i nibbleMask = _mm_set1_epi8(0x0F);
+	__m128i row = _mm_unpacklo_epi8(_mm_and_si128(packed,nibbleMask),_mm_and_si128(_mm_srli_epi16(packed,4),nibbleMask));
+	if(hflip)
+	{
+		row = _mm_shufflelo_epi16(row,_MM_SHUFFLE(0,1,2,3));
+		row = _mm_or_si128(_mm_slli_epi16(row,8),_mm_srli_epi16(row,8));
+	}
+	_mm_storel_epi64((__m128i*)dst,_mm_or_si128(row,_mm_set1_epi8(palette<<4)));
+#elif defined(ENABLE_NEON)
+	const uint8x8_t packed = vreinterpret_u8_u32(vdup_n_u32(T1ReadLong((u8*)src,0)));
+	uint8x8_t row = vzip_u8(vand_u8(packed,vdup_n_u8(0x0F)),vshr_n_u8(packed,4)).val[0];
+	if(hflip) row = vrev64_u8(row);
+	vst1_u8(dst,vorr_u8(row,vdup_n_u8(palette<<4)));
+#else
+	for(int i=0;i<4;i++)
+	{
+		const u8 pair = src[hflip ? 3-i : i];
+		dst[i*2+0] = (palette<<4) | (hflip ? (pair>>4) : (pair&0xF));
+		dst[i*2+1] = (palette<<4) | (hflip ? (pair&0xF) : (pair>>4));
+	}
+#endif
+}
+
+//copies one row of a 256 color tile, mirroring it if needed
+static FORCEINLINE void GPU_expandTileRow8bpp(u8* dst, const u8* src, bool hflip)
+{
+#if defined(ENABLE_SSE2)
+	__m128i row = _mm_loadl_epi64((const __m128i*)src);
+	if(hflip)
+	{
+		row = _mm_shufflelo_epi16(row,_MM_SHUFFLE(0,1,2,3));
+		row = _mm_or_si128(_mm_slli_epi16(row,8),_mm_srli_epi16(row,8));
+	}
+	_mm_storel_epi64((__m128i*)dst,row);
+#elif defined(ENABLE_NEON)
+	uint8x8_t row = vld1_u8(src);
+	if(hflip) row = vrev64_u8(row);
+	vst1_u8(dst,row);
+#else
+	for(int i=0;i<8;i++)
+		dst[i] = src[hflip ? 7-i : i];
+#endif
+}
+
+static void GPU_decodeTextBGLine(TextBGCachedLine& line, u32 map, u32 tile, u16 y, u16 lg, bool is256)
+{
+	const u16 yoff = y&7;
+	for(int t=0;t<(lg>>3);t++)
+	{
+		u32 mapinfo = map + (t&31) * 2;
+		if(t > 31) mapinfo += 32*32*2;
+		TILEENTRY tileentry;
+		tileentry.val = T1ReadWord(MMU_gpu_map(mapinfo), 0);
+		const u16 row = tileentry.bits.VFlip ? 7-yoff : yoff;
+
+		if(is256)
+		{
+			GPU_expandTileRow8bpp(line.indices + t*8, (u8*)MMU_gpu_map(tile + (tileentry.bits.TileNum*0x40) + row*8), tileentry.bits.HFlip);
+			line.palettes[t] = tileentry.bits.Palette;
+		}
+		else
+			GPU_expandTileRow4bpp(line.indices + t*8, (u8*)MMU_gpu_map(tile + (tileentry.bits.TileNum*0x20) + row*4), tileentry.bits.Palette, tileentry.bits.HFlip);
+	}
+
+	line.map = map;
+	line.tile = tile;
+	line.y = y;
+	line.lg = lg;
+	line.is256 = is256;
+	line.numPages = GPU_textBGPages(map, tile, lg, is256, line.pages);
+	for(int i=0;i<line.numPages;i++)
+		line.pageGens[i] = vram_page_gen[line.pages[i]];
+}
+
+static const TextBGCachedLine& GPU_getTextBGLine(GPU * gpu, u8 num, u32 map, u32 tile, u16 y, u16 lg, bool is256)
+{
+	TextBGCachedLine*& lines = textBGLineCache[gpu->core][num];
+	if(!lines)
+	{
+		lines = new TextBGCachedLine[TEXTBG_CACHE_LINES];
+		memset(lines, 0, sizeof(TextBGCachedLine)*TEXTBG_CACHE_LINES);
+	}
+
+	TextBGCachedLine& line = lines[y&(TEXTBG_CACHE_LINES-1)];
+	bool hit = line.lg == lg && line.y == y && line.map == map && line.tile == tile && line.is256 == is256;
+	if(hit)
+	{
+		u8 pages[6];
+		const int numPages = GPU_textBGPages(map, tile, lg, is256, pages);
+		hit = numPages == line.numPages;
+		for(int i=0;hit && i<numPages;i++)
+			hit = pages[i] == line.pages[i] && vram_page_gen[pages[i]] == line.pageGens[i];
+	}
+
+	if(!hit)
+		GPU_decodeTextBGLine(line, map, tile, y, lg, is256);
+	return line;
+}
+
 // render a text background to the combined pixelbuffer
 template<bool MOSAIC> INLINE void renderline_textBG(GPU * gpu, u16 XBG, u16 YBG, u16 LG)
 {
@@ -967,17 +1317,9 @@ template<bool MOSAIC> INLINE void renderline_textBG(GPU * gpu, u16 XBG, u16 YBG,
 	u16 hmask  = (ht-1);
 	u16 tmp    = ((YBG & hmask) >> 3);
 	u32 map;
-	u8 *pal, *line;
+	u8 *pal;
 	u32 tile;
 	u16 color;
-	u16 xoff;
-	u16 yoff;
-	u32 x      = 0;
-	u32 xfin;
-
-	s8 line_dir = 1;
-	u32 mapinfo;
-	TILEENTRY tileentry;
 
 	u32 tmp_map = gpu->BG_map_ram[num] + (tmp&31) * 64;
 	if(tmp>31) 
@@ -986,67 +1328,16 @@ template<bool MOSAIC> INLINE void renderline_textBG(GPU * gpu, u16 XBG, u16 YBG,
 	map = tmp_map;
 	tile = gpu->BG_tile_ram[num];
 
-	xoff = XBG;
 	pal = MMU.ARM9_VMEM + gpu->core * ADDRESS_STEP_1KB;
 
 	if(!bgCnt->Palette_256)    // color: 16 palette entries
 	{
-		yoff = ((YBG&7)<<2);
-		xfin = 8 - (xoff&7);
-		for(x = 0; x < LG; xfin = std::min<u16>(x+8, LG))
+		const TextBGCachedLine& line = GPU_getTextBGLine(gpu, num, map, tile, YBG & hmask, lg, false);
+		for(u32 x = 0; x < LG; x++)
 		{
-			u16 tilePalette = 0;
-			tmp = ((xoff&wmask)>>3);
-			mapinfo = map + (tmp&0x1F) * 2;
-			if(tmp>31) mapinfo += 32*32*2;
-			tileentry.val = T1ReadWord(MMU_gpu_map(mapinfo), 0);
-
-			tilePalette = (tileentry.bits.Palette*16);
-
-			line = (u8*)MMU_gpu_map(tile + (tileentry.bits.TileNum * 0x20) + ((tileentry.bits.VFlip) ? (7*4)-yoff : yoff));
-			
-			if(tileentry.bits.HFlip)
-			{
-				line += (3 - ((xoff&7)>>1));
-				for(; x < xfin; line --) 
-				{	
-					u8 currLine = *line;
-
-					if(!(xoff&1))
-					{
-						color = T1ReadWord(pal, ((currLine>>4) + tilePalette) << 1);
-						gpu->__setFinalColorBck<MOSAIC,false>(color,x,currLine>>4);
-						x++; xoff++;
-					}
-					
-					if(x<xfin)
-					{
-						color = T1ReadWord(pal, ((currLine&0xF) + tilePalette) << 1);
-						gpu->__setFinalColorBck<MOSAIC,false>(color,x,currLine&0xF);
-						x++; xoff++;
-					}
-				}
-			} else {
-				line += ((xoff&7)>>1);
-				for(; x < xfin; line ++) 
-				{
-					u8 currLine = *line;
-
-					if(!(xoff&1))
-					{
-						color = T1ReadWord(pal, ((currLine&0xF) + tilePalette) << 1);
-						gpu->__setFinalColorBck<MOSAIC,false>(color,x,currLine&0xF);
-						x++; xoff++;
-					}
-
-					if(x<xfin)
-					{
-						color = T1ReadWord(pal, ((currLine>>4) + tilePalette) << 1);
-						gpu->__setFinalColorBck<MOSAIC,false>(color,x,currLine>>4);
-						x++; xoff++;
-					}
-				}
-			}
+			const u8 index = line.indices[(XBG + x) & wmask];
+			color = T1ReadWord(pal, index << 1);
+			gpu->__setFinalColorBck<MOSAIC,false>(color,x,index&0xF);
 		}
 		return;
 	}
@@ -1059,37 +1350,15 @@ template<bool MOSAIC> INLINE void renderline_textBG(GPU * gpu, u16 XBG, u16 YBG,
 		if(!pal) return;
 	}
 
-	yoff = ((YBG&7)<<3);
-	u8* tilePal;
-	xfin = 8 - (xoff&7);
+	const TextBGCachedLine& line = GPU_getTextBGLine(gpu, num, map, tile, YBG & hmask, lg, true);
 	u32 extPalMask = -dispCnt->ExBGxPalette_Enable;
-	for(x = 0; x < LG; xfin = std::min<u16>(x+8, LG))
+	for(u32 x = 0; x < LG; x++)
 	{
-		tmp = (xoff & (lg-1))>>3;
-		mapinfo = map + (tmp & 31) * 2;
-		if(tmp > 31) mapinfo += 32*32*2;
-		tileentry.val = T1ReadWord(MMU_gpu_map(mapinfo), 0);
-		tilePal = pal + ((tileentry.bits.Palette<<9)&extPalMask);
-		line = (u8*)MMU_gpu_map(tile + (tileentry.bits.TileNum*0x40) + ((tileentry.bits.VFlip) ? (7*8)-yoff : yoff));
-
-		if(tileentry.bits.HFlip)
-		{
-			line += (7 - (xoff&7));
-			line_dir = -1;
-		} else {
-			line += (xoff&7);
-			line_dir = 1;
-		}
-		for(; x < xfin; )
-		{
-			color = T1ReadWord(tilePal, (*line) << 1);
-
-			gpu->__setFinalColorBck<MOSAIC,false>(color,x,*line);
-			
-			x++; xoff++;
-
-			line += line_dir;
-		}
+		const u32 px = (XBG + x) & wmask;
+		const u8 index = line.indices[px];
+		const u8* tilePal = pal + ((line.palettes[px>>3]<<9)&extPalMask);
+		color = T1ReadWord((u8*)tilePal, index << 1);
+		gpu->__setFinalColorBck<MOSAIC,false>(color,x,index);
 	}
 }
 
@@ -1429,7 +1698,7 @@ INLINE void render_sprite_Win (GPU * gpu, u16 l, u8 * src,
 		for(i = 0; i < lg; i++, sprX++,x+=xdir)
 			//sprWin[sprX] = (src[x])?1:0;
 			if(src[(x&7) + ((x&0xFFF8)<<3)]) 
-				sprWin[sprX] = 1;
+				gpu->sprWin[sprX] = 1;
 	} else {
 		for(i = 0; i < lg; i++, ++sprX, x+=xdir)
 		{
@@ -1439,7 +1708,7 @@ INLINE void render_sprite_Win (GPU * gpu, u16 l, u8 * src,
 			else       palette_entry = palette & 0xF;
 			//sprWin[sprX] = (palette_entry)?1:0;
 			if(palette_entry)
-				sprWin[sprX] = 1;
+				gpu->sprWin[sprX] = 1;
 		}
 	}
 }
@@ -1525,6 +1794,38 @@ static u32 bmp_sprite_address(GPU* gpu, _OAM_ * spriteInfo, size sprSize, s32 y)
 }
 
 
+//unpacks all of OAM and works out which lines each sprite can appear on, so that the renderer
+//doesnt have to look at every sprite on every line. the renderer still does all of its own checks on the sprites it visits
+void GPU::decodeOAM()
+{
+	memset(oamLineSprites, 0, sizeof(oamLineSprites));
+
+	for(int i = 0; i<128; i++)
+	{
+		_OAM_* spriteInfo = &oamDecoded[i];
+		SlurpOAM(spriteInfo, oam, i);
+
+		//disabled
+		if (spriteInfo->RotScale == 2)
+			continue;
+
+		//a sprite covers the lines where (line - y)&255 is within its height (doubled, for double size rotscale sprites)
+		s32 height = sprSizeTab[spriteInfo->Size][spriteInfo->Shape].y;
+		if (spriteInfo->RotScale == 3)
+			height <<= 1;
+
+		for(s32 k = 0; k < height; k++)
+		{
+			const u32 line = (spriteInfo->Y + k)&255;
+			if(line < 192)
+				oamLineSprites[line][i>>5] |= 1<<(i&31);
+		}
+	}
+
+	oamDecodedGen = oam_gen;
+	oamDecodedValid = true;
+}
+
 template<GPU::SpriteRenderMode MODE>
 void GPU::_spriteRender(u8 * dst, u8 * dst_alpha, u8 * typeTab, u8 * prioTab)
 {
@@ -1536,11 +1837,22 @@ void GPU::_spriteRender(u8 * dst, u8 * dst_alpha, u8 * typeTab, u8 * prioTab)
 	struct _DISPCNT * dispCnt = &(gpu->dispx_st)->dispx_DISPCNT.bits;
 	u8 block = gpu->sprBoundary;
 
-	for(int i = 0; i<128; i++)     
+	//debug views can ask for other lines; those just get every sprite like they used to
+	if(l >= 192)
+	{
+		for(int i = 0; i<128; i++)
+			SlurpOAM(&oamDecoded[i], gpu->oam, i);
+		oamDecodedValid = false;
+	}
+	else if(!oamDecodedValid || oamDecodedGen != oam_gen)
+		decodeOAM();
+
+	//the sprites are still visited in OAM order, since earlier ones win priority ties
+	for(int word = 0; word<4; word++)
+	for(u32 bits = (l >= 192) ? 0xFFFFFFFF : oamLineSprites[l][word]; bits; bits &= bits-1)
 	{
-		_OAM_ oam;
-		_OAM_* spriteInfo = &oam;
-		SlurpOAM(spriteInfo, gpu->oam, i);
+		const int i = (word<<5) + __builtin_ctz(bits);
+		_OAM_* spriteInfo = &oamDecoded[i];
 
 		//for each sprite:
 		if(cost>=2130)
@@ -1872,6 +2184,9 @@ void GPU::_spriteRender(u8 * dst, u8 * dst_alpha, u8 * typeTab, u8 * prioTab)
 //			SCREEN FUNCTIONS
 /*****************************************************************************/
 
+static void GPU_invalidateLineKeys();
+static void GPU_resetFrameLog();
+
 int Screen_Init()
 {
 	MainScreen.gpu = GPU_Init(0);
@@ -1880,6 +2195,8 @@ int Screen_Init()
 	memset(GPU_screen, 0, sizeof(GPU_screen));
 	for(int i = 0; i < (256*192*2); i++)
 		((u16*)GPU_screen)[i] = 0x7FFF;
+	GPU_invalidateLineKeys();
+	GPU_resetFrameLog();
 	disp_fifo.head = disp_fifo.tail = 0;
 
 	if (osd)  {delete osd; osd =NULL; }
@@ -1898,6 +2215,8 @@ void Screen_Reset(void)
 	memset(GPU_screen, 0, sizeof(GPU_screen));
 	for(int i = 0; i < (256*192*2); i++)
 		((u16*)GPU_screen)[i] = 0x7FFF;
+	GPU_invalidateLineKeys();
+	GPU_resetFrameLog();
 
 	disp_fifo.head = disp_fifo.tail = 0;
 	osd->clear();
@@ -1964,9 +2283,48 @@ void GPU_set_DISPCAPCNT(u32 val)
 			gpu->dispCapCnt.srcA, gpu->dispCapCnt.srcB);*/
 }
 
+//on a line with no windows, each BG layer is drawn into a line buffer of its own (with no color effect),
+//then gets its color effect applied and is laid over the output a whole line at a time,
+//instead of going through the per-pixel window and effect checks.
+//3d and sprites still draw per pixel, which works out since bgPixels is kept up to date by the layer drawing as usual
+static FORCEINLINE bool GPU_RenderLine_isSimpleComposite(GPU * gpu)
+{
+	return gpu->setFinalColorBck_funcNum < 4;
+}
+
+//copies every pixel of the layer line which was drawn (has bit 15 set) over dst
+static FORCEINLINE void GPU_RenderLine_mergeLayer(u8 * dst, const u16 * layerLine)
+{
+#if defined(ENABLE_SSE2)
+	for(int i=0;i<256;i+=8)
+	{
+		const __m128i src = _mm_load_si128((const __m128i*)(layerLine+i));
+		const __m128i drawn = _mm_srai_epi16(src,15);
+		const __m128i old = _mm_load_si128((const __m128i*)(dst+i*2));
+		_mm_store_si128((__m128i*)(dst+i*2), _mm_or_si128(_mm_and_si128(drawn,src),_mm_andnot_si128(drawn,old)));
+	}
+#elif defined(ENABLE_NEON)
+	for(int i=0;i<256;i+=8)
+	{
+		const uint16x8_t src = vld1q_u16(layerLine+i);
+		const uint16x8_t drawn = vreinterpretq_u16_s16(vshrq_n_s16(vreinterpretq_s16_u16(src),15));
+		vst1q_u16((u16*)(dst+i*2), vbslq_u16(drawn,src,vld1q_u16((const u16*)(dst+i*2))));
+	}
+#else
+	for(int i=0;i<256;i++)
+	{
+		const u16 color = HostReadWord((u8*)layerLine,i<<1);
+		if(color & 0x8000)
+			HostWriteWord(dst,i<<1,color);
+	}
+#endif
+}
+
 static void GPU_RenderLine_layer(NDS_Screen * screen, u16 l)
 {
 	CACHE_ALIGN u8 spr[512];
+	CACHE_ALIGN u16 layerLine[256];
+	CACHE_ALIGN u16 layerBlendUnder[256];
 	CACHE_ALIGN u8 sprAlpha[256];
 	CACHE_ALIGN u8 sprType[256];
 	CACHE_ALIGN u8 sprPrio[256];
@@ -2019,7 +2377,7 @@ PLAIN_CLEAR:
 	memset(sprAlpha, 0, 256);
 	memset(sprType, 0, 256);
 	memset(sprPrio, 0xFF, 256);
-	memset(sprWin, 0, 256);
+	memset(gpu->sprWin, 0, 256);
 	
 	// init pixels priorities
 	assert(NB_PRIORITIES==4);
@@ -2059,6 +2417,8 @@ PLAIN_CLEAR:
 	for(int j=0;j<8;j++)
 		gpu->blend2[j] = (gpu->BLDCNT & (0x100 << j))!=0;
 
+	const bool simpleComposite = GPU_RenderLine_isSimpleComposite(gpu);
+
 	// paint lower priorities first
 	// then higher priorities on top
 	for(int prio=NB_PRIORITIES; prio > 0; )
@@ -2111,12 +2471,41 @@ PLAIN_CLEAR:
 
 
 
+					//without any color effect nothing reads back the output while drawing, so the layer can go to its own buffer
+					u8* lineDst = gpu->currDst;
+					const int funcNum = gpu->setFinalColorBck_funcNum;
+					if(simpleComposite)
+					{
+						memset(layerLine,0,sizeof(layerLine));
+						gpu->currDst = (u8*)layerLine;
+						gpu->setFinalColorBck_funcNum = 0;
+
+						//drawing the layer changes bgPixels, so see what it would blend with first
+						if(funcNum == 1 && gpu->blend1)
+							for(int x=0;x<256;x++)
+								layerBlendUnder[x] = gpu->blend2[gpu->bgPixels[x]] ? 0xFFFF : 0;
+					}
+
 #ifndef DISABLE_MOSAIC
 					if(gpu->curr_mosaic_enabled)
 						gpu->modeRender<true>(i16);
 					else 
 #endif
 						gpu->modeRender<false>(i16);
+
+					if(simpleComposite)
+					{
+						gpu->currDst = lineDst;
+						gpu->setFinalColorBck_funcNum = funcNum;
+						if(gpu->blend1)
+							switch(funcNum)
+							{
+								case 1: GPU_blendLine(layerLine, layerLine, (u16*)lineDst, layerBlendUnder, gpu->BLDALPHA_EVA, gpu->BLDALPHA_EVB, 0x8000); break;
+								case 2: GPU_fadeInLine(layerLine, layerLine, gpu->BLDY_EVY, 0x8000); break;
+								case 3: GPU_fadeOutLine(layerLine, layerLine, gpu->BLDY_EVY, 0x8000); break;
+							}
+						GPU_RenderLine_mergeLayer(lineDst,layerLine);
+					}
 				} //layer enabled
 			}
 		}
@@ -2138,20 +2527,6 @@ PLAIN_CLEAR:
 
 template<bool SKIP> static void GPU_RenderLine_DispCapture(u16 l)
 {
-	//this macro takes advantage of the fact that there are only two possible values for capx
-	#define CAPCOPY(SRC,DST,SETALPHABIT) \
-	switch(gpu->dispCapCnt.capx) { \
-		case DISPCAPCNT::_128: \
-			for (int i = 0; i < 128; i++)  \
-				HostWriteWord(DST, i << 1, HostReadWord(SRC, i << 1) | (SETALPHABIT?(1<<15):0)); \
-			break; \
-		case DISPCAPCNT::_256: \
-			for (int i = 0; i < 256; i++)  \
-				HostWriteWord(DST, i << 1, HostReadWord(SRC, i << 1) | (SETALPHABIT?(1<<15):0)); \
-			break; \
-			default: assert(false); \
-		}
-	
 	GPU * gpu = MainScreen.gpu;
 
 	if (l == 0)
@@ -2195,42 +2570,33 @@ template<bool SKIP> static void GPU_RenderLine_DispCapture(u16 l)
 		if(!skip)
 		if (l < gpu->dispCapCnt.capy)
 		{
-			switch (gpu->dispCapCnt.capSrc)
+			const int todo = (gpu->dispCapCnt.capx==DISPCAPCNT::_128?128:256);
+			u16 * dst = (u16*)cap_dst;
+
+			//source A: the 2d engine output or the 3d line
+			u16 * srcA = NULL;
+			if(gpu->dispCapCnt.capSrc != 1)
 			{
-				case 0:		// Capture source is SourceA
-					{
-						//INFO("Capture source is SourceA\n");
-						switch (gpu->dispCapCnt.srcA)
-						{
-							case 0:			// Capture screen (BG + OBJ + 3D)
-								{
-									//INFO("Capture screen (BG + OBJ + 3D)\n");
-									u8 *src = (u8*)(gpu->tempScanline);
+				if (gpu->dispCapCnt.srcA == 0)
+				{
+					// Capture screen (BG + OBJ + 3D)
+					srcA = (u16*)(gpu->tempScanline);
 #ifdef LOCAL_BE
-									static u16 swapSrc[256];
-									const size_t swapSrcSize = (gpu->dispCapCnt.capx == DISPCAPCNT::_128) ? 128 : 256;
-									
-									for(size_t i = 0; i < swapSrcSize; i++)
-									{
-										swapSrc[i] = LE_TO_LOCAL_16(((u16 *)src)[i]);
-									}
-									
-									CAPCOPY((u8 *)swapSrc,cap_dst,true);
-#else
-									CAPCOPY(src,cap_dst,true);
+					static u16 swapSrc[256];
+					for(int i = 0; i < todo; i++)
+						swapSrc[i] = LE_TO_LOCAL_16(srcA[i]);
+					srcA = swapSrc;
 #endif
-								}
-							break;
-							case 1:			// Capture 3D
-								{
-									//INFO("Capture 3D\n");
-									u16* colorLine;
-									gfx3d_GetLineData15bpp(l, &colorLine);
-									CAPCOPY(((u8*)colorLine),cap_dst,false);
-								}
-							break;
-						}
-					}
+				}
+				else
+					gfx3d_GetLineData15bpp(l, &srcA);
+			}
+
+			switch (gpu->dispCapCnt.capSrc)
+			{
+				case 0:		// Capture source is SourceA
+					//the 2d output gets its alpha bit set, the 3d line keeps its own
+					GPU_captureCopyLine(dst, srcA, todo, (gpu->dispCapCnt.srcA == 0) ? 0x8000 : 0);
 				break;
 				case 1:		// Capture source is SourceB
 					{
@@ -2239,7 +2605,7 @@ template<bool SKIP> static void GPU_RenderLine_DispCapture(u16 l)
 						{
 							case 0:	
 								//Capture VRAM
-								CAPCOPY(cap_src,cap_dst,true);
+								GPU_captureCopyLine(dst, (u16*)cap_src, todo, 0x8000);
 								break;
 							case 1:
 								//capture dispfifo
@@ -2253,19 +2619,7 @@ template<bool SKIP> static void GPU_RenderLine_DispCapture(u16 l)
 				default:	// Capture source is SourceA+B blended
 					{
 						//INFO("Capture source is SourceA+B blended\n");
-						u16 *srcA = NULL;
 						u16 *srcB = NULL;
-
-						if (gpu->dispCapCnt.srcA == 0)
-						{
-							// Capture screen (BG + OBJ + 3D)
-							srcA = (u16*)(gpu->tempScanline);
-						}
-						else
-						{
-							gfx3d_GetLineData15bpp(l, &srcA);
-						}
-
 						static u16 fifoLine[256];
 
 						if (gpu->dispCapCnt.srcB == 0)			// VRAM screen
@@ -2278,48 +2632,15 @@ template<bool SKIP> static void GPU_RenderLine_DispCapture(u16 l)
 								T1WriteLong((u8*)srcB, i << 2, DISP_FIFOrecv());
 						}
 
-
-						const int todo = (gpu->dispCapCnt.capx==DISPCAPCNT::_128?128:256);
-
-						for(u16 i = 0; i < todo; i++) 
-						{
-							u16 a,r,g,b;
-
-							u16 a_alpha = srcA[i] & 0x8000;
-							u16 b_alpha = srcB[i] & 0x8000;
-
-							if(a_alpha)
-							{
-								a = 0x8000;
-								r = ((srcA[i] & 0x1F) * gpu->dispCapCnt.EVA);
-								g = (((srcA[i] >>  5) & 0x1F) * gpu->dispCapCnt.EVA);
-								b = (((srcA[i] >>  10) & 0x1F) * gpu->dispCapCnt.EVA);
-							} 
-							else
-								a = r = g = b = 0;
-
-							if(b_alpha)
-							{
-								a = 0x8000;
-								r += ((srcB[i] & 0x1F) * gpu->dispCapCnt.EVB);
-								g += (((srcB[i] >>  5) & 0x1F) * gpu->dispCapCnt.EVB);
-								b += (((srcB[i] >> 10) & 0x1F) * gpu->dispCapCnt.EVB);
-							}
-
-							r >>= 4;
-							g >>= 4;
-							b >>= 4;
-
-							//freedom wings sky will overflow while doing some fsaa/motionblur effect without this
-							r = std::min((u16)31,r);
-							g = std::min((u16)31,g);
-							b = std::min((u16)31,b);
-
-							HostWriteWord(cap_dst, i << 1, a | (b << 10) | (g << 5) | r);
-						}
+						//freedom wings sky will overflow while doing some fsaa/motionblur effect without the clamping in here
+						GPU_captureBlendLine(dst, srcA, srcB, todo, gpu->dispCapCnt.EVA, gpu->dispCapCnt.EVB);
 					}
 				break;
 			}
+
+			//captures write straight into vram, so tell anyone tracking it (such as the texture cache).
+			//lines are at least 256 byte aligned so a single line never straddles two pages
+			MMU_VRAM_markDirty(0x06000000 + cap_dst_adr);
 		}
 
 		if (l>=191)
@@ -2359,12 +2680,7 @@ static INLINE void GPU_RenderLine_MasterBrightness(NDS_Screen * screen, u16 l)
 		case 1:
 		{
 			if(factor != 16)
-			{
-				for(i16 = 0; i16 < 256; ++i16)
-				{
-					((u16*)dst)[i16] = fadeInColors[factor][((u16*)dst)[i16]&0x7FFF];
-				}
-			}
+				GPU_fadeInLine((u16*)dst, (u16*)dst, factor, 0);
 			else
 			{
 				// all white (optimization)
@@ -2378,12 +2694,7 @@ static INLINE void GPU_RenderLine_MasterBrightness(NDS_Screen * screen, u16 l)
 		case 2:
 		{
 			if(factor != 16)
-			{
-				for(i16 = 0; i16 < 256; ++i16)
-				{
-					((u16*)dst)[i16] = fadeOutColors[factor][((u16*)dst)[i16]&0x7FFF];
-				}
-			}
+				GPU_fadeOutLine((u16*)dst, (u16*)dst, factor, 0);
 			else
 			{
 				// all black (optimization)
@@ -2485,9 +2796,172 @@ void GPU::update_winh(int WIN_NUM)
 	}
 }
 
-void GPU_RenderLine(NDS_Screen * screen, u16 l, bool skip)
+//an output line which would be drawn from exactly the same state as last time is left as it is in GPU_screen.
+//the state is everything a line is drawn from: the engine's registers, and the generations of palette, OAM,
+//the vram pages the engine maps (and the mapping itself), which the MMU bumps on every write.
+//keys are kept per GPU_screen line, since screens can swap.
+struct GPU_LineKey
+{
+	u8 regs[0x50]; //0x0400x008-0x0400x057: BG control, scrolling, affine, windows, mosaic and blending
+	u32 dispcnt;
+	u32 paletteGen, oamGen, vramGen, vramMapGen;
+	u8 * vramAddr;
+	u32 masterBrightFactor;
+	u8 masterBrightMode;
+	u8 dispMode;
+	u8 core;
+	u8 layersEnable;
+	u16 line;
+};
+static GPU_LineKey GPU_lineKeys[384];
+static bool GPU_lineKeyValid[384];
+static u32 GPU_linesDrawn[2]; //per engine, since the engines may be drawn on different threads
+static bool gpu_frameReplaying = false; //drawing logged lines, which works gpu_frameUnchanged out itself once both engines are done
+bool gpu_frameUnchanged = false;
+
+
+//every page write bumps this by one, so the same sum means no writes
+static u32 GPU_vramGen()
+{
+	u32 gen = 0;
+	for(int i=0;i<VRAM_GEN_PAGES;i++)
+		gen += vram_page_gen[i];
+	return gen;
+}
+
+//the vram pages (indexes into vram_page_gen) an engine reads from: the banks mapped as its BG and OBJ memory,
+//and its extended palettes. they only change with the mapping, so they are only worked out again then
+struct GPU_VramPages
+{
+	bool valid;
+	u32 mapGen;
+	u32 count;
+	u8 pages[VRAM_GEN_PAGES];
+};
+static GPU_VramPages GPU_enginePages[2]; //per engine, since the engines may be drawn on different threads
+
+static void GPU_addVramPage(GPU_VramPages & list, bool* seen, u32 page)
+{
+	page &= VRAM_GEN_PAGES-1;
+	if(seen[page]) return;
+	seen[page] = true;
+	list.pages[list.count++] = page;
+}
+
+static void GPU_findVramPages(GPU * gpu, GPU_VramPages & list)
+{
+	bool seen[VRAM_GEN_PAGES] = {};
+	list.count = 0;
+
+	const u32 bgFirst = gpu->core == GPU_MAIN ? VRAM_PAGE_ABG : VRAM_PAGE_BBG;
+	const u32 bgPages = gpu->core == GPU_MAIN ? 32 : 8; //512KB or 128KB
+	const u32 objFirst = gpu->core == GPU_MAIN ? VRAM_PAGE_AOBJ : VRAM_PAGE_BOBJ;
+	const u32 objPages = gpu->core == GPU_MAIN ? 16 : 8; //256KB or 128KB
+	for(u32 i=0;i<bgPages;i++)
+		GPU_addVramPage(list, seen, vram_arm9_map[bgFirst+i]);
+	for(u32 i=0;i<objPages;i++)
+		GPU_addVramPage(list, seen, vram_arm9_map[objFirst+i]);
+
+	for(int i=0;i<4;i++)
+		GPU_addVramPage(list, seen, MMU_VRAM_page(MMU.ExtPal[gpu->core][i]));
+	for(int i=0;i<2;i++)
+		GPU_addVramPage(list, seen, MMU_VRAM_page(MMU.ObjExtPal[gpu->core][i]));
+
+	list.mapGen = vram_map_gen;
+	list.valid = true;
+}
+
+static void GPU_invalidateLineKeys()
+{
+	memset(GPU_lineKeyValid, 0, sizeof(GPU_lineKeyValid));
+	GPU_enginePages[0].valid = GPU_enginePages[1].valid = false;
+	gpu_frameUnchanged = false;
+}
+
+//like GPU_vramGen, but only over the pages the engine can draw from, so that vram it doesnt see
+//(textures, say) can be written without throwing away its lines
+static u32 GPU_engineVramGen(GPU * gpu)
+{
+	GPU_VramPages & list = GPU_enginePages[gpu->core];
+	if(!list.valid || list.mapGen != vram_map_gen)
+		GPU_findVramPages(gpu, list);
+
+	u32 gen = 0;
+	for(u32 i=0;i<list.count;i++)
+		gen += vram_page_gen[list.pages[i]];
+
+	//display mode 2 shows an LCDC bank straight from vram
+	if(gpu->dispMode == 2)
+	{
+		const u32 first = MMU_VRAM_page(gpu->VRAMaddr);
+		for(u32 i=0;i<8;i++)
+			gen += vram_page_gen[(first+i)&(VRAM_GEN_PAGES-1)];
+	}
+	return gen;
+}
+
+static void GPU_makeLineKey(GPU * gpu, u16 l, GPU_LineKey & key)
+{
+	//zeroed first so that padding compares equal
+	memset(&key, 0, sizeof(key));
+	memcpy(key.regs, (u8*)gpu->dispx_st + 8, sizeof(key.regs));
+	key.dispcnt = gpu->dispx_st->dispx_DISPCNT.val;
+	key.paletteGen = palette_gen;
+	key.oamGen = oam_gen;
+	key.vramGen = GPU_engineVramGen(gpu);
+	key.vramMapGen = vram_map_gen;
+	key.vramAddr = gpu->VRAMaddr;
+	key.masterBrightFactor = gpu->MasterBrightFactor;
+	key.masterBrightMode = gpu->MasterBrightMode;
+	key.dispMode = gpu->dispMode;
+	key.core = gpu->core;
+	for(int i=0;i<5;i++)
+		key.layersEnable |= (gpu->LayersEnable[i] ? 1 : 0) << i;
+	key.line = l;
+}
+
+//some lines have to be drawn every time no matter what
+static bool GPU_lineReusable(GPU * gpu)
+{
+	if(!CommonSettings.GFX2D_ReuseLines || gpu->debug) return false;
+
+	//mosaic lines depend on what was drawn on the lines before them
+	if(T1ReadWord((u8 *)&gpu->dispx_st->dispx_MISC.MOSAIC, 0) != 0) return false;
+
+	//the display fifo is consumed by displaying it
+	if(gpu->dispMode == 3) return false;
+
+	if(gpu->core == GPU_MAIN)
+	{
+		//capturing writes to vram, so it has to happen (a pending capture is latched on line 0)
+		if(gpu->dispCapCnt.enabled || (gpu->dispCapCnt.val & 0x80000000)) return false;
+
+		//3d changes without us knowing
+		if(gpu->dispCnt().BG0_3D && gpu->LayersEnable[0]) return false;
+	}
+
+	return true;
+}
+
+//does to the affine BGs' reference points what drawing the line would have done
+static void GPU_advanceAffineBGs(GPU * gpu)
+{
+	for(int num=2;num<4;num++)
+	{
+		if(!gpu->LayersEnable[num]) continue;
+		const BGType type = GPU_mode2type[gpu->dispCnt().BG_Mode][num];
+		if(type == BGType_Text || type == BGType_Invalid) continue;
+
+		BGxPARMS * parms = (num == 2) ? &gpu->dispx_st->dispx_BG2PARMS : &gpu->dispx_st->dispx_BG3PARMS;
+		parms->BGxX += parms->BGxPB;
+		parms->BGxY += parms->BGxPD;
+	}
+}
+
+static void GPU_RenderLine_screen(NDS_Screen * screen, u16 l, bool skip)
 {
 	GPU * gpu = screen->gpu;
+	const int outLine = screen->offset + l;
 
 	//here is some setup which is only done on line 0
 	if(l == 0) {
@@ -2521,6 +2995,8 @@ void GPU_RenderLine(NDS_Screen * screen, u16 l, bool skip)
 	{
 		u8 * dst =  GPU_screen + (screen->offset + l) * 512;
 		memset(dst,0,512);
+		GPU_lineKeyValid[outLine] = false;
+		GPU_linesDrawn[gpu->core]++;
 		return;
 	}
 
@@ -2532,6 +3008,8 @@ void GPU_RenderLine(NDS_Screen * screen, u16 l, bool skip)
 		{
 			gpu->currLine = l;
 			GPU_RenderLine_MasterBrightness(screen, l);
+			GPU_lineKeyValid[outLine] = false;
+			GPU_linesDrawn[gpu->core]++;
 			return;
 		}
 	}
@@ -2545,10 +3023,10 @@ void GPU_RenderLine(NDS_Screen * screen, u16 l, bool skip)
 	//mosaic test hacks
 	//mosaic_width = mosaic_height = 3;
 
-	GPU::mosaicLookup.widthValue = mosaic_width;
-	GPU::mosaicLookup.heightValue = mosaic_height;
-	GPU::mosaicLookup.width = &GPU::mosaicLookup.table[mosaic_width][0];
-	GPU::mosaicLookup.height = &GPU::mosaicLookup.table[mosaic_height][0];
+	gpu->mosaicLookup.widthValue = mosaic_width;
+	gpu->mosaicLookup.heightValue = mosaic_height;
+	gpu->mosaicLookup.width = &GPU::mosaicTable.table[mosaic_width][0];
+	gpu->mosaicLookup.height = &GPU::mosaicTable.table[mosaic_height][0];
 
 	if(gpu->need_update_winh[0]) gpu->update_winh(0);
 	if(gpu->need_update_winh[1]) gpu->update_winh(1);
@@ -2556,6 +3034,23 @@ void GPU_RenderLine(NDS_Screen * screen, u16 l, bool skip)
 	gpu->setup_windows<0>();
 	gpu->setup_windows<1>();
 
+	if(GPU_lineReusable(gpu))
+	{
+		GPU_LineKey key;
+		GPU_makeLineKey(gpu, l, key);
+		if(GPU_lineKeyValid[outLine] && !memcmp(&key, &GPU_lineKeys[outLine], sizeof(key)))
+		{
+			GPU_advanceAffineBGs(gpu);
+			if (gpu->core == GPU_MAIN && l == 191) { disp_fifo.head = disp_fifo.tail = 0; }
+			return;
+		}
+		GPU_lineKeys[outLine] = key;
+		GPU_lineKeyValid[outLine] = true;
+	}
+	else
+		GPU_lineKeyValid[outLine] = false;
+	GPU_linesDrawn[gpu->core]++;
+
 	//generate the 2d engine output
 	if(gpu->dispMode == 1) {
 		//optimization: render straight to the output buffer when thats what we are going to end up displaying anyway
@@ -2621,6 +3116,249 @@ void GPU_RenderLine(NDS_Screen * screen, u16 l, bool skip)
 	GPU_RenderLine_MasterBrightness(screen, l);
 }
 
+void GPU_RenderLine(NDS_Screen * screen, u16 l, bool skip)
+{
+	if(l == 0)
+		GPU_linesDrawn[screen->gpu->core] = 0;
+
+	GPU_RenderLine_screen(screen, l, skip);
+
+	//the sub engine goes last
+	if(l == 191 && screen->gpu->core == GPU_SUB && !gpu_frameReplaying)
+		gpu_frameUnchanged = (GPU_linesDrawn[GPU_MAIN] == 0 && GPU_linesDrawn[GPU_SUB] == 0);
+}
+
+//frame at a time drawing (CommonSettings.GFX2D_FrameRender).
+//instead of drawing each line at its hblank, in between bits of cpu emulation, we log the registers each line is drawn from
+//and draw the whole frame at the last hblank, so the cpu and the 2d engines dont keep evicting each other from the cache.
+//vram, palette and oam cant be logged like that. a frame which writes to them while it is being displayed (or which
+//captures, or displays the fifo) is finished line by line from the line it was noticed on, with the lines before it drawn
+//from memory as it is by then. the next few frames are then drawn line by line, until the game has hopefully settled down.
+
+//0x04000000-0x0400006F, or the same for the sub engine
+#define GPU_FRAME_REGS 0x70
+//frames drawn line by line after a frame had to be finished that way
+#define GPU_FRAME_COOLDOWN 60
+
+struct GPU_FrameLine
+{
+	u8 regs[2][GPU_FRAME_REGS];
+	GPU::AffineInfo affineInfo[2][2];
+	u32 affineWrites[2][2][2];
+};
+
+struct GPU_FrameLog
+{
+	bool logging;
+	u32 cooldown;
+
+	//what the frame started out with
+	u32 paletteGen, oamGen, vramGen, vramMapGen;
+	u16 mainOffset;
+
+	GPU_FrameLine lines[192];
+};
+static GPU_FrameLog* gpuFrameLog = NULL;
+static Task* gpuFrameTask = NULL;
+
+static void GPU_logLine(GPU_FrameLine & line)
+{
+	NDS_Screen* screens[2] = { &MainScreen, &SubScreen };
+	for(int i=0;i<2;i++)
+	{
+		GPU * gpu = screens[i]->gpu;
+		memcpy(line.regs[gpu->core], gpu->dispx_st, GPU_FRAME_REGS);
+		memcpy(line.affineInfo[gpu->core], gpu->affineInfo, sizeof(gpu->affineInfo));
+		memcpy(line.affineWrites[gpu->core], gpu->affineWrites, sizeof(gpu->affineWrites));
+	}
+}
+
+//brings the engine's registers to what they were when the line was logged, through the setters the MMU uses.
+//the live registers always hold what was last applied, so only what differs needs to go through them
+static void GPU_applyLoggedLine(GPU * gpu, const GPU_FrameLine & line, const GPU_FrameLine * prev)
+{
+	const u8 * regs = line.regs[gpu->core];
+	u8 * curr = (u8*)gpu->dispx_st;
+
+	if(T1ReadLong(curr, 0) != T1ReadLong(regs, 0))
+		GPU_setVideoProp(gpu, T1ReadLong(regs, 0));
+
+	for(u32 ofs = 0x08; ofs < 0x58; ofs += 2)
+	{
+		//the reference points double as the affine accumulators, so they are done below
+		if((ofs >= 0x28 && ofs < 0x30) || (ofs >= 0x38 && ofs < 0x40)) continue;
+
+		const u16 val = T1ReadWord(regs, ofs);
+		if(T1ReadWord(curr, ofs) == val) continue;
+		T1WriteWord(curr, ofs, val);
+
+		switch(ofs)
+		{
+			case 0x08: case 0x0A: case 0x0C: case 0x0E: GPU_setBGProp(gpu, (ofs - 0x08) >> 1, val); break;
+			case 0x40: GPU_setWIN0_H(gpu, val); break;
+			case 0x42: GPU_setWIN1_H(gpu, val); break;
+			case 0x44: GPU_setWIN0_V(gpu, val); break;
+			case 0x46: GPU_setWIN1_V(gpu, val); break;
+			case 0x48: GPU_setWININ(gpu, val); break;
+			case 0x4A: GPU_setWINOUT16(gpu, val); break;
+			case 0x50: GPU_setBLDCNT(gpu, val); break;
+			case 0x52: gpu->setBLDALPHA(val); break;
+			case 0x54: GPU_setBLDY_EVY(gpu, val); break;
+			default: break; //scrolling, affine parameters and mosaic are only kept in the registers
+		}
+	}
+
+	const u16 masterBright = T1ReadWord(regs, 0x6C);
+	if(T1ReadWord(curr, 0x6C) != masterBright)
+	{
+		T1WriteWord(curr, 0x6C, masterBright);
+		GPU_setMasterBrightness(gpu, masterBright);
+	}
+
+	//line 0 restarts all the reference points by itself, later lines only restart what was written
+	for(int i=0;i<2;i++)
+	{
+		gpu->affineInfo[i] = line.affineInfo[gpu->core][i];
+		if(!prev) continue;
+		for(int xy=0;xy<2;xy++)
+			if(line.affineWrites[gpu->core][i][xy] != prev->affineWrites[gpu->core][i][xy])
+				gpu->refreshAffineStartRegs(i+2, xy);
+	}
+}
+
+static void GPU_renderLoggedLines(NDS_Screen * screen, int count)
+{
+	for(int l=0;l<count;l++)
+	{
+		GPU_applyLoggedLine(screen->gpu, gpuFrameLog->lines[l], l ? &gpuFrameLog->lines[l-1] : NULL);
+		GPU_RenderLine(screen, l, false);
+	}
+}
+
+static int gpuFrameLogCount;
+static void* GPU_renderLoggedSubLines(void*)
+{
+	GPU_renderLoggedLines(&SubScreen, gpuFrameLogCount);
+	return NULL;
+}
+
+//draws the first count logged lines. the last one logged must be the current state, which the registers are left at
+static void GPU_renderLogged(int count)
+{
+	gpu_frameReplaying = true;
+	if(CommonSettings.GFX2D_FrameThread && !CommonSettings.single_core())
+	{
+		if(!gpuFrameTask)
+		{
+			gpuFrameTask = new Task();
+			gpuFrameTask->start(false);
+		}
+		gpuFrameLogCount = count;
+		gpuFrameTask->execute(GPU_renderLoggedSubLines, NULL);
+		GPU_renderLoggedLines(&MainScreen, count);
+		gpuFrameTask->finish();
+	}
+	else
+	{
+		GPU_renderLoggedLines(&MainScreen, count);
+		GPU_renderLoggedLines(&SubScreen, count);
+	}
+	gpu_frameReplaying = false;
+
+	//the sub engine may have finished before the main one did
+	if(count == 192)
+		gpu_frameUnchanged = (GPU_linesDrawn[GPU_MAIN] == 0 && GPU_linesDrawn[GPU_SUB] == 0);
+}
+
+//checked on line 0: capturing writes to vram, which later lines may display (captures only start on line 0)
+static bool GPU_frameLoggable()
+{
+	GPU * main = MainScreen.gpu;
+	return !main->dispCapCnt.enabled && !(main->dispCapCnt.val & 0x80000000) && main->dispMode != 3;
+}
+
+//checked on every line
+static bool GPU_frameLogBroken()
+{
+	//the display fifo is filled by dma as the frame goes
+	if(MainScreen.gpu->dispMode == 3) return true;
+
+	return gpuFrameLog->paletteGen != palette_gen || gpuFrameLog->oamGen != oam_gen
+		|| gpuFrameLog->vramGen != GPU_vramGen() || gpuFrameLog->vramMapGen != vram_map_gen
+		|| gpuFrameLog->mainOffset != MainScreen.offset;
+}
+
+static void GPU_resetFrameLog()
+{
+	if(!gpuFrameLog) return;
+	gpuFrameLog->logging = false;
+	gpuFrameLog->cooldown = 0;
+}
+
+static void GPU_freeFrameLog()
+{
+	if(gpuFrameTask)
+	{
+		gpuFrameTask->shutdown();
+		delete gpuFrameTask;
+		gpuFrameTask = NULL;
+	}
+	delete gpuFrameLog;
+	gpuFrameLog = NULL;
+}
+
+void GPU_RenderLines(u16 l, bool skip)
+{
+	if(l == 0)
+	{
+		const bool wanted = CommonSettings.GFX2D_FrameRender && !skip;
+		if(wanted && !gpuFrameLog)
+		{
+			gpuFrameLog = new GPU_FrameLog();
+			GPU_resetFrameLog();
+		}
+		if(gpuFrameLog)
+		{
+			gpuFrameLog->logging = false;
+			if(gpuFrameLog->cooldown)
+				gpuFrameLog->cooldown--;
+			else if(wanted && GPU_frameLoggable())
+			{
+				gpuFrameLog->logging = true;
+				gpuFrameLog->paletteGen = palette_gen;
+				gpuFrameLog->oamGen = oam_gen;
+				gpuFrameLog->vramGen = GPU_vramGen();
+				gpuFrameLog->vramMapGen = vram_map_gen;
+				gpuFrameLog->mainOffset = MainScreen.offset;
+			}
+		}
+	}
+
+	if(!gpuFrameLog || !gpuFrameLog->logging)
+	{
+		GPU_RenderLine(&MainScreen, l, skip);
+		GPU_RenderLine(&SubScreen, l, skip);
+		return;
+	}
+
+	GPU_logLine(gpuFrameLog->lines[l]);
+
+	//the game has changed something we cant log: finish the frame line by line
+	if(GPU_frameLogBroken())
+	{
+		GPU_renderLogged(l + 1);
+		gpuFrameLog->logging = false;
+		gpuFrameLog->cooldown = GPU_FRAME_COOLDOWN;
+		return;
+	}
+
+	if(l == 191)
+	{
+		GPU_renderLogged(192);
+		gpuFrameLog->logging = false;
+	}
+}
+
 void gpu_savestate(EMUFILE* os)
 {
 	//version
@@ -2658,6 +3396,8 @@ bool gpu_loadstate(EMUFILE* is, int size)
 	if(version<0||version>1) return false;
 
 	is->fread((char*)GPU_screen,sizeof(GPU_screen));
+	GPU_invalidateLineKeys();
+	GPU_resetFrameLog();
 
 	if(version==1)
 	{
@@ -2697,6 +3437,7 @@ void GPU::setAffineStart(int layer, int xy, u32 val)
 {
 	if(xy==0) affineInfo[layer-2].x = val;
 	else affineInfo[layer-2].y = val;
+	affineWrites[layer-2][xy]++;
 	refreshAffineStartRegs(layer,xy);
 }
 
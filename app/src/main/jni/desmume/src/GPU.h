@@ -691,13 +691,13 @@ struct GPU
 	u8* _3dColorLine;
 
 
-	static struct MosaicLookup {
+	static struct MosaicTable {
 
 		struct TableEntry {
 			u8 begin, trunc;
 		} table[16][256];
 
-		MosaicLookup() {
+		MosaicTable() {
 			for(int m=0;m<16;m++)
 				for(int i=0;i<256;i++) {
 					int mosaic = m+1;
@@ -706,10 +706,12 @@ struct GPU
 					te.trunc = i/mosaic*mosaic;
 				}
 		}
+	} mosaicTable;
 
-		TableEntry *width, *height;
+	//the current line's mosaic size. per engine, since the two can render their lines at the same time (GPU_renderLogged)
+	struct MosaicLookup {
+		MosaicTable::TableEntry *width, *height;
 		int widthValue, heightValue;
-		
 	} mosaicLookup;
 	bool curr_mosaic_enabled;
 
@@ -732,6 +734,16 @@ struct GPU
 
 	template<GPU::SpriteRenderMode MODE>
 	void _spriteRender(u8 * dst, u8 * dst_alpha, u8 * typeTab, u8 * prioTab);
+
+	//OAM decoded once (until oam_gen says it was written), with a bit per sprite for each line that sprite may cover
+	_OAM_ oamDecoded[128];
+	u32 oamLineSprites[192][4];
+	u32 oamDecodedGen;
+	bool oamDecodedValid;
+	void decodeOAM();
+
+	//the OBJ window for the line being drawn (one per engine so that the engines can be drawn on different threads)
+	u8 sprWin[256];
 	
 	inline void spriteRender(u8 * dst, u8 * dst_alpha, u8 * typeTab, u8 * prioTab)
 	{
@@ -758,6 +770,9 @@ struct GPU
 		u32 x, y;
 	} affineInfo[2];
 
+	//bumped by every write to a reference point ([layer-2][xy]), since writing the same value again still restarts it
+	u32 affineWrites[2][2];
+
 	void renderline_checkWindows(u16 x, bool &draw, bool &effect) const;
 
 	// check whether (x,y) is within the rectangle (including wraparounds) 
@@ -816,6 +831,8 @@ static void REG_DISPx_pack_test(GPU * gpu)
 #endif
 
 CACHE_ALIGN extern u8 GPU_screen[4*256*192];
+//set after both screens are drawn when no line of the frame had to be redrawn, so GPU_screen is as it was
+extern bool gpu_frameUnchanged;
 
 
 GPU * GPU_Init(u8 l);
@@ -863,6 +880,8 @@ int GPU_ChangeGraphicsCore(int coreid);
 
 void GPU_set_DISPCAPCNT(u32 val) ;
 void GPU_RenderLine(NDS_Screen * screen, u16 l, bool skip = false) ;
+//draws line l of both engines, or logs it to be drawn with the rest of the frame (see CommonSettings.GFX2D_FrameRender)
+void GPU_RenderLines(u16 l, bool skip = false);
 void GPU_setMasterBrightness (GPU *gpu, u16 val);
 
 inline void GPU_setWIN0_H(GPU* gpu, u16 val) { gpu->WIN0H0 = val >> 8; gpu->WIN0H1 = val&0xFF; gpu->need_update_winh[0] = true; }
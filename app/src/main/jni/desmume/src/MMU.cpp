@@ -285,6 +285,13 @@ u8 vram_arm9_map[VRAM_ARM9_PAGES];
 //this chooses which banks are mapped in the 128K banks starting at 0x06000000 in ARM7
 u8 vram_arm7_map[2];
 
+u32 vram_page_gen[VRAM_GEN_PAGES];
+u32 oam_gen;
+u32 palette_gen;
+u32 vram_map_gen;
+u32 main_mem_page_gen[MAIN_MEM_GEN_PAGES];
+u32 main_mem_spu_watch[MAIN_MEM_GEN_PAGES/32];
+
 //----->
 //consider these later, for better recordkeeping, instead of using the u8* in MMU
 
@@ -763,6 +770,7 @@ unsupported_mst:
 
 void MMU_VRAM_unmap_all()
 {
+	vram_map_gen++;
 	vramConfiguration.clear();
 
 	vram_arm7_map[0] = VRAM_PAGE_UNMAPPED;
@@ -791,6 +799,14 @@ void MMU_VRAM_unmap_all()
 		MMU.texInfo.textureSlotAddr[i] = MMU.blank_memory;
 }
 
+void MMU_VRAM_markAllDirty()
+{
+	for(int i=0;i<VRAM_GEN_PAGES;i++)
+		vram_page_gen[i]++;
+	oam_gen++;
+	palette_gen++;
+}
+
 static inline void MMU_VRAMmapControl(u8 block, u8 VRAMBankCnt)
 {
 	//handle WRAM, first of all
@@ -1015,6 +1031,7 @@ void MMU_Reset()
 	SubScreen.offset  = 192;
 	
 	MMU_VRAM_unmap_all();
+	MMU_VRAM_markAllDirty();
 
 	MMU.powerMan_CntReg = 0x00;
 	MMU.powerMan_CntRegWritten = FALSE;
@@ -2024,6 +2041,7 @@ u32 TGXSTAT::read32()
 
 void TGXSTAT::write32(const u32 val)
 {
+	gfx3d_syncGeometry();
 	gxfifo_irq = (val>>30)&3;
 	if(BIT15(val)) 
 	{
@@ -3512,6 +3530,7 @@ void FASTCALL _MMU_ARM9_write08(u32 adr, u8 val)
 	adr = MMU_LCDmap<ARMCPU_ARM9>(adr, unmapped, restricted);
 	if(unmapped) return;
 	if(restricted) return; //block 8bit vram writes
+	MMU_VRAM_markDirty(adr);
 
 #ifdef HAVE_JIT
 	if (JIT_MAPPED(adr, ARMCPU_ARM9))
@@ -3965,6 +3984,7 @@ void FASTCALL _MMU_ARM9_write16(u32 adr, u16 val)
 	bool unmapped, restricted;
 	adr = MMU_LCDmap<ARMCPU_ARM9>(adr, unmapped, restricted);
 	if(unmapped) return;
+	MMU_VRAM_markDirty(adr);
 
 #ifdef HAVE_JIT
 	if (JIT_MAPPED(adr, ARMCPU_ARM9))
@@ -4396,6 +4416,7 @@ void FASTCALL _MMU_ARM9_write32(u32 adr, u32 val)
 	bool unmapped, restricted;
 	adr = MMU_LCDmap<ARMCPU_ARM9>(adr, unmapped, restricted);
 	if(unmapped) return;
+	MMU_VRAM_markDirty(adr);
 
 #ifdef HAVE_JIT
 	if (JIT_MAPPED(adr, ARMCPU_ARM9))
@@ -4875,6 +4896,7 @@ void FASTCALL _MMU_ARM7_write08(u32 adr, u8 val)
 	bool unmapped, restricted;
 	adr = MMU_LCDmap<ARMCPU_ARM7>(adr,unmapped, restricted);
 	if(unmapped) return;
+	MMU_VRAM_markDirty(adr);
 
 #ifdef HAVE_JIT
 	if (JIT_MAPPED(adr, ARMCPU_ARM7))
@@ -5057,6 +5079,7 @@ void FASTCALL _MMU_ARM7_write16(u32 adr, u16 val)
 	bool unmapped, restricted;
 	adr = MMU_LCDmap<ARMCPU_ARM7>(adr,unmapped, restricted);
 	if(unmapped) return;
+	MMU_VRAM_markDirty(adr);
 
 #ifdef HAVE_JIT
 	if (JIT_MAPPED(adr, ARMCPU_ARM7))
@@ -5156,6 +5179,7 @@ void FASTCALL _MMU_ARM7_write32(u32 adr, u32 val)
 	bool unmapped, restricted;
 	adr = MMU_LCDmap<ARMCPU_ARM7>(adr,unmapped, restricted);
 	if(unmapped) return;
+	MMU_VRAM_markDirty(adr);
 
 #ifdef HAVE_JIT
 	if (JIT_MAPPED(adr, ARMCPU_ARM7))
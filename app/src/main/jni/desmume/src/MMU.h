@@ -562,6 +562,42 @@ extern VramConfiguration vramConfiguration;
 
 #define VRAM_ARM9_PAGES 512
 extern u8 vram_arm9_map[VRAM_ARM9_PAGES];
+
+//a generation counter for each 16KB page of ARM9_LCD (and the blank memory after it).
+//a page's counter is bumped whenever its contents may have changed, so that consumers such as the texture cache
+//can tell whether vram they depend on was modified by comparing a few integers instead of the memory itself.
+//this is sized to 64 pages so that it can be indexed by an LCDC address masked with 63
+#define VRAM_GEN_PAGES 64
+extern u32 vram_page_gen[VRAM_GEN_PAGES];
+
+//the same idea for OAM and for palette memory (both engines share one counter for each).
+//the sprite renderer keeps its decoded OAM until oam_gen changes
+extern u32 oam_gen;
+extern u32 palette_gen;
+
+//bumped whenever the vram mapping is changed (by any VRAMCNT write)
+extern u32 vram_map_gen;
+
+//marks the page containing the given address (as returned by MMU_LCDmap) as modified.
+//writes to OAM and palette memory come through here too
+FORCEINLINE void MMU_VRAM_markDirty(u32 lcdc_addr)
+{
+	if((lcdc_addr & 0x0F000000) == 0x06000000)
+		vram_page_gen[(lcdc_addr>>14)&(VRAM_GEN_PAGES-1)]++;
+	else if((lcdc_addr & 0x0F000000) == 0x07000000)
+		oam_gen++;
+	else if((lcdc_addr & 0x0F000000) == 0x05000000)
+		palette_gen++;
+}
+
+//marks every vram page (and OAM and palettes) as modified. use this when vram is changed behind the MMU's back (reset, savestate loading)
+void MMU_VRAM_markAllDirty();
+
+//returns the vram page which the given host pointer into ARM9_LCD (or blank_memory) refers to
+FORCEINLINE u32 MMU_VRAM_page(const u8* ptr)
+{
+	return ((u32)(ptr - MMU.ARM9_LCD)>>14)&(VRAM_GEN_PAGES-1);
+}
 FORCEINLINE void* MMU_gpu_map(u32 vram_addr)
 {
 	//this is supposed to map a single gpu vram address to emulator host memory
@@ -619,6 +655,25 @@ extern u32 _MMU_MAIN_MEM_MASK16;
 extern u32 _MMU_MAIN_MEM_MASK32;
 void SetupMMU(bool debugConsole, bool dsi);
 
+//a generation counter for each 16KB page of main memory, bumped by every write to it through the MMU,
+//like vram_page_gen. the spu's adpcm decode cache uses these to notice sample data being overwritten
+#define MAIN_MEM_GEN_PAGES 1024
+extern u32 main_mem_page_gen[MAIN_MEM_GEN_PAGES];
+
+//one bit per page, set for the pages a channel is playing from while the core spu is mixing a frame at a time.
+//writing to one of them makes the spu catch up first, so the samples before the write are mixed from the old data
+extern u32 main_mem_spu_watch[MAIN_MEM_GEN_PAGES/32];
+void SPU_SampleDataWrite();
+
+//call this before the write
+FORCEINLINE void MMU_MAIN_markDirty(u32 addr)
+{
+	const u32 page = (addr & _MMU_MAIN_MEM_MASK)>>14;
+	if(main_mem_spu_watch[page>>5] & (1<<(page&31)))
+		SPU_SampleDataWrite();
+	main_mem_page_gen[page]++;
+}
+
 FORCEINLINE void CheckMemoryDebugEvent(EDEBUG_EVENT event, const MMU_ACCESS_TYPE type, const u32 procnum, const u32 addr, const u32 size, const u32 val)
 {
 	//TODO - ugh work out a better prefetch event system
@@ -813,6 +868,7 @@ FORCEINLINE void _MMU_write08(const int PROCNUM, const MMU_ACCESS_TYPE AT, const
 #ifdef HAVE_JIT
 		JIT_COMPILED_FUNC_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK, 0) = 0;
 #endif
+		MMU_MAIN_markDirty(addr);
 		T1WriteByte( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK, val);
 #ifdef HAVE_LUA
 		CallRegisteredLuaMemHook(addr, 1, val, LUAMEMHOOK_WRITE);
@@ -852,6 +908,7 @@ FORCEINLINE void _MMU_write16(const int PROCNUM, const MMU_ACCESS_TYPE AT, const
 #ifdef HAVE_JIT
 		JIT_COMPILED_FUNC_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK16, 0) = 0;
 #endif
+		MMU_MAIN_markDirty(addr);
 		T1WriteWord( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK16, val);
 #ifdef HAVE_LUA
 		CallRegisteredLuaMemHook(addr, 2, val, LUAMEMHOOK_WRITE);
@@ -892,6 +949,7 @@ FORCEINLINE void _MMU_write32(const int PROCNUM, const MMU_ACCESS_TYPE AT, const
 		JIT_COMPILED_FUNC_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK32, 0) = 0;
 		JIT_COMPILED_FUNC_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK32, 1) = 0;
 #endif
+		MMU_MAIN_markDirty(addr);
 		T1WriteLong( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK32, val);
 #ifdef HAVE_LUA
 		CallRegisteredLuaMemHook(addr, 4, val, LUAMEMHOOK_WRITE);
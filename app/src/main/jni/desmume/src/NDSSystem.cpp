@@ -1238,15 +1238,6 @@ void Sequencer::init()
 	#endif
 }
 
-//this isnt helping much right now. work on it later
-//#include "utils/task.h"
-//Task taskSubGpu(true);
-//void* renderSubScreen(void*)
-//{
-//	GPU_RenderLine(&SubScreen, nds.VCount, SkipCur2DFrame);
-//	return NULL;
-//}
-
 static void execHardware_hblank()
 {
 	//this logic keeps moving around.
@@ -1256,10 +1247,8 @@ static void execHardware_hblank()
 	//scroll regs for the next scanline
 	if(nds.VCount<192)
 	{
-		//taskSubGpu.execute(renderSubScreen,NULL);
-		GPU_RenderLine(&MainScreen, nds.VCount, frameSkipper.ShouldSkip2D());
-		GPU_RenderLine(&SubScreen, nds.VCount, frameSkipper.ShouldSkip2D());
-		//taskSubGpu.finish();
+		//(with CommonSettings.GFX2D_FrameRender this may only log the line, to be drawn with the rest of the frame at line 191)
+		GPU_RenderLines(nds.VCount, frameSkipper.ShouldSkip2D());
 
 		//trigger hblank dmas
 		//but notice, we do that just after we finished drawing the line
@@ -1293,9 +1282,8 @@ static void execHardware_hblank()
 
 	//emulation housekeeping. for some reason we always do this at hblank,
 	//even though it sounds more reasonable to do it at hstart
+	//(with CommonSettings.spu_frameBatch this may only count up the samples, to be mixed with the rest of the frame at line 191)
 	SPU_Emulate_core();
-	driver->AVI_SoundUpdate(SPU_core->outbuf,spu_core_samples);
-	WAV_WavSoundUpdate(SPU_core->outbuf,spu_core_samples);
 }
 
 static void execHardware_hstart_vblankEnd()
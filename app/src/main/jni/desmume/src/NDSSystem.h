@@ -480,6 +480,12 @@ extern struct TCommonSettings {
 		, GFX3D_Zelda_Shadow_Depth_Hack(0)
 		, GFX3D_Renderer_Multisample(false)
 		, GFX3D_TXTHack(false)
+		, GFX3D_TexCacheBudgetMB(16)
+		, GFX3D_TexPreDecode(false)
+		, GFX3D_GeometryThread(false)
+		, GFX2D_ReuseLines(false)
+		, GFX2D_FrameRender(false)
+		, GFX2D_FrameThread(false)
 		, jit_max_block_size(100)
 		, loadToMemory(false)
 		, UseExtBIOS(false)
@@ -505,6 +511,8 @@ extern struct TCommonSettings {
 		, backupSave(false)
 		, SPU_sync_mode(0)
 		, SPU_sync_method(0)
+		, spu_fixedPoint(false)
+		, spu_frameBatch(false)
 	{
 		strcpy(ARM9BIOS, "biosnds9.bin");
 		strcpy(ARM7BIOS, "biosnds7.bin");
@@ -539,6 +547,12 @@ extern struct TCommonSettings {
 	int  GFX3D_Zelda_Shadow_Depth_Hack;
 	bool GFX3D_Renderer_Multisample;
 	bool GFX3D_TXTHack;
+	int  GFX3D_TexCacheBudgetMB; //least recently used textures are evicted once the texture cache grows past this
+	bool GFX3D_TexPreDecode; //decode textures on another thread as soon as the geometry engine sees them (multi-core only)
+	bool GFX3D_GeometryThread; //run the geometry engine commands on a thread of their own (multi-core only)
+	bool GFX2D_ReuseLines; //leave 2d output lines alone when nothing they are drawn from has changed since last time
+	bool GFX2D_FrameRender; //draw the 2d engines a frame at a time at the end of the frame, from registers logged for each line
+	bool GFX2D_FrameThread; //with GFX2D_FrameRender, draw the sub engine's frame on another thread (multi-core only)
 
 	bool loadToMemory;
 
@@ -604,6 +618,8 @@ extern struct TCommonSettings {
 	bool spu_muteChannels[16];
 	bool spu_captureMuted;
 	bool spu_advanced;
+	bool spu_fixedPoint; //step pcm and adpcm channels in fixed point instead of double, interpolating a few samples at a time
+	bool spu_frameBatch; //mix the core spu a frame at a time at vblank, replaying the register writes logged during the frame
 
 	struct _ShowGpu {
 		_ShowGpu() : main(true), sub(true) {}
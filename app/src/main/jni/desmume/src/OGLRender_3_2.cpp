@@ -496,7 +496,7 @@ Render3DError OpenGLRenderer_3_2::EnableVertexAttributes(const VERTLIST *vertLis
 	OGLRenderRef &OGLRef = *this->ref;
 	
 	glBindVertexArray(OGLRef.vaoMainStatesID);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(VERT) * vertList->count, vertList);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(VERT) * vertList->count, vertList->list);
 	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, vertIndexCount * sizeof(GLushort), indexBuffer);
 	
 	return OGLERROR_NOERR;
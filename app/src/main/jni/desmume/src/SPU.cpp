@@ -41,6 +41,10 @@
 #include "NDSSystem.h"
 #include "matrix.h"
 
+#ifdef ENABLE_NEON
+	#include <arm_neon.h>
+#endif
+
 
 static inline s16 read16(u32 addr) { return (s16)_MMU_read16<ARMCPU_ARM7,MMU_AT_DEBUG>(addr); }
 static inline u8 read08(u32 addr) { return _MMU_read08<ARMCPU_ARM7,MMU_AT_DEBUG>(addr); }
@@ -108,6 +112,7 @@ static const s16 wavedutytbl[8][8] = {
 static s32 precalcdifftbl[89][16];
 static u8 precalcindextbl[89][8];
 static double cos_lut[COSINE_INTERPOLATION_RESOLUTION];
+static s16 cos_lut_fixed[COSINE_INTERPOLATION_RESOLUTION]; //cos_lut in 2.14 fixed point, for the fixed point stepper
 
 static const double ARM7_CLOCK = 33513982;
 
@@ -115,6 +120,12 @@ static const double samples_per_hline = (DESMUME_SAMPLE_RATE / 59.8261f) / 263.0
 
 static double samples = 0;
 
+static void SPU_AdpcmCacheClear();
+static void SPU_BatchReset();
+
+//the core spu is given room for a frame's worth of samples (about 738), so it can be mixed a frame at a time
+#define SPU_CORE_BUFFER_SAMPLES 1024
+
 template<typename T>
 static FORCEINLINE T MinMax(T val, T min, T max)
 {
@@ -201,9 +212,12 @@ int SPU_Init(int coreid, int buffersize)
 	
 	// Build the cosine interpolation LUT
 	for(unsigned int i = 0; i < COSINE_INTERPOLATION_RESOLUTION; i++)
+	{
 		cos_lut[i] = (1.0 - cos(((double)i/(double)COSINE_INTERPOLATION_RESOLUTION) * M_PI)) * 0.5;
+		cos_lut_fixed[i] = (s16)(cos_lut[i] * 16384);
+	}
 
-	SPU_core = new SPU_struct((int)ceil(samples_per_hline));
+	SPU_core = new SPU_struct(SPU_CORE_BUFFER_SAMPLES);
 	SPU_Reset();
 
 	//create adpcm decode accelerator lookups
@@ -240,6 +254,7 @@ void SPU_Pause(int pause)
 
 void SPU_CloneUser()
 {
+	SPU_FlushCore();
 	if(SPU_user) {
 		memcpy(SPU_user->channels,SPU_core->channels,sizeof(SPU_core->channels));
 		SPU_user->regs = SPU_core->regs;
@@ -288,6 +303,8 @@ void SPU_Reset(void)
 	int i;
 
 	SPU_core->reset();
+	SPU_AdpcmCacheClear();
+	SPU_BatchReset();
 
 	if(SPU_user) {
 		if(SNDCore)
@@ -314,6 +331,8 @@ void SPU_struct::reset()
 {
 	memset(sndbuf,0,bufsize*2*4);
 	memset(outbuf,0,bufsize*2*2);
+	silent = true;
+	silentLength = bufsize;
 
 	memset((void *)channels, 0, sizeof(channel_struct) * 16);
 
@@ -331,6 +350,8 @@ SPU_struct::SPU_struct(int buffersize)
 	, sndbuf(0)
 	, outbuf(0)
 	, bufsize(buffersize)
+	, silent(true)
+	, silentLength(0)
 {
 	sndbuf = new s32[buffersize*2];
 	outbuf = new s16[buffersize*2];
@@ -349,6 +370,9 @@ void SPU_DeInit(void)
 		SNDCore->DeInit();
 	SNDCore = 0;
 
+	spu_core_batching = false;
+	SPU_BatchReset();
+
 	delete SPU_core; SPU_core=0;
 	delete SPU_user; SPU_user=0;
 }
@@ -1109,7 +1133,7 @@ template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE void FetchADP
 			chan->pcm16b_last = chan->pcm16b;
 			chan->pcm16b = MinMax(chan->pcm16b+diff, -0x8000, 0x7FFF);
 
-			if(i == (chan->loopstart<<3)) {
+			if(i == ((u32)chan->loopstart<<3)) {
 				if(chan->loop_index != K_ADPCM_LOOPING_RECOVERY_INDEX) printf("over-snagging\n");
 				chan->loop_pcm16b = chan->pcm16b;
 				chan->loop_index = chan->index;
@@ -1257,6 +1281,317 @@ static FORCEINLINE void TestForLoop2(SPU_struct *SPU, channel_struct *chan)
 	}
 }
 
+//////////////////////////////////////////////////////////////////////////////
+//fixed point channel stepping.
+//the sampcnt/sampinc doubles above are the reference, but double math for every sample of every channel is slow
+//on the older arm devices. this steps pcm8, pcm16 and adpcm channels in 32.32 fixed point instead, and
+//interpolates several samples at a time with 14 bit weights. the doubles stay the channel's real state
+//(savestates and the reference path use them): they are converted to fixed point and back around each run.
+
+#define SPU_FIXED_BLOCK 64
+
+//out[i] = a[i] + (b[i]-a[i])*w[i]/16384, rounded down like Interpolate() does
+static void SPU_InterpolateBlock(const s16 * const a, const s16 * const b, const s16 * const w, s32 * const out, const int count)
+{
+	int i = 0;
+#if defined(ENABLE_SSE2)
+	const __m128i one = _mm_set1_epi16(16384);
+	for(;i+8<=count;i+=8)
+	{
+		const __m128i va = _mm_loadu_si128((const __m128i*)(a+i));
+		const __m128i vb = _mm_loadu_si128((const __m128i*)(b+i));
+		const __m128i vw = _mm_loadu_si128((const __m128i*)(w+i));
+		const __m128i vwa = _mm_sub_epi16(one, vw);
+		//a*(16384-w) + b*w, with the pairs side by side for madd
+		const __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(va, vb), _mm_unpacklo_epi16(vwa, vw));
+		const __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(va, vb), _mm_unpackhi_epi16(vwa, vw));
+		_mm_storeu_si128((__m128i*)(out+i), _mm_srai_epi32(lo, 14));
+		_mm_storeu_si128((__m128i*)(out+i+4), _mm_srai_epi32(hi, 14));
+	}
+#elif defined(ENABLE_NEON)
+	const int16x8_t one = vdupq_n_s16(16384);
+	for(;i+8<=count;i+=8)
+	{
+		const int16x8_t va = vld1q_s16(a+i);
+		const int16x8_t vb = vld1q_s16(b+i);
+		const int16x8_t vw = vld1q_s16(w+i);
+		const int16x8_t vwa = vsubq_s16(one, vw);
+		int32x4_t lo = vmull_s16(vget_low_s16(va), vget_low_s16(vwa));
+		int32x4_t hi = vmull_s16(vget_high_s16(va), vget_high_s16(vwa));
+		lo = vmlal_s16(lo, vget_low_s16(vb), vget_low_s16(vw));
+		hi = vmlal_s16(hi, vget_high_s16(vb), vget_high_s16(vw));
+		vst1q_s32(out+i, vshrq_n_s32(lo, 14));
+		vst1q_s32(out+i+4, vshrq_n_s32(hi, 14));
+	}
+#endif
+	for(;i<count;i++)
+		out[i] = ((s32)a[i] * (16384 - w[i]) + (s32)b[i] * w[i]) >> 14;
+}
+
+//the sample data of a channel, if it can be read straight out of main memory.
+//anything else (other regions, or data running off the end of main memory) stays on the reference path
+template<int FORMAT> static const u8* SPU_ChanFixedSource(const channel_struct * const chan)
+{
+	if(!CommonSettings.spu_fixedPoint) return NULL;
+	if(FORMAT == 3) return NULL;
+	//adpcm channels this short dont advance at all (see TestForLoop2)
+	if(FORMAT == 2 && chan->totlength < 4) return NULL;
+	if((chan->addr & 0x0F000000) != 0x02000000) return NULL;
+	const u32 ofs = chan->addr & _MMU_MAIN_MEM_MASK;
+	//(pcm8 can look one byte past the end, when sampcnt lands exactly on it)
+	if(ofs + (chan->totlength << 2) + 2 > _MMU_MAIN_MEM_MASK + 1) return NULL;
+	return MMU.MAIN_MEM + ofs;
+}
+
+//adpcm decode cache.
+//the fixed point path keeps the samples it decodes from each adpcm region, so that looping instruments get decoded
+//once instead of on every pass through their loop. an entry holds the decoder state (sample and table index) after
+//each position from..upto. it is only used where it agrees with the playing channel's own decoder state, and it
+//starts over from the channel's state otherwise, or when main memory under the region has been written to.
+//so the channel ends up decoding exactly what FetchADPCMData would have.
+
+#define SPU_ADPCM_CACHE_ENTRIES 32
+#define SPU_ADPCM_CACHE_MAXSAMPLES (64*1024)
+
+struct SPU_AdpcmCacheEntry
+{
+	SPU_AdpcmCacheEntry()
+		: ofs(0), totlength(0), gen(0), from(1), upto(0), lastUse(0)
+	{}
+	u32 ofs, totlength; //the region (ofs is into main memory)
+	u32 gen; //sum of the region's main_mem_page_gen counters, as of the samples held
+	u32 from, upto; //sample positions held (none if from > upto)
+	u32 lastUse;
+	std::vector<s16> pcm16b;
+	std::vector<u8> index;
+};
+
+static SPU_AdpcmCacheEntry spu_adpcmCache[SPU_ADPCM_CACHE_ENTRIES];
+static u32 spu_adpcmCacheClock = 0;
+
+static void SPU_AdpcmCacheClear()
+{
+	for(int i=0;i<SPU_ADPCM_CACHE_ENTRIES;i++)
+	{
+		spu_adpcmCache[i].totlength = 0;
+		spu_adpcmCache[i].from = 1;
+		spu_adpcmCache[i].upto = 0;
+		spu_adpcmCache[i].lastUse = 0;
+	}
+	spu_adpcmCacheClock = 0;
+}
+
+static u32 SPU_AdpcmCacheGen(const u32 ofs, const u32 bytes)
+{
+	u32 gen = 0;
+	for(u32 page = ofs>>14; page <= (ofs+bytes)>>14; page++)
+		gen += main_mem_page_gen[page];
+	return gen;
+}
+
+//finds the entry for a channel's region (or takes over the least recently used one). NULL if the region is too big to keep
+static SPU_AdpcmCacheEntry* SPU_AdpcmCacheLookup(const channel_struct * const chan)
+{
+	const u32 samples = chan->totlength << 3;
+	if(samples > SPU_ADPCM_CACHE_MAXSAMPLES) return NULL;
+
+	const u32 ofs = chan->addr & _MMU_MAIN_MEM_MASK;
+	const u32 gen = SPU_AdpcmCacheGen(ofs, chan->totlength << 2);
+	SPU_AdpcmCacheEntry* victim = &spu_adpcmCache[0];
+	for(int i=0;i<SPU_ADPCM_CACHE_ENTRIES;i++)
+	{
+		SPU_AdpcmCacheEntry& e = spu_adpcmCache[i];
+		if(e.ofs == ofs && e.totlength == chan->totlength)
+		{
+			//written to since? then nothing held can be trusted
+			if(e.gen != gen)
+			{
+				e.gen = gen;
+				e.from = 1;
+				e.upto = 0;
+			}
+			e.lastUse = ++spu_adpcmCacheClock;
+			return &e;
+		}
+		if(e.lastUse < victim->lastUse)
+			victim = &e;
+	}
+
+	victim->ofs = ofs;
+	victim->totlength = chan->totlength;
+	victim->gen = gen;
+	victim->from = 1;
+	victim->upto = 0;
+	victim->lastUse = ++spu_adpcmCacheClock;
+	//(the decoder can be asked for the position just past the end, when sampcnt lands exactly on it)
+	victim->pcm16b.resize(samples+1);
+	victim->index.resize(samples+1);
+	return victim;
+}
+
+//brings the channel's decoder from lastsampcnt up to loc, the same as the decode loop in FetchADPCMData does,
+//but out of the cache where it can. returns false if the channel's state cant be cached (a bogus table index)
+static FORCEINLINE bool SPU_AdpcmCacheAdvance(SPU_AdpcmCacheEntry& e, channel_struct * const chan, const u8 * const src, const u32 loc)
+{
+	const u32 last = chan->lastsampcnt;
+	if(last < e.from || last > e.upto || e.pcm16b[last] != chan->pcm16b || e.index[last] != chan->index)
+	{
+		//start over from where the channel is
+		if(chan->index < 0 || chan->index > 88) return false;
+		e.from = e.upto = last;
+		e.pcm16b[last] = chan->pcm16b;
+		e.index[last] = chan->index;
+	}
+
+	if(loc > e.upto)
+	{
+		s32 pcm16b = e.pcm16b[e.upto];
+		u32 index = e.index[e.upto];
+		for(u32 i = e.upto+1; i <= loc; i++)
+		{
+			const u32 data4bit = ((u32)src[i>>1]) >> ((i&1)<<2);
+			const s32 diff = precalcdifftbl[index][data4bit & 0xF];
+			index = precalcindextbl[index][data4bit & 0x7];
+			pcm16b = MinMax(pcm16b+diff, -0x8000, 0x7FFF);
+			e.pcm16b[i] = pcm16b;
+			e.index[i] = index;
+		}
+		e.upto = loc;
+	}
+
+	chan->pcm16b_last = (loc-1 > last) ? e.pcm16b[loc-1] : chan->pcm16b;
+	chan->pcm16b = e.pcm16b[loc];
+	chan->index = e.index[loc];
+	const u32 loopstart = chan->loopstart << 3;
+	if(last < loopstart && loopstart <= loc)
+	{
+		chan->loop_pcm16b = e.pcm16b[loopstart];
+		chan->loop_index = e.index[loopstart];
+	}
+	chan->lastsampcnt = loc;
+	return true;
+}
+
+template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE s16 SPU_FixedWeight(const s64 pos)
+{
+	const u32 frac = (u32)pos;
+	if(INTERPOLATE_MODE == SPUInterpolation_Cosine)
+		return cos_lut_fixed[frac >> 19]; //COSINE_INTERPOLATION_RESOLUTION is 2^13
+	return (s16)(frac >> 18);
+}
+
+//generates up to length samples of a pcm8, pcm16 or adpcm channel from src, the same way the Fetch*Data and
+//TestForLoop functions do but in fixed point. returns how many it generated: fewer than length if the channel stopped
+template<int FORMAT, SPUInterpolationMode INTERPOLATE_MODE>
+	static int SPU_ChanGenerateFixed(SPU_struct* const SPU, channel_struct* const chan, const u8* const src, s32* const out, const int length)
+{
+	const int shift = (FORMAT == 0 ? 2 : FORMAT == 1 ? 1 : 3);
+	const u32 lastloc = (chan->totlength << (FORMAT == 0 ? 2 : 1)) - 1; //last sample which has a next one to interpolate with
+	const s64 one = (s64)1 << 32;
+	const s64 end = (s64)(chan->double_totlength_shifted * 4294967296.0);
+	const s64 step = end - (((s64)(chan->loopstart << shift)) << 32);
+	const s64 inc = (s64)(chan->sampinc * 4294967296.0);
+	s64 pos = (s64)(chan->sampcnt * 4294967296.0);
+
+	SPU_AdpcmCacheEntry* const cache = (FORMAT == 2) ? SPU_AdpcmCacheLookup(chan) : NULL;
+
+	s16 a[SPU_FIXED_BLOCK], b[SPU_FIXED_BLOCK], w[SPU_FIXED_BLOCK];
+	int done = 0;
+	bool stopped = false;
+	while(done < length && !stopped)
+	{
+		const int todo = std::min(length - done, SPU_FIXED_BLOCK);
+		int n = 0;
+		while(n < todo)
+		{
+			//fetch
+			if(pos < (FORMAT == 2 ? 8*one : 0))
+				a[n] = b[n] = 0;
+			else
+			{
+				const u32 loc = (u32)(pos >> 32);
+				switch(FORMAT)
+				{
+				case 0:
+					a[n] = (s16)((s8)src[loc] << 8);
+					b[n] = (loc < lastloc) ? (s16)((s8)src[loc+1] << 8) : a[n];
+					break;
+				case 1:
+					a[n] = (s16)T1ReadWord(src, loc << 1);
+					b[n] = (loc < lastloc) ? (s16)T1ReadWord(src, (loc << 1) + 2) : a[n];
+					break;
+				case 2:
+					if(chan->lastsampcnt != loc && !(cache && SPU_AdpcmCacheAdvance(*cache, chan, src, loc)))
+					{
+						for(u32 i = chan->lastsampcnt+1; i <= loc; i++)
+						{
+							const u32 data4bit = ((u32)src[i>>1]) >> ((i&1)<<2);
+
+							const s32 diff = precalcdifftbl[chan->index][data4bit & 0xF];
+							chan->index = precalcindextbl[chan->index][data4bit & 0x7];
+
+							chan->pcm16b_last = chan->pcm16b;
+							chan->pcm16b = MinMax(chan->pcm16b+diff, -0x8000, 0x7FFF);
+
+							if(i == ((u32)chan->loopstart<<3)) {
+								chan->loop_pcm16b = chan->pcm16b;
+								chan->loop_index = chan->index;
+							}
+						}
+						chan->lastsampcnt = loc;
+					}
+					a[n] = chan->pcm16b_last;
+					b[n] = chan->pcm16b;
+					if(INTERPOLATE_MODE == SPUInterpolation_None) a[n] = b[n];
+					break;
+				}
+			}
+			w[n] = SPU_FixedWeight<INTERPOLATE_MODE>(pos);
+			n++;
+
+			//step, and loop or stop
+			pos += inc;
+			if(pos > end)
+			{
+				if(chan->repeat == 1)
+				{
+					while(pos > end) pos -= step;
+					if(FORMAT == 2)
+					{
+						if(chan->loop_index == K_ADPCM_LOOPING_RECOVERY_INDEX)
+						{
+							chan->pcm16b = (s16)read16(chan->addr);
+							chan->index = read08(chan->addr+2) & 0x7F;
+							chan->lastsampcnt = 7;
+						}
+						else
+						{
+							chan->pcm16b = chan->loop_pcm16b;
+							chan->index = chan->loop_index;
+							chan->lastsampcnt = (chan->loopstart << 3);
+						}
+					}
+				}
+				else
+				{
+					SPU->KeyOff(chan->num);
+					stopped = true;
+					break;
+				}
+			}
+		}
+
+		if(INTERPOLATE_MODE == SPUInterpolation_None)
+			for(int i=0;i<n;i++) out[done+i] = a[i];
+		else
+			SPU_InterpolateBlock(a, b, w, out+done, n);
+		done += n;
+	}
+
+	chan->sampcnt = (double)pos * (1.0 / 4294967296.0);
+	return done;
+}
+
 template<int CHANNELS> FORCEINLINE static void SPU_Mix(SPU_struct* SPU, channel_struct *chan, s32 data)
 {
 	switch(CHANNELS)
@@ -1272,6 +1607,24 @@ template<int CHANNELS> FORCEINLINE static void SPU_Mix(SPU_struct* SPU, channel_
 template<int FORMAT, SPUInterpolationMode INTERPOLATE_MODE, int CHANNELS> 
 	FORCEINLINE static void ____SPU_ChanUpdate(SPU_struct* const SPU, channel_struct* const chan)
 {
+	if(CHANNELS != -1 && FORMAT != 3)
+	{
+		const u8* const src = SPU_ChanFixedSource<FORMAT>(chan);
+		if(src)
+		{
+			s32 data[SPU_FIXED_BLOCK];
+			while(SPU->bufpos < SPU->buflength)
+			{
+				const int todo = std::min(SPU->buflength - SPU->bufpos, (u32)SPU_FIXED_BLOCK);
+				const int count = SPU_ChanGenerateFixed<FORMAT,INTERPOLATE_MODE>(SPU, chan, src, data, todo);
+				for(int s=0;s<count;s++,SPU->bufpos++)
+					SPU_Mix<CHANNELS>(SPU, chan, data[s]);
+				if(chan->status != CHANSTAT_PLAY) SPU->bufpos = SPU->buflength;
+			}
+			return;
+		}
+	}
+
 	for (; SPU->bufpos < SPU->buflength; SPU->bufpos++)
 	{
 		if(CHANNELS != -1)
@@ -1332,148 +1685,291 @@ FORCEINLINE static void _SPU_ChanUpdate(const bool actuallyMix, SPU_struct* cons
 	}
 }
 
-//ENTERNEW
-static void SPU_MixAudio_Advanced(bool actuallyMix, SPU_struct *SPU, int length)
+//generates up to length samples of a channel into out, without mixing them anywhere.
+//returns how many it generated: fewer than length if the channel stopped.
+//when fetch is false, the channel only advances (like ____SPU_ChanUpdate<..,-1>), and out is not written
+template<int FORMAT, SPUInterpolationMode INTERPOLATE_MODE> 
+	FORCEINLINE static int ___SPU_ChanGenerate(const bool fetch, SPU_struct* const SPU, channel_struct* const chan, s32* const out, const int length)
 {
-	//the advanced spu function correctly handles all sound control mixing options, as well as capture
-	//this code is not entirely optimal, as it relies on sort of manhandling the core mixing functions
-	//in order to get the results it needs.
+	if(fetch && FORMAT != 3)
+	{
+		const u8* const src = SPU_ChanFixedSource<FORMAT>(chan);
+		if(src)
+			return SPU_ChanGenerateFixed<FORMAT,INTERPOLATE_MODE>(SPU, chan, src, out, length);
+	}
 
-	//THIS IS MAX HACKS!!!!
-	//AND NEEDS TO BE REWRITTEN ALONG WITH THE DEEPEST PARTS OF THE SPU
-	//ONCE WE KNOW THAT IT WORKS
-	
-	//BIAS gets ignored since our spu is still not bit perfect,
-	//and it doesnt matter for purposes of capture
+	int count = 0;
+	SPU->buflength = length;
+	//(the loop tests end the channel's block by setting bufpos to buflength)
+	for (SPU->bufpos = 0; SPU->bufpos < SPU->buflength; SPU->bufpos++)
+	{
+		if(fetch)
+		{
+			switch(FORMAT)
+			{
+				case 0: Fetch8BitData<INTERPOLATE_MODE>(chan, &out[count]); break;
+				case 1: Fetch16BitData<INTERPOLATE_MODE>(chan, &out[count]); break;
+				case 2: FetchADPCMData<INTERPOLATE_MODE>(chan, &out[count]); break;
+				case 3: FetchPSGData(chan, &out[count]); break;
+			}
+		}
+		count++;
 
-	//-----------DEBUG CODE
-	bool skipcap = false;
-	//-----------------
+		switch(FORMAT) {
+			case 0: case 1: TestForLoop<FORMAT>(SPU, chan); break;
+			case 2: TestForLoop2(SPU, chan); break;
+			case 3: chan->sampcnt += chan->sampinc; break;
+		}
+	}
+	return count;
+}
 
-	s32 samp0[2];
-	
-	//believe it or not, we are going to do this one sample at a time.
-	//like i said, it is slower.
-	for(int samp=0;samp<length;samp++)
+template<SPUInterpolationMode INTERPOLATE_MODE> 
+	FORCEINLINE static int __SPU_ChanGenerate(const bool fetch, SPU_struct* const SPU, channel_struct* const chan, s32* const out, const int length)
+{
+	switch(chan->format)
 	{
-		SPU->sndbuf[0] = 0;
-		SPU->sndbuf[1] = 0;
-		SPU->buflength = 1;
+		case 0: return ___SPU_ChanGenerate<0,INTERPOLATE_MODE>(fetch, SPU, chan, out, length);
+		case 1: return ___SPU_ChanGenerate<1,INTERPOLATE_MODE>(fetch, SPU, chan, out, length);
+		case 2: return ___SPU_ChanGenerate<2,INTERPOLATE_MODE>(fetch, SPU, chan, out, length);
+		case 3: return ___SPU_ChanGenerate<3,INTERPOLATE_MODE>(fetch, SPU, chan, out, length);
+		default: assert(false); return 0;
+	}
+}
 
-		s32 capmix[2] = {0,0};
-		s32 mix[2] = {0,0};
-		s32 chanout[16];
-		s32 submix[32];
+static int _SPU_ChanGenerate(const bool fetch, SPU_struct* const SPU, channel_struct* const chan, s32* const out, const int length)
+{
+	switch(CommonSettings.spuInterpolationMode)
+	{
+	case SPUInterpolation_None: return __SPU_ChanGenerate<SPUInterpolation_None>(fetch, SPU, chan, out, length);
+	case SPUInterpolation_Linear: return __SPU_ChanGenerate<SPUInterpolation_Linear>(fetch, SPU, chan, out, length);
+	case SPUInterpolation_Cosine: return __SPU_ChanGenerate<SPUInterpolation_Cosine>(fetch, SPU, chan, out, length);
+	default: assert(false); return 0;
+	}
+}
 
-		//generate each channel, and helpfully mix it at the same time
-		for(int i=0;i<16;i++)
+//volume and pan a channel's generated samples, the same way MixL/MixR/MixLR do. samples past count are silent
+static void SPU_PanBlock(const channel_struct * const chan, const s32 * const data, const int count, const int length, s32 * const left, s32 * const right)
+{
+	const u8 vol = chan->vol;
+	const u8 pan = chan->pan;
+	const int shift = volume_shift[chan->volumeDiv];
+	int s = 0;
+	if(pan == 0)
+		for(;s<count;s++)
 		{
-			channel_struct *chan = &SPU->channels[i];
+			left[s] = spumuldiv7(data[s], vol) >> shift;
+			right[s] = 0;
+		}
+	else if(pan == 127)
+		for(;s<count;s++)
+		{
+			left[s] = 0;
+			right[s] = spumuldiv7(data[s], vol) >> shift;
+		}
+	else
+		for(;s<count;s++)
+		{
+			const s32 v = spumuldiv7(data[s], vol) >> shift;
+			left[s] = spumuldiv7(v, 127 - pan);
+			right[s] = spumuldiv7(v, pan);
+		}
+	for(;s<length;s++)
+		left[s] = right[s] = 0;
+}
 
-			if (chan->status == CHANSTAT_PLAY)
-			{
-				SPU->bufpos = 0;
+//whether two ranges of arm7 memory may be the same memory. main memory is compared modulo its mirroring,
+//anything else is only told apart by region
+static bool SPU_RangesMayOverlap(u32 a, u32 alen, u32 b, u32 blen)
+{
+	if((a>>24) != (b>>24)) return false;
+	if((a>>24) != 0x02) return true;
+	const u32 mask = 0x3FFFFF;
+	a &= mask; b &= mask;
+	return ((b - a) & mask) < alen || ((a - b) & mask) < blen;
+}
 
-				bool bypass = false;
-				if(i==1 && SPU->regs.ctl_ch1bypass) bypass=true;
-				if(i==3 && SPU->regs.ctl_ch3bypass) bypass=true;
+//a capture writing over sample data that a channel is playing has to be interleaved with it sample by sample
+static bool SPU_CaptureMayFeedChannel(SPU_struct *SPU)
+{
+	for(int capchan=0;capchan<2;capchan++)
+	{
+		const SPU_struct::REGS::CAP& cap = SPU->regs.cap[capchan];
+		if(!cap.runtime.running) continue;
+		for(int i=0;i<16;i++)
+		{
+			const channel_struct& chan = SPU->channels[i];
+			if(chan.status != CHANSTAT_PLAY || chan.format == 3) continue;
+			if(SPU_RangesMayOverlap(chan.addr, chan.totlength << 2, cap.dad, cap.runtime.maxdad - cap.dad))
+				return true;
+		}
+	}
+	return false;
+}
 
+//advanced mixing works on blocks of up to this many samples
+#define SPU_ADVANCED_BLOCK 64
 
-				//output to mixer unless we are bypassed.
-				//dont output to mixer if the user muted us
-				bool outputToMix = true;
-				if(CommonSettings.spu_muteChannels[i]) outputToMix = false;
-				if(bypass) outputToMix = false;
-				bool outputToCap = outputToMix;
-				if(CommonSettings.spu_captureMuted && !bypass) outputToCap = true;
+static struct SPU_AdvancedBlock
+{
+	s32 data[16][SPU_ADVANCED_BLOCK]; //each channel's fetched samples
+	int count[16]; //how many samples each channel generated (0 if it wasnt playing)
+	bool fetched[16];
+	s32 lastEnd[SPU_ADVANCED_BLOCK]; //SPU->lastdata after each sample
+	s32 chanL[SPU_ADVANCED_BLOCK], chanR[SPU_ADVANCED_BLOCK];
+	s32 subL[2][SPU_ADVANCED_BLOCK], subR[2][SPU_ADVANCED_BLOCK]; //channels 1 and 3, for the output selectors
+	s32 mixL[SPU_ADVANCED_BLOCK], mixR[SPU_ADVANCED_BLOCK];
+	s32 capL[SPU_ADVANCED_BLOCK], capR[SPU_ADVANCED_BLOCK];
+	s32 chanout[4][SPU_ADVANCED_BLOCK]; //channels 0-3, for the capture sources
+} spuBlock;
 
-				//channels 1 and 3 should probably always generate their audio
-				//internally at least, just in case they get used by the spu output
-				bool domix = outputToCap || outputToMix || i==1 || i==3;
+//what SPU->lastdata held when channel i got to sample s, for channels which didnt fetch
+static s32 SPU_LastDataBefore(const SPU_AdvancedBlock& b, int i, int s, s32 lastBefore)
+{
+	for(int j=i-1;j>=0;j--)
+		if(b.fetched[j] && b.count[j] > s)
+			return b.data[j][s];
+	return s ? b.lastEnd[s-1] : lastBefore;
+}
 
-				//clear the output buffer since this is where _SPU_ChanUpdate wants to accumulate things
-				SPU->sndbuf[0] = SPU->sndbuf[1] = 0;
+static void SPU_MixAudio_AdvancedBlock(SPU_struct *SPU, int start, int length)
+{
+	SPU_AdvancedBlock& b = spuBlock;
 
-				//get channel's next output sample.
-				_SPU_ChanUpdate(domix, SPU, chan);
-				chanout[i] = SPU->lastdata >> volume_shift[chan->volumeDiv];
+	//-----------DEBUG CODE
+	bool skipcap = false;
+	//-----------------
 
-				//save the panned results
-				submix[i*2] = SPU->sndbuf[0];
-				submix[i*2+1] = SPU->sndbuf[1];
+	memset(b.subL, 0, sizeof(b.subL));
+	memset(b.subR, 0, sizeof(b.subR));
+	memset(b.mixL, 0, length*4);
+	memset(b.mixR, 0, length*4);
+	memset(b.capL, 0, length*4);
+	memset(b.capR, 0, length*4);
 
-				//send sample to our capture mix
-				if(outputToCap)
-				{
-					capmix[0] += submix[i*2];
-					capmix[1] += submix[i*2+1];
-				}
+	//generate each channel's samples for the whole block, and mix them
+	for(int i=0;i<16;i++)
+	{
+		channel_struct *chan = &SPU->channels[i];
+
+		b.count[i] = 0;
+		b.fetched[i] = false;
+		if (chan->status != CHANSTAT_PLAY)
+			continue;
+
+		bool bypass = false;
+		if(i==1 && SPU->regs.ctl_ch1bypass) bypass=true;
+		if(i==3 && SPU->regs.ctl_ch3bypass) bypass=true;
+
+		//output to mixer unless we are bypassed.
+		//dont output to mixer if the user muted us
+		bool outputToMix = true;
+		if(CommonSettings.spu_muteChannels[i]) outputToMix = false;
+		if(bypass) outputToMix = false;
+		bool outputToCap = outputToMix;
+		if(CommonSettings.spu_captureMuted && !bypass) outputToCap = true;
+
+		//channels 1 and 3 should probably always generate their audio
+		//internally at least, just in case they get used by the spu output
+		bool domix = outputToCap || outputToMix || i==1 || i==3;
+
+		b.count[i] = _SPU_ChanGenerate(domix, SPU, chan, b.data[i], length);
+		b.fetched[i] = domix;
+		if(!domix) continue;
+
+		//save the panned results
+		s32 *left = b.chanL, *right = b.chanR;
+		if(i==1 || i==3)
+		{
+			left = b.subL[i>>1];
+			right = b.subR[i>>1];
+		}
+		SPU_PanBlock(chan, b.data[i], b.count[i], length, left, right);
 
-				//send sample to our main mixer
-				if(outputToMix)
-				{
-					mix[0] += submix[i*2];
-					mix[1] += submix[i*2+1];
-				}
+		//send samples to our capture mix
+		if(outputToCap)
+			for(int s=0;s<length;s++)
+			{
+				b.capL[s] += left[s];
+				b.capR[s] += right[s];
+			}
+
+		//send samples to our main mixer
+		if(outputToMix)
+			for(int s=0;s<length;s++)
+			{
+				b.mixL[s] += left[s];
+				b.mixR[s] += right[s];
 			}
-			else 
+	} //foreach channel
+
+	//the last sample generated, which channels that dont fetch anything report as theirs
+	s32 last = SPU->lastdata;
+	for(int s=0;s<length;s++)
+	{
+		for(int i=15;i>=0;i--)
+			if(b.fetched[i] && b.count[i] > s)
 			{
-				chanout[i] = 0;
-				submix[i*2] = 0;
-				submix[i*2+1] = 0;
+				last = b.data[i][s];
+				break;
 			}
-		} //foreach channel
+		b.lastEnd[s] = last;
+	}
 
-		s32 mixout[2] = {mix[0],mix[1]};
-		s32 capmixout[2] = {capmix[0],capmix[1]};
+	//channels 0-3 as the captures see them
+	for(int i=0;i<4;i++)
+	{
+		const int shift = volume_shift[SPU->channels[i].volumeDiv];
+		for(int s=0;s<length;s++)
+		{
+			if(s >= b.count[i]) b.chanout[i][s] = 0;
+			else if(b.fetched[i]) b.chanout[i][s] = b.data[i][s] >> shift;
+			else b.chanout[i][s] = SPU_LastDataBefore(b, i, s, SPU->lastdata) >> shift;
+		}
+	}
+	SPU->lastdata = last;
+
+	for(int s=0;s<length;s++)
+	{
 		s32 sndout[2];
 		s32 capout[2];
 
 		//create SPU output
 		switch(SPU->regs.ctl_left)
 		{
-		case SPU_struct::REGS::LOM_LEFT_MIXER: sndout[0] = mixout[0]; break;
-		case SPU_struct::REGS::LOM_CH1: sndout[0] = submix[1*2+0]; break;
-		case SPU_struct::REGS::LOM_CH3: sndout[0] = submix[3*2+0]; break;
-		case SPU_struct::REGS::LOM_CH1_PLUS_CH3: sndout[0] = submix[1*2+0] + submix[3*2+0]; break;
+		case SPU_struct::REGS::LOM_LEFT_MIXER: sndout[0] = b.mixL[s]; break;
+		case SPU_struct::REGS::LOM_CH1: sndout[0] = b.subL[0][s]; break;
+		case SPU_struct::REGS::LOM_CH3: sndout[0] = b.subL[1][s]; break;
+		case SPU_struct::REGS::LOM_CH1_PLUS_CH3: sndout[0] = b.subL[0][s] + b.subL[1][s]; break;
 		}
 		switch(SPU->regs.ctl_right)
 		{
-		case SPU_struct::REGS::ROM_RIGHT_MIXER: sndout[1] = mixout[1]; break;
-		case SPU_struct::REGS::ROM_CH1: sndout[1] = submix[1*2+1]; break;
-		case SPU_struct::REGS::ROM_CH3: sndout[1] = submix[3*2+1]; break;
-		case SPU_struct::REGS::ROM_CH1_PLUS_CH3: sndout[1] = submix[1*2+1] + submix[3*2+1]; break;
+		case SPU_struct::REGS::ROM_RIGHT_MIXER: sndout[1] = b.mixR[s]; break;
+		case SPU_struct::REGS::ROM_CH1: sndout[1] = b.subR[0][s]; break;
+		case SPU_struct::REGS::ROM_CH3: sndout[1] = b.subR[1][s]; break;
+		case SPU_struct::REGS::ROM_CH1_PLUS_CH3: sndout[1] = b.subR[0][s] + b.subR[1][s]; break;
 		}
 
+		//write the output sample where it is supposed to go
+		SPU->sndbuf[(start+s)*2+0] = sndout[0];
+		SPU->sndbuf[(start+s)*2+1] = sndout[1];
 
 		//generate capture output ("capture bugs" from gbatek are not emulated)
 		if(SPU->regs.cap[0].source==0) 
-			capout[0] = capmixout[0]; //cap0 = L-mix
+			capout[0] = b.capL[s]; //cap0 = L-mix
 		else if(SPU->regs.cap[0].add)
-			capout[0] = chanout[0] + chanout[1]; //cap0 = ch0+ch1
-		else capout[0] = chanout[0]; //cap0 = ch0
+			capout[0] = b.chanout[0][s] + b.chanout[1][s]; //cap0 = ch0+ch1
+		else capout[0] = b.chanout[0][s]; //cap0 = ch0
 
 		if(SPU->regs.cap[1].source==0) 
-			capout[1] = capmixout[1]; //cap1 = R-mix
+			capout[1] = b.capR[s]; //cap1 = R-mix
 		else if(SPU->regs.cap[1].add)
-			capout[1] = chanout[2] + chanout[3]; //cap1 = ch2+ch3
-		else capout[1] = chanout[2]; //cap1 = ch2
+			capout[1] = b.chanout[2][s] + b.chanout[3][s]; //cap1 = ch2+ch3
+		else capout[1] = b.chanout[2][s]; //cap1 = ch2
 
 		capout[0] = MinMax(capout[0],-0x8000,0x7FFF);
 		capout[1] = MinMax(capout[1],-0x8000,0x7FFF);
 
-		//write the output sample where it is supposed to go
-		if(samp==0)
-		{
-			samp0[0] = sndout[0];
-			samp0[1] = sndout[1];
-		}
-		else
-		{
-			SPU->sndbuf[samp*2+0] = sndout[0];
-			SPU->sndbuf[samp*2+1] = sndout[1];
-		}
-
 		for(int capchan=0;capchan<2;capchan++)
 		{
 			if(SPU->regs.cap[capchan].runtime.running)
@@ -1537,19 +2033,78 @@ static void SPU_MixAudio_Advanced(bool actuallyMix, SPU_struct *SPU, int length)
 				} //sampinc loop
 			} //if capchan running
 		} //capchan loop
-	} //main sample loop
+	} //output sample loop
+}
+
+//ENTERNEW
+static void SPU_MixAudio_Advanced(bool actuallyMix, SPU_struct *SPU, int length)
+{
+	//the advanced spu function correctly handles all sound control mixing options, as well as capture.
+	//each channel is generated a block at a time and then mixed, captured and routed to the output over the block,
+	//which comes out sample for sample the same as doing all of it one sample at a time.
+	//the exception is a capture writing over sample data a channel is playing, which needs the two interleaved:
+	//then the blocks are a sample long.
+	
+	//BIAS gets ignored since our spu is still not bit perfect,
+	//and it doesnt matter for purposes of capture
 
-	SPU->sndbuf[0] = samp0[0];
-	SPU->sndbuf[1] = samp0[1];
+	const int blockSize = SPU_CaptureMayFeedChannel(SPU) ? 1 : SPU_ADVANCED_BLOCK;
+	for(int pos=0;pos<length;pos+=blockSize)
+		SPU_MixAudio_AdvancedBlock(SPU, pos, std::min(blockSize, length-pos));
 }
 
 //ENTER
+//a playing channel which adds nothing to the mix: zero volume, or muted by the user.
+//these only need to advance, like the channels of a spu which isnt mixing
+static FORCEINLINE bool SPU_ChanSilent(const channel_struct *chan)
+{
+	return chan->vol == 0 || CommonSettings.spu_muteChannels[chan->num];
+}
+
+//zeroes the first length samples of outbuf, unless they are still zero from an earlier silent block
+static void SPU_SilenceOutput(SPU_struct *SPU, int length)
+{
+	if(SPU->silentLength >= (u32)length) return;
+	memset(SPU->outbuf, 0, length*2*2);
+	SPU->silentLength = length;
+}
+
 static void SPU_MixAudio(bool actuallyMix, SPU_struct *SPU, int length)
 {
+	bool advanced = CommonSettings.spu_advanced && SPU == SPU_core;
+
+	//we used to bail out if speakers were disabled.
+	//this is technically wrong. sound may still be captured, or something.
+	//in all likelihood, any game doing this probably master disabled the SPU also
+	//so, optimization of this case is probably not necessary.
+	//later, we'll just silence the output
+	bool speakers = T1ReadWord(MMU.ARM7_REG, 0x304) & 0x01;
+
+	u8 vol = SPU->regs.mastervol;
+
+	//whether anything can come out of this block at all.
+	//if not, the channels only advance and the output is left silent, without mixing or converting anything.
+	//the advanced path routes channels around in too many ways to rule them out one by one
+	//(and still has to run for capture), so there it only counts as silent when nothing plays
+	bool audible = false;
+	if(SPU->regs.masteren && speakers && vol != 0)
+		for(int i=0;i<16;i++)
+		{
+			const channel_struct *chan = &SPU->channels[i];
+			if(chan->status == CHANSTAT_PLAY && (advanced || !SPU_ChanSilent(chan)))
+			{
+				audible = true;
+				break;
+			}
+		}
+
 	if(actuallyMix)
 	{
-		memset(SPU->sndbuf, 0, length*4*2);
-		memset(SPU->outbuf, 0, length*2*2);
+		SPU->silent = !audible;
+		if(audible)
+			memset(SPU->sndbuf, 0, length*4*2);
+		else
+			SPU_SilenceOutput(SPU, length);
 	}
 
 	//we used to use master enable here, and do nothing if audio is disabled.
@@ -1557,12 +2112,10 @@ static void SPU_MixAudio(bool actuallyMix, SPU_struct *SPU, int length)
 	//but for a speed optimization we will still do it
 	if(!SPU->regs.masteren) return;
 
-	bool advanced = CommonSettings.spu_advanced ;
-
 	//branch here so that slow computers don't have to take the advanced (slower) codepath.
 	//it remainds to be seen exactly how much slower it is
 	//if it isnt much slower then we should refactor everything to be simpler, once it is working
-	if(advanced && SPU == SPU_core)
+	if(advanced)
 	{
 		SPU_MixAudio_Advanced(actuallyMix, SPU, length);
 	}
@@ -1580,21 +2133,13 @@ static void SPU_MixAudio(bool actuallyMix, SPU_struct *SPU, int length)
 			SPU->buflength = length;
 
 			// Mix audio
-			_SPU_ChanUpdate(!CommonSettings.spu_muteChannels[i] && actuallyMix, SPU, chan);
+			_SPU_ChanUpdate(actuallyMix && audible && !SPU_ChanSilent(chan), SPU, chan);
 		}
 	}
 
-	//we used to bail out if speakers were disabled.
-	//this is technically wrong. sound may still be captured, or something.
-	//in all likelihood, any game doing this probably master disabled the SPU also
-	//so, optimization of this case is probably not necessary.
-	//later, we'll just silence the output
-	bool speakers = T1ReadWord(MMU.ARM7_REG, 0x304) & 0x01;
-
-	u8 vol = SPU->regs.mastervol;
-
 	// convert from 32-bit->16-bit
-	if(actuallyMix && speakers)
+	if(actuallyMix && audible)
+	{
 		for (int i = 0; i < length*2; i++)
 		{
 			// Apply Master Volume
@@ -1602,26 +2147,19 @@ static void SPU_MixAudio(bool actuallyMix, SPU_struct *SPU, int length)
 			s16 outsample = MinMax(SPU->sndbuf[i],-0x8000,0x7FFF);
 			SPU->outbuf[i] = outsample;
 		}
-
-
+		SPU->silentLength = 0;
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////////
 
 
-//emulates one hline of the cpu core.
-//this will produce a variable number of samples, calculated to keep a 44100hz output
-//in sync with the emulator framerate
-int spu_core_samples = 0;
-void SPU_Emulate_core()
+//mixes the next length samples of the core spu and sends them on
+static void SPU_EmulateCoreBlock(int length)
 {
 	bool needToMix = true;
 	SoundInterface_struct *soundProcessor = SPU_SoundCore();
-	
-	samples += samples_per_hline;
-	spu_core_samples = (int)(samples);
-	samples -= spu_core_samples;
-	
+
 	// We don't need to mix audio for Dual Synch/Asynch mode since we do this
 	// later in SPU_Emulate_user(). Disable mixing here to speed up processing.
 	// However, recording still needs to mix the audio, so make sure we're also
@@ -1632,21 +2170,209 @@ void SPU_Emulate_core()
 		needToMix = false;
 	}
 	
-	SPU_MixAudio(needToMix, SPU_core, spu_core_samples);
+	SPU_MixAudio(needToMix, SPU_core, length);
 	
-	if (soundProcessor == NULL)
+	if (soundProcessor != NULL)
+	{
+		if (soundProcessor->FetchSamples != NULL)
+		{
+			soundProcessor->FetchSamples(SPU_core->outbuf, length, synchmode, synchronizer);
+		}
+		else
+		{
+			SPU_DefaultFetchSamples(SPU_core->outbuf, length, synchmode, synchronizer);
+		}
+	}
+
+	driver->AVI_SoundUpdate(SPU_core->outbuf,length);
+	WAV_WavSoundUpdate(SPU_core->outbuf,length);
+}
+
+//frame at a time mixing (CommonSettings.spu_frameBatch).
+//each hline only counts up the samples it owes, and register writes are logged with the sample they land on.
+//at vblank the whole frame is mixed in one go, stopping at each logged write to carry it out,
+//which comes out the same as mixing every hline.
+//anything which the cpu could see the difference in makes the spu catch up first:
+//reading its registers, writing sample data a channel is playing from (see main_mem_spu_watch),
+//and register writes which start channels, move them, or touch capture (those are carried out at once).
+//capturing, or playing from anywhere but main memory, falls back to mixing every hline.
+bool spu_core_batching = false;
+
+#define SPU_BATCH_LOG_SIZE 1024
+
+static struct SPU_BatchLogEntry
+{
+	u32 offset; //samples into the batch
+	u32 addr, val;
+	int size;
+} spu_batchLog[SPU_BATCH_LOG_SIZE];
+static int spu_batchLogCount = 0;
+static u32 spu_batchPending = 0; //samples owed
+static bool spu_batchSafe = false; //nothing is going on which needs mixing every hline
+static bool spu_batchFlushing = false;
+
+static void SPU_CoreWrite(u32 addr, u32 val, int size)
+{
+	switch(size)
+	{
+		case 1: SPU_core->WriteByte(addr,val); break;
+		case 2: SPU_core->WriteWord(addr,val); break;
+		case 4: SPU_core->WriteLong(addr,val); break;
+	}
+}
+
+//whether a register write can be logged, or has to be carried out at once
+static bool SPU_BatchCanLog(u32 addr, u32 val, int size)
+{
+	for(int i=0;i<size;i++)
+	{
+		const u32 a = addr+i;
+		const u8 b = (u8)(val >> (i*8));
+		if((a & 0x0F00) == 0x0400)
+		{
+			switch(a & 0xF)
+			{
+				case 0x0: case 0x1: case 0x2: case 0x8: case 0x9: break;
+				case 0x3: if(b & 0x80) return false; break; //key on
+				default: return false; //source, loop start and length
+			}
+		}
+		else if(a == 0x501)
+		{
+			if(b & 0x80) return false; //master enable, which can key channels on
+		}
+		else if(a != 0x500 && a != 0x504 && a != 0x505)
+			return false; //capture
+	}
+	return true;
+}
+
+//works out whether batching is safe, and which pages of main memory to watch
+static void SPU_BatchWatch()
+{
+	memset(main_mem_spu_watch,0,sizeof(main_mem_spu_watch));
+	spu_batchSafe = spu_core_batching;
+	if(!spu_core_batching) return;
+
+	if(SPU_core->regs.cap[0].runtime.running || SPU_core->regs.cap[1].runtime.running)
 	{
+		spu_batchSafe = false;
 		return;
 	}
-	
-	if (soundProcessor->FetchSamples != NULL)
+
+	for(int i=0;i<16;i++)
 	{
-		soundProcessor->FetchSamples(SPU_core->outbuf, spu_core_samples, synchmode, synchronizer);
+		const channel_struct& chan = SPU_core->channels[i];
+		if(chan.status != CHANSTAT_PLAY || chan.format == 3) continue;
+		if((chan.addr >> 24) != 0x02)
+		{
+			//not main memory, which is the only memory writes are watched in
+			spu_batchSafe = false;
+			continue;
+		}
+		const u32 first = (chan.addr & _MMU_MAIN_MEM_MASK) >> 14;
+		const u32 pages = std::min<u32>((((chan.addr & 0x3FFF) + (chan.totlength << 2)) >> 14) + 1, MAIN_MEM_GEN_PAGES);
+		for(u32 p=0;p<pages;p++)
+		{
+			const u32 page = (first + p) & ((_MMU_MAIN_MEM_MASK >> 14));
+			main_mem_spu_watch[page>>5] |= 1<<(page&31);
+		}
 	}
-	else
+}
+
+static void SPU_BatchReset()
+{
+	spu_batchLogCount = 0;
+	spu_batchPending = 0;
+	SPU_BatchWatch();
+}
+
+void SPU_FlushCore()
+{
+	if(spu_batchFlushing) return;
+	if(spu_batchPending == 0 && spu_batchLogCount == 0) return;
+
+	//(capture, if it somehow runs, writes to main memory and may land on a watched page)
+	spu_batchFlushing = true;
+
+	u32 done = 0;
+	for(int i=0;i<spu_batchLogCount;i++)
 	{
-		SPU_DefaultFetchSamples(SPU_core->outbuf, spu_core_samples, synchmode, synchronizer);
+		const SPU_BatchLogEntry& e = spu_batchLog[i];
+		if(e.offset > done)
+		{
+			SPU_EmulateCoreBlock(e.offset - done);
+			done = e.offset;
+		}
+		SPU_CoreWrite(e.addr,e.val,e.size);
 	}
+	if(spu_batchPending > done)
+		SPU_EmulateCoreBlock(spu_batchPending - done);
+
+	spu_batchLogCount = 0;
+	spu_batchPending = 0;
+	spu_batchFlushing = false;
+
+	SPU_BatchWatch();
+}
+
+void SPU_BatchWrite(u32 addr, u32 val, int size)
+{
+	if(spu_batchLogCount == SPU_BATCH_LOG_SIZE || !SPU_BatchCanLog(addr,val,size))
+	{
+		SPU_FlushCore();
+		SPU_CoreWrite(addr,val,size);
+		SPU_BatchWatch();
+		return;
+	}
+
+	if(spu_batchPending == 0 && spu_batchLogCount == 0)
+	{
+		//nothing owed, so there is nothing to log it against
+		SPU_CoreWrite(addr,val,size);
+		return;
+	}
+
+	SPU_BatchLogEntry& e = spu_batchLog[spu_batchLogCount++];
+	e.offset = spu_batchPending;
+	e.addr = addr;
+	e.val = val;
+	e.size = size;
+}
+
+void SPU_SampleDataWrite()
+{
+	SPU_FlushCore();
+}
+
+//emulates one hline of the cpu core.
+//this will produce a variable number of samples, calculated to keep a 44100hz output
+//in sync with the emulator framerate
+int spu_core_samples = 0;
+void SPU_Emulate_core()
+{
+	samples += samples_per_hline;
+	spu_core_samples = (int)(samples);
+	samples -= spu_core_samples;
+
+	if(spu_core_batching != CommonSettings.spu_frameBatch)
+	{
+		SPU_FlushCore();
+		spu_core_batching = CommonSettings.spu_frameBatch;
+		SPU_BatchWatch();
+	}
+
+	if(!spu_core_batching)
+	{
+		SPU_EmulateCoreBlock(spu_core_samples);
+		return;
+	}
+
+	spu_batchPending += spu_core_samples;
+
+	//mix the frame at vblank, or now if this frame cant be batched
+	if(!spu_batchSafe || nds.VCount == 191 || spu_batchPending + (u32)ceil(samples_per_hline) > SPU_core->bufsize)
+		SPU_FlushCore();
 }
 
 void SPU_Emulate_user(bool mix)
@@ -1906,6 +2632,8 @@ void WAV_WavSoundUpdate(void* soundData, int numSamples, WAVMode mode)
 
 void spu_savestate(EMUFILE* os)
 {
+	SPU_FlushCore();
+
 	//version
 	write32le(6,os);
 
@@ -2066,6 +2794,12 @@ bool spu_loadstate(EMUFILE* is, int size)
 		spu->regs.masteren = BIT15(T1ReadWord(MMU.ARM7_REG, 0x500));
 	}
 
+	//main memory was just replaced without going through the MMU
+	SPU_AdpcmCacheClear();
+
+	//anything still owed belonged to the state which was just replaced
+	SPU_BatchReset();
+
 	//copy the core spu (the more accurate) to the user spu
 	SPU_CloneUser();
 
@@ -152,6 +152,8 @@ public:
    s32 lastdata; //the last sample that a channel generated
    s16 *outbuf;
    u32 bufsize;
+   bool silent; //the last block mixed into outbuf was all silence (nothing audible was playing)
+   u32 silentLength; //how many samples at the start of outbuf are known to be zero
    channel_struct channels[16];
 
    //registers
@@ -235,11 +237,21 @@ void SPU_ClearOutputBuffer(void);
 void SPU_Reset(void);
 void SPU_DeInit(void);
 void SPU_KeyOn(int channel);
+
+//with CommonSettings.spu_frameBatch the core spu is mixed a frame at a time, and runs behind the cpu in between.
+//register writes to it are logged (or carried out after it catches up), and reads make it catch up first
+extern bool spu_core_batching;
+void SPU_BatchWrite(u32 addr, u32 val, int size);
+void SPU_FlushCore();
+
 static FORCEINLINE void SPU_WriteByte(u32 addr, u8 val)
 {
 	addr &= 0xFFF;
 
-	SPU_core->WriteByte(addr,val);
+	if(spu_core_batching)
+		SPU_BatchWrite(addr,val,1);
+	else
+		SPU_core->WriteByte(addr,val);
 	if(SPU_user)
 		SPU_user->WriteByte(addr,val);
 }
@@ -247,7 +259,10 @@ static FORCEINLINE void SPU_WriteWord(u32 addr, u16 val)
 {
 	addr &= 0xFFF;
 
-	SPU_core->WriteWord(addr,val);
+	if(spu_core_batching)
+		SPU_BatchWrite(addr,val,2);
+	else
+		SPU_core->WriteWord(addr,val);
 	if(SPU_user)
 		SPU_user->WriteWord(addr,val);
 }
@@ -255,13 +270,16 @@ static FORCEINLINE void SPU_WriteLong(u32 addr, u32 val)
 {
 	addr &= 0xFFF;
 
-	SPU_core->WriteLong(addr,val);
+	if(spu_core_batching)
+		SPU_BatchWrite(addr,val,4);
+	else
+		SPU_core->WriteLong(addr,val);
 	if(SPU_user) 
 		SPU_user->WriteLong(addr,val);
 }
-static FORCEINLINE u8 SPU_ReadByte(u32 addr) { return SPU_core->ReadByte(addr & 0x0FFF); }
-static FORCEINLINE u16 SPU_ReadWord(u32 addr) { return SPU_core->ReadWord(addr & 0x0FFF); }
-static FORCEINLINE u32 SPU_ReadLong(u32 addr) { return SPU_core->ReadLong(addr & 0x0FFF); }
+static FORCEINLINE u8 SPU_ReadByte(u32 addr) { if(spu_core_batching) SPU_FlushCore(); return SPU_core->ReadByte(addr & 0x0FFF); }
+static FORCEINLINE u16 SPU_ReadWord(u32 addr) { if(spu_core_batching) SPU_FlushCore(); return SPU_core->ReadWord(addr & 0x0FFF); }
+static FORCEINLINE u32 SPU_ReadLong(u32 addr) { if(spu_core_batching) SPU_FlushCore(); return SPU_core->ReadLong(addr & 0x0FFF); }
 void SPU_Emulate_core(void);
 void SPU_Emulate_user(bool mix = true);
 void SPU_DefaultFetchSamples(s16 *sampleBuffer, size_t sampleCount, ESynchMode synchMode, ISynchronizingAudioBuffer *theSynchronizer);
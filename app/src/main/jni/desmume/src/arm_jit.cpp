@@ -2203,6 +2203,7 @@ static u32 FASTCALL OP_LDM_STM(u32 adr, u64 regs, int n)
 	{
 		ptr = MMU.MAIN_MEM + (adr & _MMU_MAIN_MEM_MASK32);
 		cycles = n * ((PROCNUM==ARMCPU_ARM9) ? 4 : 2);
+		if(store) MMU_MAIN_markDirty(adr); //(the whole transfer is within one 16KB page)
 	}
 	else if(PROCNUM==ARMCPU_ARM7 && !store && (adr & 0xFF800000) == 0x03800000)
 	{
@@ -33,6 +33,7 @@
 #include <assert.h>
 #include <math.h>
 #include <string.h>
+#include <semaphore.h>
 #include <algorithm>
 #include <queue>
 
@@ -50,6 +51,12 @@
 #include "NDSSystem.h"
 #include "readwrite.h"
 #include "FIFO.h"
+#include "texcache.h"
+#include "utils/ringbuffer.h"
+#include "utils/task.h"
+#if defined(ENABLE_NEON) && defined(__aarch64__)
+	#include <arm_neon.h>
+#endif
 #include "movie.h" //only for currframecounter which really ought to be moved into the core emu....
 
 //#define _SHOW_VTX_COUNTERS	// show polygon/vertex counters on screen
@@ -75,6 +82,9 @@ resolved since then by deferring actual rendering to the next vcount=0 (giving t
 But since we're not sure how we'll eventually want this, I am leaving it sort of reconfigurable, doing all the work
 in this function: */
 static void gfx3d_doFlush();
+static void gfx3d_execute(u8 cmd, u32 param);
+static void gfx3d_syncGeometryStack();
+static void gfx3d_requestTexturePreDecode(u32 format, u32 texpal);
 
 #define GFX_NOARG_COMMAND 0x00
 #define GFX_INVALID_COMMAND 0xFF
@@ -242,8 +252,11 @@ public:
 //while the fifo was full, apparently expecting the fifo not to be full by that time.
 //in general we are finding that 3d takes less time than we think....
 //although maybe the true culprit was charging the cpu less time for the dma.
-#define GFX_DELAY(x) NDS_RescheduleGXFIFO(1);
-#define GFX_DELAY_M2(x) NDS_RescheduleGXFIFO(1);
+//while the geometry thread is running, the emulator thread charges for each command as it hands it over,
+//and the commands themselves must not touch the scheduler.
+static bool geometryThreadRunning = false;
+#define GFX_DELAY(x) if(!geometryThreadRunning) NDS_RescheduleGXFIFO(1);
+#define GFX_DELAY_M2(x) if(!geometryThreadRunning) NDS_RescheduleGXFIFO(1);
 
 using std::max;
 using std::min;
@@ -318,7 +331,7 @@ CACHE_ALIGN MatrixStack	mtxStack[4] = {
 	MatrixStack(1, 3), // Texture stack
 };
 
-int _hack_getMatrixStackLevel(int which) { return mtxStack[which].position; }
+int _hack_getMatrixStackLevel(int which) { gfx3d_syncGeometryStack(); return mtxStack[which].position; }
 
 static CACHE_ALIGN s32		mtxCurrent [4][16];
 static CACHE_ALIGN s32		mtxTemporal[16];
@@ -360,6 +373,7 @@ static CACHE_ALIGN float PTcoords[4] = {0.0, 0.0, 0.0, 1.0};
 
 //raw ds format poly attributes
 static u32 polyAttr=0,textureFormat=0, texturePalette=0, polyAttrPending=0;
+static bool texturePreDecodePending = false; //the texture params changed since the last polygon
 
 //the current vertex color, 5bit values
 static u8 colorRGB[4] = { 31,31,31,31 };
@@ -499,6 +513,7 @@ void VERT::load(EMUFILE* is)
 	OSREAD(u); OSREAD(v);
 	OSREAD(color[0]); OSREAD(color[1]); OSREAD(color[2]);
 	OSREAD(fcolor[0]); OSREAD(fcolor[1]); OSREAD(fcolor[2]);
+	outcode = VERT_OUTCODE_UNKNOWN;
 }
 
 void gfx3d_init()
@@ -521,19 +536,15 @@ void gfx3d_init()
 
 	//printf("SPEED TEST %d %d\n",diff,diff2);
 
-	// Use malloc() instead of new because, for some unknown reason, GCC 4.9 has a bug
-	// that causes a std::bad_alloc exception on certain memory allocations. Right now,
-	// POLYLIST and VERTLIST are POD-style structs, so malloc() can substitute for new
-	// in this case.
 	if(polylists == NULL)
 	{
-		polylists = (POLYLIST *)malloc(sizeof(POLYLIST)*2);
+		polylists = new POLYLIST[2];
 		polylist = &polylists[0];
 	}
 	
 	if(vertlists == NULL)
 	{
-		vertlists = (VERTLIST *)malloc(sizeof(VERTLIST)*2);
+		vertlists = new VERTLIST[2];
 		vertlist = &vertlists[0];
 	}
 	
@@ -543,6 +554,7 @@ void gfx3d_init()
 
 void gfx3d_reset()
 {
+	gfx3d_syncGeometry();
 	gpu3D->NDS_3D_RenderFinish();
 	
 #ifdef _SHOW_VTX_COUNTERS
@@ -558,8 +570,8 @@ void gfx3d_reset()
 	control = 0;
 	drawPending = FALSE;
 	flushPending = FALSE;
-	memset(polylists, 0, sizeof(POLYLIST)*2);
-	memset(vertlists, 0, sizeof(VERTLIST)*2);
+	polylists[0].count = polylists[1].count = 0;
+	vertlists[0].count = vertlists[1].count = 0;
 	gfx3d.state.invalidateToon = true;
 	listTwiddle = 1;
 	twiddleLists();
@@ -569,6 +581,7 @@ void gfx3d_reset()
 	polyAttr = 0;
 	textureFormat = 0;
 	texturePalette = 0;
+	texturePreDecodePending = false;
 	polyAttrPending = 0;
 	mode = 0;
 	s16coord[0] = s16coord[1] = s16coord[2] = s16coord[3] = 0;
@@ -642,6 +655,21 @@ FORCEINLINE s32 vec3dot_fixed32(const s32* a, const s32* b) {
 	return fx32_shiftdown(fx32_mul(a[0],b[0]) + fx32_mul(a[1],b[1]) + fx32_mul(a[2],b[2]));
 }
 
+//which view volume planes a transformed vert lies outside of. the clipper makes the same tests on the float coords;
+//float conversion can only turn a strict inequality into an equality, so a vert found inside here is inside there too
+static FORCEINLINE u8 vec4_outcode_fixed32(const s32* coord)
+{
+	const s64 w = coord[3];
+	u8 outcode = 0;
+	if(coord[0] < -w) outcode |= VERT_OUTCODE_LEFT;
+	if(coord[0] > w) outcode |= VERT_OUTCODE_RIGHT;
+	if(coord[1] < -w) outcode |= VERT_OUTCODE_BOTTOM;
+	if(coord[1] > w) outcode |= VERT_OUTCODE_TOP;
+	if(coord[2] < -w) outcode |= VERT_OUTCODE_FRONT;
+	if(coord[2] > w) outcode |= VERT_OUTCODE_BACK;
+	return outcode;
+}
+
 #define SUBMITVERTEX(ii, nn) polylist->list[polylist->count].vertIndexes[ii] = tempVertInfo.map[nn];
 //Submit a vertex to the GE
 static void SetVertex()
@@ -668,10 +696,11 @@ static void SetVertex()
 	}
 
 	//refuse to do anything if we have too many verts or polys
+	//(this vert may go up to 3 past the end of the list, and it may complete a poly)
 	polygonListCompleted = 0;
-	if(vertlist->count >= VERTLIST_SIZE) 
+	if(!vertlist->reserve(vertlist->count+4)) 
 			return;
-	if(polylist->count >= POLYLIST_SIZE) 
+	if(!polylist->reserve(polylist->count+1)) 
 			return;
 	
 	//TODO - think about keeping the clip matrix concatenated,
@@ -722,6 +751,7 @@ static void SetVertex()
 	vert.color[0] = GFX3D_5TO6(colorRGB[0]);
 	vert.color[1] = GFX3D_5TO6(colorRGB[1]);
 	vert.color[2] = GFX3D_5TO6(colorRGB[2]);
+	vert.outcode = vec4_outcode_fixed32(coordTransformed);
 	tempVertInfo.map[tempVertInfo.count] = vertlist->count + tempVertInfo.count - continuation;
 	tempVertInfo.count++;
 
@@ -825,6 +855,15 @@ static void SetVertex()
 				}
 			}
 
+			//the first polygon after the texture params change is where we know for sure that the texture is going to be used.
+			//let the texture cache start decoding it now, so that it is ready by the time the frame gets rendered
+			if(texturePreDecodePending)
+			{
+				if(textureFormat & (7 << 26))
+					gfx3d_requestTexturePreDecode(textureFormat,texturePalette);
+				texturePreDecodePending = false;
+			}
+
 			poly.polyAttr = polyAttr;
 			poly.texParam = textureFormat;
 			poly.texPalette = texturePalette;
@@ -1388,12 +1427,14 @@ static void gfx3d_glTexImage(u32 val)
 {
 	textureFormat = val;
 	gfx3d_glTexImage_cache();
+	texturePreDecodePending = true;
 	GFX_DELAY(1);
 }
 
 static void gfx3d_glTexPalette(u32 val)
 {
 	texturePalette = val;
+	texturePreDecodePending = true;
 	GFX_DELAY(1);
 }
 
@@ -1545,6 +1586,8 @@ static BOOL gfx3d_glBoxTest(u32 v)
 	verts[5].set_coord(xw,y,zd,1);
 	verts[6].set_coord(xw,yh,zd,1);
 	verts[7].set_coord(x,yh,zd,1);
+	for(int i=0;i<8;i++)
+		verts[i].outcode = VERT_OUTCODE_UNKNOWN;
 
 	//craft the faces of the box (clockwise)
 	POLY polys[6];
@@ -1719,12 +1762,14 @@ void gfx3d_glSwapScreen(unsigned int screen)
 
 int gfx3d_GetNumPolys()
 {
+	gfx3d_syncGeometry();
 	//so is this in the currently-displayed or currently-built list?
 	return (polylists[listTwiddle].count);
 }
 
 int gfx3d_GetNumVertex()
 {
+	gfx3d_syncGeometry();
 	//so is this in the currently-displayed or currently-built list?
 	return (vertlists[listTwiddle].count);
 }
@@ -1748,6 +1793,7 @@ void gfx3d_UpdateToonTable(u8 offset, u32 val)
 
 s32 gfx3d_GetClipMatrix (unsigned int index)
 {
+	gfx3d_syncGeometry();
 	s32 val = MatrixGetMultipliedIndex (index, mtxCurrent[0], mtxCurrent[1]);
 
 	//printf("reading clip matrix: %d\n",index);
@@ -1757,6 +1803,7 @@ s32 gfx3d_GetClipMatrix (unsigned int index)
 
 s32 gfx3d_GetDirectionalMatrix (unsigned int index)
 {
+	gfx3d_syncGeometry();
 	int _index = (((index / 3) * 4) + (index % 3));
 
 	//return (s32)(mtxCurrent[2][_index]*(1<<12));
@@ -2024,11 +2071,202 @@ static void gfx3d_execute(u8 cmd, u32 param)
 	}
 }
 
+//runs the geometry engine on a thread of its own (CommonSettings.GFX3D_GeometryThread).
+//the emulator thread keeps doing all of the gxFIFO bookkeeping (sizes, irqs, dma and timing) and only hands the commands
+//over here instead of executing them. anything which reads the geometry engine's state back has to sync() first.
+class GeometryThread
+{
+public:
+	static const u32 QUEUE_SIZE = 4096;
+
+	GeometryThread()
+		: quit(false)
+		, sleeping(false)
+		, waiting(false)
+		, waitTarget(0)
+		, submitted(0)
+		, executed(0)
+		, lastStackCommand(0)
+	{}
+
+	~GeometryThread() { stop(); }
+
+	void start()
+	{
+		sem_init(&wake,0,0);
+		sem_init(&idle,0,0);
+		quit = sleeping = waiting = false;
+		submitted = executed = lastStackCommand = 0;
+		geometryThreadRunning = true;
+		task.start(false);
+		task.execute(threadProc,this);
+	}
+
+	void stop()
+	{
+		if(!geometryThreadRunning) return;
+		sync();
+		__atomic_store_n(&quit,true,__ATOMIC_SEQ_CST);
+		sem_post(&wake);
+		task.finish();
+		task.shutdown();
+		sem_destroy(&wake);
+		sem_destroy(&idle);
+		commands.clear();
+		geometryThreadRunning = false;
+	}
+
+	//queue a command. waits for the thread to make room if the queue is full.
+	//call wakeup() once done submitting a batch
+	void submit(u8 cmd, u32 param)
+	{
+		const Command command = { param, cmd };
+		while(!commands.push(command))
+		{
+			wakeup();
+			waitFor(submitted - QUEUE_SIZE + 1);
+		}
+		submitted++;
+
+		//push, pop, store and restore are what change the matrix stack pointers and the stack error flag in GXSTAT
+		if(cmd >= 0x11 && cmd <= 0x14)
+			lastStackCommand = submitted;
+	}
+
+	void wakeup()
+	{
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if(__atomic_exchange_n(&sleeping,false,__ATOMIC_SEQ_CST))
+			sem_post(&wake);
+	}
+
+	//waits until everything submitted so far has been executed
+	void sync() { waitFor(submitted); }
+
+	//waits until the matrix stack commands submitted so far have been executed
+	void syncStack() { waitFor(lastStackCommand); }
+
+private:
+	struct Command
+	{
+		u32 param;
+		u8 cmd;
+	};
+
+	bool hasExecuted(u32 serial) const
+	{
+		return (s32)(__atomic_load_n(&executed,__ATOMIC_SEQ_CST) - serial) >= 0;
+	}
+
+	void waitFor(u32 serial)
+	{
+		if(hasExecuted(serial)) return;
+		wakeup();
+		__atomic_store_n(&waitTarget,serial,__ATOMIC_SEQ_CST);
+		__atomic_store_n(&waiting,true,__ATOMIC_SEQ_CST);
+		while(!hasExecuted(serial))
+			while(sem_wait(&idle) != 0) {} //retry when interrupted
+		__atomic_store_n(&waiting,false,__ATOMIC_SEQ_CST);
+	}
+
+	static void* threadProc(void* param)
+	{
+		GeometryThread* self = (GeometryThread*)param;
+		for(;;)
+		{
+			Command command;
+			while(self->commands.pop(command))
+			{
+				gfx3d_execute(command.cmd,command.param);
+				const u32 serial = __atomic_add_fetch(&self->executed,1,__ATOMIC_SEQ_CST);
+				if(__atomic_load_n(&self->waiting,__ATOMIC_SEQ_CST) && (s32)(serial - __atomic_load_n(&self->waitTarget,__ATOMIC_SEQ_CST)) >= 0)
+					sem_post(&self->idle);
+			}
+
+			//go to sleep, unless something arrived in the meantime. the emulator thread checks sleeping after it pushes,
+			//so one of us is bound to notice the other
+			__atomic_store_n(&self->sleeping,true,__ATOMIC_SEQ_CST);
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			if(!self->commands.empty())
+			{
+				__atomic_store_n(&self->sleeping,false,__ATOMIC_SEQ_CST);
+				continue;
+			}
+			if(__atomic_load_n(&self->quit,__ATOMIC_SEQ_CST)) break;
+			while(sem_wait(&self->wake) != 0) {}
+		}
+		return NULL;
+	}
+
+	SPSCRing<Command,QUEUE_SIZE> commands;
+	Task task;
+	sem_t wake, idle;
+	bool quit;
+	bool sleeping;
+	bool waiting;
+	u32 waitTarget;
+
+	//serial numbers of commands. submitted and lastStackCommand belong to the emulator thread, executed to the geometry thread
+	u32 submitted;
+	u32 executed;
+	u32 lastStackCommand;
+};
+
+static GeometryThread geometryThread;
+
+//textures which the geometry thread wants pre-decoded. the texture cache may only be used from the emulator thread
+struct TexturePreDecodeRequest
+{
+	u32 format, texpal;
+};
+static SPSCRing<TexturePreDecodeRequest,64> texturePreDecodeRequests;
+
+static void gfx3d_requestTexturePreDecode(u32 format, u32 texpal)
+{
+	if(geometryThreadRunning)
+	{
+		//it is only a hint, so it doesnt matter if the queue is full
+		const TexturePreDecodeRequest request = { format, texpal };
+		texturePreDecodeRequests.push(request);
+	}
+	else
+		TexCache_PreDecode(format,texpal);
+}
+
+static bool gfx3d_geometryThreadEnabled()
+{
+	return CommonSettings.GFX3D_GeometryThread && !CommonSettings.single_core();
+}
+
+void gfx3d_syncGeometry()
+{
+	if(geometryThreadRunning)
+		geometryThread.sync();
+}
+
+static void gfx3d_syncGeometryStack()
+{
+	if(geometryThreadRunning)
+		geometryThread.syncStack();
+}
+
 void gfx3d_execute3D()
 {
 	u8	cmd = 0;
 	u32	param = 0;
 
+	if(gfx3d_geometryThreadEnabled() != geometryThreadRunning)
+	{
+		if(geometryThreadRunning)
+			geometryThread.stop();
+		else
+			geometryThread.start();
+	}
+
+	TexturePreDecodeRequest request;
+	while(texturePreDecodeRequests.pop(request))
+		TexCache_PreDecode(request.format,request.texpal);
+
 #ifndef FLUSHMODE_HACK
 	if (isSwapBuffers) return;
 #endif
@@ -2046,12 +2284,27 @@ void gfx3d_execute3D()
 			//since we did anything at all, incur a pipeline motion cost.
 			//also, we can't let gxfifo sequencer stall until the fifo is empty.
 			//see...
-			GFX_DELAY(1); 
+			//(this is charged here even while the geometry thread is running, unlike GFX_DELAY)
+			NDS_RescheduleGXFIFO(1);
 
 			//..these guys will ordinarily set a delay, but multi-param operations won't
 			//for the earlier params.
 			//printf("%05d:%03d:%12lld: executed 3d: %02X %08X\n",currFrameCounter, nds.VCount, nds_timer , cmd, param);
-			gfx3d_execute(cmd, param);
+			if(!geometryThreadRunning)
+				gfx3d_execute(cmd, param);
+			else if(cmd == 0x50)
+			{
+				//swap buffers only flags the flush for the next vblank (which syncs), but it has to stop this loop right away
+				gfx3d_execute(cmd, param);
+			}
+			else if(cmd >= 0x70)
+			{
+				//the tests report their results straight back to the cpu
+				geometryThread.sync();
+				gfx3d_execute(cmd, param);
+			}
+			else
+				geometryThread.submit(cmd, param);
 
 			//this is a COMPATIBILITY HACK.
 			//this causes 3d to take virtually no time whatsoever to execute.
@@ -2064,6 +2317,8 @@ void gfx3d_execute3D()
 		} else break;
 	}
 
+	if(geometryThreadRunning)
+		geometryThread.wakeup();
 }
 
 void gfx3d_glFlush(u32 v)
@@ -2133,6 +2388,118 @@ static bool gfx3d_ysort_compare(int num1, int num2)
 	return original;
 }
 
+static GFX3D_List<float,6144,VERTLIST_SIZE> vertSortY;
+
+//the y value the sort uses for each vertex, 1-(y+w)/(2w), with w=0 taken as a tiny number instead.
+//each vertex is done once here rather than once for every poly using it.
+//these are real divides: a reciprocal estimate would give slightly different values and so reorder polys which come out even.
+static void gfx3d_calcVertSortY(const VERT* verts, int count, float* out)
+{
+	int i=0;
+#if defined(ENABLE_SSE2)
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 tiny = _mm_set1_ps(0.00000001f);
+	for(;i+4<=count;i+=4)
+	{
+		const __m128 y = _mm_setr_ps(verts[i].y,verts[i+1].y,verts[i+2].y,verts[i+3].y);
+		__m128 w = _mm_setr_ps(verts[i].w,verts[i+1].w,verts[i+2].w,verts[i+3].w);
+		const __m128 wzero = _mm_cmpeq_ps(w,_mm_setzero_ps());
+		w = _mm_or_ps(_mm_andnot_ps(wzero,w),_mm_and_ps(wzero,tiny));
+		_mm_storeu_ps(out+i, _mm_sub_ps(one,_mm_div_ps(_mm_add_ps(y,w),_mm_add_ps(w,w))));
+	}
+#elif defined(ENABLE_NEON) && defined(__aarch64__)
+	const float32x4_t one = vdupq_n_f32(1.0f);
+	const float32x4_t tiny = vdupq_n_f32(0.00000001f);
+	for(;i+4<=count;i+=4)
+	{
+		float32x4_t y = vdupq_n_f32(verts[i].y);
+		float32x4_t w = vdupq_n_f32(verts[i].w);
+		y = vsetq_lane_f32(verts[i+1].y,y,1); w = vsetq_lane_f32(verts[i+1].w,w,1);
+		y = vsetq_lane_f32(verts[i+2].y,y,2); w = vsetq_lane_f32(verts[i+2].w,w,2);
+		y = vsetq_lane_f32(verts[i+3].y,y,3); w = vsetq_lane_f32(verts[i+3].w,w,3);
+		w = vbslq_f32(vceqq_f32(w,vdupq_n_f32(0.0f)),tiny,w);
+		vst1q_f32(out+i, vsubq_f32(one,vdivq_f32(vaddq_f32(y,w),vaddq_f32(w,w))));
+	}
+#endif
+	for(;i<count;i++)
+	{
+		const float w = (verts[i].w != 0.0f) ? verts[i].w : 0.00000001f;
+		out[i] = 1.0f-(verts[i].y+w)/(2*w);
+	}
+}
+
+//maps a float to a u32 which sorts the same way it compares
+static FORCEINLINE u32 gfx3d_ysort_key(float f)
+{
+	u32 bits;
+	memcpy(&bits,&f,4);
+	if((bits & 0x7FFFFFFF) == 0) bits = 0; //-0 and +0 compare equal
+	return (bits & 0x80000000) ? ~bits : (bits | 0x80000000);
+}
+
+struct YSortItem
+{
+	u64 key; //maxy in the upper half and miny in the lower
+	int index;
+};
+static GFX3D_List<YSortItem,2048,POLYLIST_SIZE> ysortBuffers[2];
+
+//sorts poly indices into the same order as std::stable_sort with gfx3d_ysort_compare would:
+//by maxy, then miny, and otherwise leaving them as they are.
+//this is a least significant digit first radix sort (which is stable) on the bits of both values, a byte at a time.
+static void gfx3d_ysort(int* indices, int count)
+{
+	if(count < 2) return;
+
+	ysortBuffers[0].reserve(count);
+	ysortBuffers[1].reserve(count);
+	YSortItem* src = ysortBuffers[0].list;
+	YSortItem* dst = ysortBuffers[1].list;
+
+	u32 histograms[8][256];
+	memset(histograms,0,sizeof(histograms));
+	for(int i=0;i<count;i++)
+	{
+		const POLY &poly = polylist->list[indices[i]];
+		const u64 key = ((u64)gfx3d_ysort_key(poly.maxy)<<32) | gfx3d_ysort_key(poly.miny);
+		src[i].key = key;
+		src[i].index = indices[i];
+		for(int digit=0;digit<8;digit++)
+			histograms[digit][(key>>(digit*8))&0xFF]++;
+	}
+
+	for(int digit=0;digit<8;digit++)
+	{
+		const int shift = digit*8;
+		u32* histogram = histograms[digit];
+
+		//nothing to do when every key has the same value here. in practice that is most of the upper bytes
+		if(histogram[(src[0].key>>shift)&0xFF] == (u32)count)
+			continue;
+
+		u32 offset = 0;
+		for(int i=0;i<256;i++)
+		{
+			const u32 n = histogram[i];
+			histogram[i] = offset;
+			offset += n;
+		}
+
+		for(int i=0;i<count;i++)
+			dst[histogram[(src[i].key>>shift)&0xFF]++] = src[i];
+
+		std::swap(src,dst);
+	}
+
+	for(int i=0;i<count;i++)
+		indices[i] = src[i].index;
+
+#ifndef NDEBUG
+	for(int i=1;i<count;i++)
+		assert(!gfx3d_ysort_compare(indices[i],indices[i-1]));
+#endif
+}
+
 static void gfx3d_doFlush()
 {
 	gfx3d.frameCtr++;
@@ -2183,23 +2550,21 @@ static void gfx3d_doFlush()
 	//TODO - this _MUST_ be moved later in the pipeline, after clipping.
 	//the w-division here is just an approximation to fix the shop in harvest moon island of happiness
 	//also the buttons in the knights in the nightmare frontend depend on this
+	// TODO: Possible divide by zero with the w-coordinate.
+	// Is the vertex being read correctly? Is 0 a valid value for w?
+	// If both of these questions answer to yes, then how does the NDS handle a NaN?
+	// For now, simply prevent w from being zero.
+	vertSortY.reserve(vertlist->count);
+	gfx3d_calcVertSortY(vertlist->list, vertlist->count, vertSortY.list);
 	for(int i=0; i<polycount; i++)
 	{
-		// TODO: Possible divide by zero with the w-coordinate.
-		// Is the vertex being read correctly? Is 0 a valid value for w?
-		// If both of these questions answer to yes, then how does the NDS handle a NaN?
-		// For now, simply prevent w from being zero.
 		POLY &poly = polylist->list[i];
-		float verty = vertlist->list[poly.vertIndexes[0]].y;
-		float vertw = (vertlist->list[poly.vertIndexes[0]].w != 0.0f) ? vertlist->list[poly.vertIndexes[0]].w : 0.00000001f;
-		verty = 1.0f-(verty+vertw)/(2*vertw);
+		float verty = vertSortY.list[poly.vertIndexes[0]];
 		poly.miny = poly.maxy = verty;
 
 		for(int j=1; j<poly.type; j++)
 		{
-			verty = vertlist->list[poly.vertIndexes[j]].y;
-			vertw = (vertlist->list[poly.vertIndexes[j]].w != 0.0f) ? vertlist->list[poly.vertIndexes[j]].w : 0.00000001f;
-			verty = 1.0f-(verty+vertw)/(2*vertw);
+			verty = vertSortY.list[poly.vertIndexes[j]];
 			poly.miny = min(poly.miny, verty);
 			poly.maxy = max(poly.maxy, verty);
 		}
@@ -2208,6 +2573,8 @@ static void gfx3d_doFlush()
 
 	//we need to sort the poly list with alpha polys last
 	//first, look for opaque polys
+	gfx3d.indexlist.reserve(polycount);
+	gfx3d.indexlist.count = polycount;
 	int ctr=0;
 	for(int i=0;i<polycount;i++) {
 		POLY &poly = polylist->list[i];
@@ -2222,21 +2589,20 @@ static void gfx3d_doFlush()
 			gfx3d.indexlist.list[ctr++] = i;
 	}
 	
-	//NOTE: the use of the stable_sort below must be here as a workaround for some compilers on osx and linux.
+	//NOTE: this used to be a std::stable_sort with gfx3d_ysort_compare, as a workaround for some compilers on osx and linux.
 	//we're hazy on the exact behaviour of the resulting bug, all thats known is the list gets mangled somehow.
-	//it should not in principle be relevant since the predicate results in no ties.
-	//perhaps the compiler is buggy. perhaps the predicate is wrong.
+	//gfx3d_ysort is stable by construction and produces the same order.
 
 	//now we have to sort the opaque polys by y-value.
 	//(test case: harvest moon island of happiness character cretor UI)
 	//should this be done after clipping??
-	std::stable_sort(gfx3d.indexlist.list, gfx3d.indexlist.list + opaqueCount, gfx3d_ysort_compare);
+	gfx3d_ysort(gfx3d.indexlist.list, opaqueCount);
 	
 	if(!gfx3d.state.sortmode)
 	{
 		//if we are autosorting translucent polys, we need to do this also
 		//TODO - this is unverified behavior. need a test case
-		std::stable_sort(gfx3d.indexlist.list + opaqueCount, gfx3d.indexlist.list + polycount, gfx3d_ysort_compare);
+		gfx3d_ysort(gfx3d.indexlist.list + opaqueCount, polycount - opaqueCount);
 	}
 
 	//switch to the new lists
@@ -2259,10 +2625,12 @@ void gfx3d_VBlankSignal()
 {
 	if (isSwapBuffers)
 	{
+		//the lists are about to be handed to the renderer
+		gfx3d_syncGeometry();
 #ifndef FLUSHMODE_HACK
 		gfx3d_doFlush();
 #endif
-		GFX_DELAY(392);
+		NDS_RescheduleGXFIFO(1); //not GFX_DELAY, this has to happen even while the geometry thread is running
 		isSwapBuffers = FALSE;
 	}
 }
@@ -2364,6 +2732,7 @@ void gfx3d_Control(u32 v)
 //other misc stuff
 void gfx3d_glGetMatrix(unsigned int m_mode, int index, float* dest)
 {
+	gfx3d_syncGeometry();
 	//if(index == -1)
 	//{
 	//	MatrixCopy(dest, mtxCurrent[m_mode]);
@@ -2381,11 +2750,13 @@ void gfx3d_glGetMatrix(unsigned int m_mode, int index, float* dest)
 
 void gfx3d_glGetLightDirection(unsigned int index, unsigned int* dest)
 {
+	gfx3d_syncGeometry();
 	*dest = lightDirection[index];
 }
 
 void gfx3d_glGetLightColor(unsigned int index, unsigned int* dest)
 {
+	gfx3d_syncGeometry();
 	*dest = lightColor[index];
 }
 
@@ -2555,10 +2926,15 @@ bool gfx3d_loadstate(EMUFILE* is, int size)
 
 	if(version>=1)
 	{
-		OSREAD(vertlist->count);
+		int count;
+		OSREAD(count);
+		if(!vertlist->reserve(count)) return false;
+		vertlist->count = count;
 		for(int i=0;i<vertlist->count;i++)
 			vertlist->list[i].load(is);
-		OSREAD(polylist->count);
+		OSREAD(count);
+		if(!polylist->reserve(count)) return false;
+		polylist->count = count;
 		for(int i=0;i<polylist->count;i++)
 			polylist->list[i].load(is);
 	}
@@ -2791,6 +3167,21 @@ template<bool hirez> void GFX3D_Clipper::clipPoly(POLY* poly, VERT** verts)
 	CLIPLOG("==Begin poly==\n");
 
 	int type = poly->type;
+
+	//a poly entirely inside the view volume comes out of the clipper unchanged,
+	//except that each of the six stages rotates the vert order by one. do the same here without running them
+	u8 outcode = verts[0]->outcode | verts[1]->outcode | verts[2]->outcode;
+	if(type == 4) outcode |= verts[3]->outcode;
+	if(outcode == 0)
+	{
+		for(int i=0;i<type;i++)
+			clippedPolys[clippedPolyCounter].clipVerts[i] = *verts[(i+6)%type];
+		clippedPolys[clippedPolyCounter].type = type;
+		clippedPolys[clippedPolyCounter].poly = poly;
+		clippedPolyCounter++;
+		return;
+	}
+
 	numScratchClipVerts = 0;
 
 	clipper.init(clippedPolys[clippedPolyCounter].clipVerts);
@@ -22,6 +22,8 @@
 #include <iosfwd>
 #include <ostream>
 #include <istream>
+#include <stdlib.h>
+#include <string.h>
 
 #include "types.h"
 
@@ -485,12 +487,67 @@ struct POLY {
 	void load(EMUFILE* is);
 };
 
-#define POLYLIST_SIZE 100000
-struct POLYLIST {
-	POLY list[POLYLIST_SIZE];
+//storage for the lists which the geometry engine builds.
+//the hardware keeps at most 2048 polys and 6144 verts per frame, so that is about what these start out with,
+//but since we also keep the polys which it would have clipped or culled away, they grow on demand (up to MAX_SIZE).
+//copying one copies its contents
+template<typename T, int INITIAL_SIZE, int MAX_SIZE>
+struct GFX3D_List
+{
+	T* list;
 	int count;
+	int capacity;
+
+	GFX3D_List()
+		: list(NULL)
+		, count(0)
+		, capacity(0)
+	{
+		reserve(INITIAL_SIZE);
+	}
+
+	GFX3D_List(const GFX3D_List& other)
+		: list(NULL)
+		, count(0)
+		, capacity(0)
+	{
+		*this = other;
+	}
+
+	~GFX3D_List() { free(list); }
+
+	GFX3D_List& operator=(const GFX3D_List& other)
+	{
+		if(this == &other) return *this;
+		reserve(other.count);
+		memcpy(list,other.list,other.count*sizeof(T));
+		count = other.count;
+		return *this;
+	}
+
+	//makes room for at least n items, keeping the current ones. fails past MAX_SIZE
+	bool reserve(int n)
+	{
+		if(n <= capacity) return true;
+		if(n > MAX_SIZE) return false;
+
+		int newCapacity = capacity ? capacity : INITIAL_SIZE;
+		while(newCapacity < n) newCapacity *= 2;
+		if(newCapacity > MAX_SIZE) newCapacity = MAX_SIZE;
+
+		void* newList = NULL;
+		if(posix_memalign(&newList,64,newCapacity*sizeof(T)) != 0) return false;
+		if(list) memcpy(newList,list,count*sizeof(T));
+		free(list);
+		list = (T*)newList;
+		capacity = newCapacity;
+		return true;
+	}
 };
 
+#define POLYLIST_SIZE 100000
+struct POLYLIST : public GFX3D_List<POLY,2048,POLYLIST_SIZE> {};
+
 //just a vert with a 4 float position
 struct VERT_POS4f
 {
@@ -512,22 +569,29 @@ struct VERT_POS4f
 	}
 };
 
+#define VERT_OUTCODE_LEFT    0x01
+#define VERT_OUTCODE_RIGHT   0x02
+#define VERT_OUTCODE_BOTTOM  0x04
+#define VERT_OUTCODE_TOP     0x08
+#define VERT_OUTCODE_FRONT   0x10
+#define VERT_OUTCODE_BACK    0x20
+#define VERT_OUTCODE_UNKNOWN 0xFF
+
 //dont use SSE optimized matrix instructions in here, things might not be aligned
 //we havent padded this because the sheer bulk of data leaves things running faster without the extra bloat
 struct VERT {
-	// Align to 16 for SSE instructions to work
 	union {
 		float coord[4];
 		struct {
 			float x,y,z,w;
 		};
-	} CACHE_ALIGN;
+	};
 	union {
 		float texcoord[2];
 		struct {
 			float u,v;
 		};
-	} CACHE_ALIGN;
+	};
 	void set_coord(float x, float y, float z, float w) { 
 		this->x = x; 
 		this->y = y; 
@@ -542,6 +606,9 @@ struct VERT {
 	}
 	float fcolor[3];
 	u8 color[3];
+	//the view volume planes (VERT_OUTCODE_*) which this vert lies outside of, worked out by the geometry engine when it transformed the vert.
+	//polys whose verts are all inside skip the clipper. VERT_OUTCODE_UNKNOWN for verts which came from anywhere else
+	u8 outcode;
 
 
 	void color_to_float() {
@@ -553,16 +620,12 @@ struct VERT {
 	void load(EMUFILE* is);
 };
 
-#define VERTLIST_SIZE 400000
-//#define VERTLIST_SIZE 10000
-struct VERTLIST {
-	VERT list[VERTLIST_SIZE];
-	int count;
-};
+//POLY::vertIndexes are 16bit, so there is no point in keeping more verts than this
+#define VERTLIST_SIZE 65536
+struct VERTLIST : public GFX3D_List<VERT,6144,VERTLIST_SIZE> {};
 
-struct INDEXLIST {
-	int list[POLYLIST_SIZE];
-};
+//the order in which to render the polys of a POLYLIST (count is the number of polys)
+struct INDEXLIST : public GFX3D_List<int,2048,POLYLIST_SIZE> {};
 
 
 struct VIEWPORT {
@@ -740,6 +803,9 @@ void gfx3d_VBlankSignal();
 void gfx3d_VBlankEndSignal(bool skipFrame);
 void gfx3d_Control(u32 v);
 void gfx3d_execute3D();
+//waits for the geometry thread (if it is running) to execute everything it has been handed.
+//must be called before touching any geometry engine state from outside of it
+void gfx3d_syncGeometry();
 void gfx3d_sendCommandToFIFO(u32 val);
 void gfx3d_sendCommand(u32 cmd, u32 param);
 
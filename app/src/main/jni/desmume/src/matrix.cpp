@@ -24,6 +24,12 @@
 #include "matrix.h"
 #include "MMU.h"
 
+#if defined(ENABLE_NEON)
+	#include <arm_neon.h>
+#elif defined(ENABLE_SSE4_1)
+	#include <smmintrin.h>
+#endif
+
 void _NOSSE_MatrixMultVec4x4 (const float *matrix, float *vecPtr)
 {
 	float x = vecPtr[0];
@@ -37,8 +43,55 @@ void _NOSSE_MatrixMultVec4x4 (const float *matrix, float *vecPtr)
 	vecPtr[3] = x * matrix[3] + y * matrix[7] + z * matrix[11] + w * matrix[15];
 }
 
+//the vector versions compute exactly what the plain one does: full 64bit products, summed, then shifted down and truncated to 32bits.
+//the geometry engine runs every vertex through this twice, so it is worth the trouble
 void MatrixMultVec4x4 (const s32 *matrix, s32 *vecPtr)
 {
+#if defined(ENABLE_NEON)
+	const int32x4_t col0 = vld1q_s32(matrix);
+	const int32x4_t col1 = vld1q_s32(matrix+4);
+	const int32x4_t col2 = vld1q_s32(matrix+8);
+	const int32x4_t col3 = vld1q_s32(matrix+12);
+	const s32 x = vecPtr[0];
+	const s32 y = vecPtr[1];
+	const s32 z = vecPtr[2];
+	const s32 w = vecPtr[3];
+
+	int64x2_t lo = vmull_n_s32(vget_low_s32(col0),x);
+	lo = vmlal_n_s32(lo,vget_low_s32(col1),y);
+	lo = vmlal_n_s32(lo,vget_low_s32(col2),z);
+	lo = vmlal_n_s32(lo,vget_low_s32(col3),w);
+	int64x2_t hi = vmull_n_s32(vget_high_s32(col0),x);
+	hi = vmlal_n_s32(hi,vget_high_s32(col1),y);
+	hi = vmlal_n_s32(hi,vget_high_s32(col2),z);
+	hi = vmlal_n_s32(hi,vget_high_s32(col3),w);
+
+	vst1q_s32(vecPtr,vcombine_s32(vshrn_n_s64(lo,12),vshrn_n_s64(hi,12)));
+#elif defined(ENABLE_SSE4_1)
+	//_mm_mul_epi32 only multiplies the even elements, so the odd ones are moved down and done separately.
+	//a logical shift is fine for the result, since only the low 32bits of it are kept
+	const __m128i col0 = _mm_loadu_si128((const __m128i*)matrix);
+	const __m128i col1 = _mm_loadu_si128((const __m128i*)(matrix+4));
+	const __m128i col2 = _mm_loadu_si128((const __m128i*)(matrix+8));
+	const __m128i col3 = _mm_loadu_si128((const __m128i*)(matrix+12));
+	const __m128i x = _mm_set1_epi32(vecPtr[0]);
+	const __m128i y = _mm_set1_epi32(vecPtr[1]);
+	const __m128i z = _mm_set1_epi32(vecPtr[2]);
+	const __m128i w = _mm_set1_epi32(vecPtr[3]);
+
+	__m128i even = _mm_mul_epi32(col0,x);
+	even = _mm_add_epi64(even,_mm_mul_epi32(col1,y));
+	even = _mm_add_epi64(even,_mm_mul_epi32(col2,z));
+	even = _mm_add_epi64(even,_mm_mul_epi32(col3,w));
+	__m128i odd = _mm_mul_epi32(_mm_srli_epi64(col0,32),x);
+	odd = _mm_add_epi64(odd,_mm_mul_epi32(_mm_srli_epi64(col1,32),y));
+	odd = _mm_add_epi64(odd,_mm_mul_epi32(_mm_srli_epi64(col2,32),z));
+	odd = _mm_add_epi64(odd,_mm_mul_epi32(_mm_srli_epi64(col3,32),w));
+
+	even = _mm_srli_epi64(even,12);
+	odd = _mm_slli_epi64(_mm_srli_epi64(odd,12),32);
+	_mm_storeu_si128((__m128i*)vecPtr,_mm_blend_epi16(even,odd,0xCC));
+#else
 	const s32 x = vecPtr[0];
 	const s32 y = vecPtr[1];
 	const s32 z = vecPtr[2];
@@ -48,6 +101,7 @@ void MatrixMultVec4x4 (const s32 *matrix, s32 *vecPtr)
 	vecPtr[1] = fx32_shiftdown(fx32_mul(x,matrix[1]) + fx32_mul(y,matrix[5]) + fx32_mul(z,matrix[ 9]) + fx32_mul(w,matrix[13]));
 	vecPtr[2] = fx32_shiftdown(fx32_mul(x,matrix[2]) + fx32_mul(y,matrix[6]) + fx32_mul(z,matrix[10]) + fx32_mul(w,matrix[14]));
 	vecPtr[3] = fx32_shiftdown(fx32_mul(x,matrix[3]) + fx32_mul(y,matrix[7]) + fx32_mul(z,matrix[11]) + fx32_mul(w,matrix[15]));
+#endif
 }
 
 void MatrixMultVec3x3_fixed(const s32 *matrix, s32 *vecPtr)
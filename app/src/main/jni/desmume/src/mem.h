@@ -34,54 +34,54 @@ enum MMU_ACCESS_TYPE
 	MMU_AT_DEBUG, //used for emulator debugging functions (bypasses some debug handling)
 };
 
-static INLINE u8 T1ReadByte(u8* const mem, const u32 addr)
+static INLINE u8 T1ReadByte(const u8* const mem, const u32 addr)
 {
    return mem[addr];
 }
 
-static INLINE u16 T1ReadWord_guaranteedAligned(void* const mem, const u32 addr)
+static INLINE u16 T1ReadWord_guaranteedAligned(const void* const mem, const u32 addr)
 {
 	assert((addr&1)==0);
 #ifdef WORDS_BIGENDIAN
-   return (((u8*)mem)[addr + 1] << 8) | ((u8*)mem)[addr];
+   return (((const u8*)mem)[addr + 1] << 8) | ((const u8*)mem)[addr];
 #else
-   return *(u16*)((u8*)mem + addr);
+   return *(const u16*)((const u8*)mem + addr);
 #endif
 }
 
-static INLINE u16 T1ReadWord(void* const mem, const u32 addr)
+static INLINE u16 T1ReadWord(const void* const mem, const u32 addr)
 {
 #ifdef WORDS_BIGENDIAN
-   return (((u8*)mem)[addr + 1] << 8) | ((u8*)mem)[addr];
+   return (((const u8*)mem)[addr + 1] << 8) | ((const u8*)mem)[addr];
 #else
-   return *((u16 *) ((u8*)mem + addr));
+   return *((const u16 *) ((const u8*)mem + addr));
 #endif
 }
 
-static INLINE u32 T1ReadLong_guaranteedAligned(u8* const  mem, const u32 addr)
+static INLINE u32 T1ReadLong_guaranteedAligned(const u8* const  mem, const u32 addr)
 {
 	assert((addr&3)==0);
 #ifdef WORDS_BIGENDIAN
    return (mem[addr + 3] << 24 | mem[addr + 2] << 16 |
            mem[addr + 1] << 8 | mem[addr]);
 #else
-	return *(u32*)(mem + addr);
+	return *(const u32*)(mem + addr);
 #endif
 }
 
 
-static INLINE u32 T1ReadLong(u8* const  mem, u32 addr)
+static INLINE u32 T1ReadLong(const u8* const  mem, u32 addr)
 {
    addr &= ~3;
 #ifdef WORDS_BIGENDIAN
    return (mem[addr + 3] << 24 | mem[addr + 2] << 16 |
            mem[addr + 1] << 8 | mem[addr]);
 #else
-   return *(u32*)(mem + addr);
+   return *(const u32*)(mem + addr);
 #endif
 }
 
-static INLINE u64 T1ReadQuad(u8* const mem, const u32 addr)
+static INLINE u64 T1ReadQuad(const u8* const mem, const u32 addr)
 {
 #ifdef WORDS_BIGENDIAN
    return (u64(mem[addr + 7]) << 56 | u64(mem[addr + 6]) << 48 |
@@ -89,7 +89,7 @@ static INLINE u64 T1ReadQuad(u8* const mem, const u32 addr)
            u64(mem[addr + 3]) << 24 | u64(mem[addr + 2]) << 16 |
            u64(mem[addr + 1]) << 8  | u64(mem[addr    ]));
 #else
-   return *((u64 *) (mem + addr));
+   return *((const u64 *) (mem + addr));
 #endif
 }
 
@@ -19,8 +19,8 @@
 
 #include "metaspu.h"
 
-#include <queue>
-#include <vector>
+#include <string.h>
+#include <math.h>
 #include <assert.h>
 
 //for pcsx2 method
@@ -35,6 +35,77 @@ template<typename T> inline T _abs(T val)
 	else return val;
 }
 
+//a first-in first-out queue of fixed capacity (rounded up to a power of two), allocated once.
+//these run every hline, so nothing here may touch the heap per sample.
+//when it is full, pushing more throws away the oldest items to make room (that only happens
+//when nobody has been consuming for a second or so, and then the old audio is stale anyway)
+template<typename T> class RingQueue
+{
+public:
+	RingQueue(u32 minCapacity)
+		: head(0)
+		, tail(0)
+	{
+		capacity = 1;
+		while(capacity < minCapacity) capacity <<= 1;
+		mask = capacity-1;
+		items = new T[capacity];
+	}
+
+	~RingQueue() { delete[] items; }
+
+	u32 size() const { return head - tail; }
+
+	//0 is the oldest item
+	FORCEINLINE T& operator[](u32 i) { return items[(tail+i)&mask]; }
+	FORCEINLINE T& front() { return items[tail&mask]; }
+
+	FORCEINLINE void push(const T& item)
+	{
+		if(head - tail == capacity) tail++;
+		items[head&mask] = item;
+		head++;
+	}
+
+	void push(const T* src, u32 count)
+	{
+		if(count > capacity)
+		{
+			src += count - capacity;
+			count = capacity;
+		}
+		if(head - tail + count > capacity)
+			tail = head + count - capacity;
+		const u32 at = head & mask;
+		const u32 first = std::min(count, capacity - at);
+		memcpy(items + at, src, first*sizeof(T));
+		memcpy(items, src + first, (count-first)*sizeof(T));
+		head += count;
+	}
+
+	FORCEINLINE void pop() { tail++; }
+
+	//removes the oldest count items
+	void erase(u32 count) { tail += std::min(count, size()); }
+
+	//copies out (without removing) the oldest count items
+	void copy(T* dst, u32 count) const
+	{
+		const u32 at = tail & mask;
+		const u32 first = std::min(count, capacity - at);
+		memcpy(dst, items + at, first*sizeof(T));
+		memcpy(dst + first, items, (count-first)*sizeof(T));
+	}
+
+private:
+	T* items;
+	u32 capacity, mask;
+	u32 head, tail; //count up forever; the capacity divides 2^32 so wrapping is fine
+};
+
+//about a second and a half at 44100hz
+#define SYNCH_QUEUE_FRAMES 65536
+
 template<typename T> inline T moveValueTowards(T val, T target, T incr)
 {
 	incr = _abs(incr);
@@ -67,11 +138,7 @@ public:
 
 	virtual void enqueue_samples(s16* buf, int samples_provided)
 	{
-		for(int i=0;i<samples_provided;i++) {
-			s16 left = *buf++;
-			s16 right = *buf++;
-			adjustobuf.enqueue(left,right);
-		}
+		adjustobuf.enqueue(buf,samples_provided);
 	}
 
 	//returns the number of samples actually supplied, which may not match the number requested
@@ -105,37 +172,41 @@ private:
 	{
 	public:
 		Adjustobuf(int _minLatency, int _maxLatency)
-			: size(0)
-			, minLatency(_minLatency)
+			: minLatency(_minLatency)
 			, maxLatency(_maxLatency)
+			, buffer(SYNCH_QUEUE_FRAMES)
+			, size(0)
+			, statsHistory(kAverageSize+1)
 		{
 			rollingTotalSize = 0;
 			targetLatency = (maxLatency + minLatency)/2;
 			rate = 1.0f;
 			cursor = 0.0f;
 			curr[0] = curr[1] = 0;
-			kAverageSize = 80000;
 		}
 
 		float rate, cursor;
 		int minLatency, targetLatency, maxLatency;
-		std::queue<s16> buffer;
+
+		//stereo frames
+		struct frame { s16 l, r; };
+		RingQueue<frame> buffer;
 		int size;
 		s16 curr[2];
 
-		std::queue<int> statsHistory;
+		static const u32 kAverageSize = 80000;
+
+		//never holds more than kAverageSize+1 entries, so nothing is ever pushed out of it
+		RingQueue<int> statsHistory;
 
-		void enqueue(s16 left, s16 right) 
+		void enqueue(const s16* buf, int samples)
 		{
-			buffer.push(left);
-			buffer.push(right);
-			size++;
+			buffer.push((const frame*)buf,samples);
+			size = buffer.size();
 		}
 
 		s64 rollingTotalSize;
 
-		u32 kAverageSize;
-
 		void addStatistic()
 		{
 			statsHistory.push(size);
@@ -175,8 +246,9 @@ private:
 			while(cursor>1.0f) {
 				cursor -= 1.0f;
 				if(size>0) {
-					curr[0] = buffer.front(); buffer.pop();
-					curr[1] = buffer.front(); buffer.pop();
+					curr[0] = buffer.front().l;
+					curr[1] = buffer.front().r;
+					buffer.pop();
 					size--;
 				}
 			}
@@ -196,7 +268,7 @@ private:
 		ssamp(s16 ll, s16 rr) : l(ll), r(rr) {}
 	};
 
-	std::vector<ssamp> sampleQueue;
+	RingQueue<ssamp> sampleQueue;
 
 	// returns values going between 0 and y-1 in a saw wave pattern, based on x
 	static FORCEINLINE int pingpong(int x, int y)
@@ -240,23 +312,22 @@ private:
 		*outbuf++ = sample.r;
 	}
 
-	static FORCEINLINE void emit_samples(s16*& outbuf, const ssamp* samplebuf, int samples)
+	//takes the samples off the front of the queue
+	static FORCEINLINE void emit_samples(s16*& outbuf, RingQueue<ssamp>& queue, int samples)
 	{
-		for(int i=0;i<samples;i++)
-			emit_sample(outbuf,samplebuf[i]);
+		queue.copy((ssamp*)outbuf,samples);
+		queue.erase(samples);
+		outbuf += samples*2;
 	}
 
 public:
 	NitsujaSynchronizer()
+		: sampleQueue(SYNCH_QUEUE_FRAMES)
 	{}
 
 	virtual void enqueue_samples(s16* buf, int samples_provided)
 	{
-		for(int i=0;i<samples_provided;i++)
-		{
-			sampleQueue.push_back(ssamp(buf[0],buf[1]));
-			buf += 2;
-		}
+		sampleQueue.push((const ssamp*)buf,samples_provided);
 	}
 
 	virtual int output_samples(s16* buf, int samples_requested)
@@ -353,7 +424,7 @@ public:
 						{
 							emit_sample(buf,sampleQueue[x]);
 						}
-						sampleQueue.erase(sampleQueue.begin(), sampleQueue.begin() + beststart);
+						sampleQueue.erase(beststart);
 					}
 
 
@@ -423,7 +494,7 @@ public:
 					audiosize += beststart + extraAtEnd;
 				} //end else
 
-				sampleQueue.erase(sampleQueue.begin(), sampleQueue.begin() + queued);
+				sampleQueue.erase(queued);
 				return audiosize;
 			}
 			else
@@ -439,14 +510,12 @@ public:
 
 				if(audiosize >= queued)
 				{
-					emit_samples(buf,&sampleQueue[0],queued);
-					sampleQueue.erase(sampleQueue.begin(), sampleQueue.begin() + queued);
+					emit_samples(buf,sampleQueue,queued);
 					return queued;
 				}
 				else
 				{
-					emit_samples(buf,&sampleQueue[0],audiosize);
-					sampleQueue.erase(sampleQueue.begin(), sampleQueue.begin()+audiosize);
+					emit_samples(buf,sampleQueue,audiosize);
 					return audiosize;
 				}
 
@@ -465,12 +534,157 @@ private:
 }; //NitsujaSynchronizer
 
 
+//time stretching with WSOLA (waveform similarity overlap-add), for when the emulator isnt running at 100%.
+//the output is built from short sequences of the input, each overlapped with the tail of the last one.
+//the input position moves on by the sequence length times the tempo, so the input is played faster or slower,
+//but each sequence plays at its own pitch. the start of each sequence is sought a little way around where it
+//should be, to line its waveform up with the tail it is crossfaded with, so the seams dont click.
+//the tempo follows the amount of input queued, which settles where the tempo matches the emulation speed,
+//with about WSOLA_LATENCY frames of output time queued whatever the speed.
+class WsolaSynchronizer : public ISynchronizingAudioBuffer
+{
+private:
+	//all in stereo frames at 44100hz
+	enum
+	{
+		WSOLA_SEQUENCE = 882, //20ms
+		WSOLA_OVERLAP = 220, //5ms
+		WSOLA_SEEK = 441, //10ms
+		WSOLA_STRIDE = WSOLA_SEQUENCE - WSOLA_OVERLAP, //output made per sequence
+		WSOLA_NEEDED = WSOLA_SEQUENCE + WSOLA_SEEK, //input needed to make a sequence
+		WSOLA_LATENCY = 2048,
+	};
+
+	struct frame { s16 l, r; };
+
+	RingQueue<frame> input;
+	RingQueue<frame> output;
+	double inputFrac; //fractional part of the input position (the whole part is the front of the queue)
+	double tempo;
+	bool haveTail;
+	frame tail[WSOLA_OVERLAP]; //the end of the last sequence, waiting to be crossfaded with the next
+	s32 tailMono[WSOLA_OVERLAP];
+	s32 seekMono[WSOLA_SEEK + WSOLA_OVERLAP];
+
+	//finds where in the seek window the next sequence lines up best with the tail
+	int seek()
+	{
+		for(int i=0;i<WSOLA_SEEK + WSOLA_OVERLAP;i++)
+			seekMono[i] = ((s32)input[i].l + input[i].r) >> 1;
+
+		//normalized cross correlation, searched coarsely and then refined around the best match
+		int best = 0;
+		double bestScore = -1e30;
+		for(int pass=0;pass<2;pass++)
+		{
+			const int from = pass ? std::max(0, best-3) : 0;
+			const int to = pass ? std::min((int)WSOLA_SEEK-1, best+3) : WSOLA_SEEK-1;
+			const int step = pass ? 1 : 4;
+			for(int k=from;k<=to;k+=step)
+			{
+				const s32* in = seekMono + k;
+				s64 corr = 0, energy = 1;
+				for(int i=0;i<WSOLA_OVERLAP;i++)
+				{
+					corr += in[i] * tailMono[i];
+					energy += in[i] * in[i];
+				}
+				const double score = corr / sqrt((double)energy);
+				if(score > bestScore)
+				{
+					bestScore = score;
+					best = k;
+				}
+			}
+		}
+		return best;
+	}
+
+	//makes one sequence of output from the front of the input
+	void process()
+	{
+		int start = 0;
+		if(haveTail)
+		{
+			start = seek();
+			for(int i=0;i<WSOLA_OVERLAP;i++)
+			{
+				const frame& in = input[start+i];
+				frame f;
+				f.l = (s16)((tail[i].l * (WSOLA_OVERLAP-i) + in.l * i) / WSOLA_OVERLAP);
+				f.r = (s16)((tail[i].r * (WSOLA_OVERLAP-i) + in.r * i) / WSOLA_OVERLAP);
+				output.push(f);
+			}
+			for(int i=start+WSOLA_OVERLAP;i<start+WSOLA_STRIDE;i++)
+				output.push(input[i]);
+		}
+		else
+		{
+			for(int i=0;i<WSOLA_STRIDE;i++)
+				output.push(input[i]);
+		}
+
+		for(int i=0;i<WSOLA_OVERLAP;i++)
+		{
+			tail[i] = input[start+WSOLA_STRIDE+i];
+			tailMono[i] = ((s32)tail[i].l + tail[i].r) >> 1;
+		}
+		haveTail = true;
+
+		inputFrac += WSOLA_STRIDE * tempo;
+		const u32 advance = (u32)inputFrac;
+		inputFrac -= advance;
+		input.erase(advance);
+	}
+
+public:
+	WsolaSynchronizer()
+		: input(SYNCH_QUEUE_FRAMES)
+		, output(SYNCH_QUEUE_FRAMES)
+		, inputFrac(0)
+		, tempo(1.0)
+		, haveTail(false)
+	{}
+
+	virtual void enqueue_samples(s16* buf, int samples_provided)
+	{
+		input.push((const frame*)buf,samples_provided);
+	}
+
+	virtual int output_samples(s16* buf, int samples_requested)
+	{
+		//the queued input is worth (queued / tempo) frames of output, and this aims to keep that at WSOLA_LATENCY
+		//past what a sequence needs. at a steady emulation speed the tempo settles on that speed
+		const int queued = (int)input.size() - WSOLA_NEEDED;
+		const double wanted = GetClamped((double)queued / WSOLA_LATENCY, 1.0/16, 8.0);
+		tempo += (wanted - tempo) * 0.2;
+
+		//the hard limit on latency: skip input past it (the seek hides the jump like any other seam)
+		const int limit = WSOLA_NEEDED + (int)(WSOLA_LATENCY * 2 * tempo);
+		if((int)input.size() > limit)
+			input.erase(input.size() - limit);
+
+		while((int)output.size() < samples_requested && input.size() >= WSOLA_NEEDED)
+			process();
+
+		const int done = std::min(samples_requested, (int)output.size());
+		output.copy((frame*)buf,done);
+		output.erase(done);
+		return done;
+	}
+};
+
+
 #if defined(_MSC_VER) || defined(HAVE_LIBSOUNDTOUCH) || defined(DESMUME_COCOA) || defined(DESMUME_QT)
 class PCSX2Synchronizer : public ISynchronizingAudioBuffer
 {
 public:
-	std::queue<s16> readySamples;
+	//the last packet read from SndBuffer, and how far into it we are
+	StereoOut16 readySamples[SndOutPacketSize];
+	int readyPos;
+
 	PCSX2Synchronizer()
+		: readyPos(SndOutPacketSize)
 	{
 		SndBuffer::Init();
 	}
@@ -488,17 +702,13 @@ public:
 	virtual int output_samples(s16* buf, int samples_requested)
 	{
 		for(int i=0;i<samples_requested;i++) {
-			if(readySamples.size()==0) {
-				//SndOutPacketSize
-				StereoOut16 temp[SndOutPacketSize*2];
-				SndBuffer::ReadSamples( temp );
-				for(int i=0;i<SndOutPacketSize;i++) {
-					readySamples.push(temp[i].Left);
-					readySamples.push(temp[i].Right);
-				}
+			if(readyPos==SndOutPacketSize) {
+				SndBuffer::ReadSamples( readySamples );
+				readyPos = 0;
 			}
-			*buf++ = readySamples.front(); readySamples.pop();
-			*buf++ = readySamples.front(); readySamples.pop();
+			*buf++ = readySamples[readyPos].Left;
+			*buf++ = readySamples[readyPos].Right;
+			readyPos++;
 		}
 		return samples_requested;
 	}
@@ -512,6 +722,7 @@ ISynchronizingAudioBuffer* metaspu_construct(ESynchMethod method)
 	{
 	case ESynchMethod_N: return new NitsujaSynchronizer();
 	case ESynchMethod_Z: return new ZeromusSynchronizer();
+	case ESynchMethod_W: return new WsolaSynchronizer();
 #if defined(_MSC_VER) || defined(HAVE_LIBSOUNDTOUCH) || defined(DESMUME_COCOA) || defined(DESMUME_QT)
 	case ESynchMethod_P: return new PCSX2Synchronizer();
 #endif
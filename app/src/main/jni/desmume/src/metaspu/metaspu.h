@@ -43,6 +43,8 @@ static FORCEINLINE T GetClamped( T src, T min, T max )
 class ISynchronizingAudioBuffer
 {
 public:
+	virtual ~ISynchronizingAudioBuffer() {}
+
 	virtual void enqueue_samples(s16* buf, int samples_provided) = 0;
 
 	//returns the number of samples actually supplied, which may not match the number requested
@@ -60,6 +62,7 @@ enum ESynchMethod
 	ESynchMethod_N, //nitsuja's
 	ESynchMethod_Z, //zero's
 	ESynchMethod_P, //PCSX2 spu2-x
+	ESynchMethod_W, //wsola time stretching
 };
 
 ISynchronizingAudioBuffer* metaspu_construct(ESynchMethod method);
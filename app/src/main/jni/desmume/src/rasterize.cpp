@@ -1372,7 +1372,20 @@ void SoftRasterizerEngine::updateFloatColors()
 SoftRasterizerEngine::SoftRasterizerEngine()
 	: _debug_drawClippedUserPoly(-1)
 {
-	this->clippedPolys = clipper.clippedPolys = new GFX3D_Clipper::TClippedPoly[POLYLIST_SIZE*2];
+	reservePolys(0);
+}
+
+void SoftRasterizerEngine::reservePolys(int count)
+{
+	//clipping makes at most one poly out of each one
+	clippedPolyStorage.reserve(count);
+	polyTexKeyStorage.reserve(count);
+	polyVisibleStorage.reserve(count);
+	polyBackfacingStorage.reserve(count);
+	this->clippedPolys = clipper.clippedPolys = clippedPolyStorage.list;
+	this->polyTexKeys = polyTexKeyStorage.list;
+	this->polyVisible = polyVisibleStorage.list;
+	this->polyBackfacing = polyBackfacingStorage.list;
 }
 
 void SoftRasterizerEngine::framebufferProcess()
@@ -1496,6 +1509,8 @@ void SoftRasterizerEngine::framebufferProcess()
 
 void SoftRasterizerEngine::performClipping(bool hirez)
 {
+	reservePolys(polylist->count);
+
 	//submit all polys to clipper
 	clipper.reset();
 	for(int i=0;i<polylist->count;i++)
@@ -81,15 +81,23 @@ public:
 	GFX3D_Clipper clipper;
 	GFX3D_Clipper::TClippedPoly *clippedPolys;
 	int clippedPolyCounter;
-	TexCacheItem* polyTexKeys[POLYLIST_SIZE];
-	bool polyVisible[POLYLIST_SIZE];
-	bool polyBackfacing[POLYLIST_SIZE];
+	TexCacheItem** polyTexKeys;
+	bool* polyVisible;
+	bool* polyBackfacing;
 	Fragment *screen;
 	FragmentColor *screenColor;
 	POLYLIST* polylist;
 	VERTLIST* vertlist;
 	INDEXLIST* indexlist;
 	int width, height;
+
+private:
+	//storage behind the per-poly arrays above. each frame makes sure they can hold all of its polys
+	void reservePolys(int count);
+	GFX3D_List<GFX3D_Clipper::TClippedPoly,2048,POLYLIST_SIZE> clippedPolyStorage;
+	GFX3D_List<TexCacheItem*,2048,POLYLIST_SIZE> polyTexKeyStorage;
+	GFX3D_List<bool,2048,POLYLIST_SIZE> polyVisibleStorage;
+	GFX3D_List<bool,2048,POLYLIST_SIZE> polyBackfacingStorage;
 };
 
 
@@ -1027,6 +1027,7 @@ bool savestate_save (const char *file_name)
 }
 
 static void writechunks(EMUFILE* os) {
+	gfx3d_syncGeometry();
 
 	DateTime tm = DateTime::get_Now();
 	svn_rev = EMU_DESMUME_SUBVERSION_NUMERIC();
@@ -1063,6 +1064,8 @@ static void writechunks(EMUFILE* os) {
 
 static bool ReadStateChunks(EMUFILE* is, s32 totalsize)
 {
+	gfx3d_syncGeometry();
+
 	bool ret = true;
 	bool haveInfo = false;
 	
@@ -1171,6 +1174,9 @@ static void loadstate()
     for (int i = 0; i < 0xA; i++)
        _MMU_write08<ARMCPU_ARM9>(0x04000240+i, _MMU_read08<ARMCPU_ARM9>(0x04000240+i));
 
+    // vram contents were replaced wholesale, so anything tracking them must revalidate
+    MMU_VRAM_markAllDirty();
+
     // This should regenerate the graphics power control register
     _MMU_write16<ARMCPU_ARM9>(0x04000304, _MMU_read16<ARMCPU_ARM9>(0x04000304));
 
@@ -18,11 +18,13 @@
 */
 
 #include <string.h>
+#include <semaphore.h>
 #include <algorithm>
 #include <assert.h>
-#include <map>
+#include <vector>
 
 #include "texcache.h"
+#include "texdecode.h"
 
 #include "bits.h"
 #include "common.h"
@@ -30,6 +32,8 @@
 #include "gfx3d.h"
 #include "MMU.h"
 #include "NDSSystem.h"
+#include "utils/ringbuffer.h"
+#include "utils/task.h"
 
 using std::min;
 using std::max;
@@ -37,8 +41,6 @@ using std::max;
 //only dump this from ogl renderer. for now, softrasterizer creates things in an incompatible pixel format
 //#define DEBUG_DUMP_TEXTURE
 
-#define CONVERT(color,alpha) ((TEXFORMAT == TexFormat_32bpp)?(RGB15TO32(color,alpha)):RGB15TO6665(color,alpha))
-
 //This class represents a number of regions of memory which should be viewed as contiguous
 class MemSpan
 {
@@ -78,6 +80,20 @@ public:
 		return 0;
 	}
 
+	//records the vram pages covered by this MemSpan
+	void addVramDeps(TexCacheVramDeps& deps)
+	{
+		for(int i=0;i<numItems;i++)
+		{
+			Item &item = items[i];
+			if(item.len == 0) continue;
+			const u32 first = MMU_VRAM_page(item.ptr);
+			const u32 last = MMU_VRAM_page(item.ptr + item.len - 1);
+			for(u32 page=first;page<=last;page++)
+				deps.addPage(page);
+		}
+	}
+
 	//TODO - get rid of duplication between these two methods.
 
 	//dumps the memspan to the specified buffer
@@ -130,6 +146,14 @@ public:
 	}
 };
 
+void TexCacheVramDeps::addPage(u32 page)
+{
+	const u64 bit = ((u64)1)<<page;
+	if(pageMask & bit) return;
+	pageMask |= bit;
+	genSum += vram_page_gen[page];
+}
+
 //creates a MemSpan in texture memory
 static MemSpan MemSpan_TexMem(u32 ofs, u32 len) 
 {
@@ -201,40 +225,19 @@ static void DebugDumpTexture(TexCacheItem* item)
 }
 #endif
 
-class TexCache
+static FORCEINLINE void DumpPalette(MemSpan& mspal, u16* pal)
 {
-public:
-	TexCache()
-		: cache_size(0)
-	{
-		memset(paletteDump,0,sizeof(paletteDump));
-	}
-
-	TTexCacheItemMultimap index;
-
-	//this ought to be enough for anyone
-	//static const u32 kMaxCacheSize = 64*1024*1024; 
-	//changed by zeromus on 15-dec. I couldnt find any games that were getting anywhere NEAR 64
-	static const u32 kMaxCacheSize = 16*1024*1024; 
-	//metal slug burns through sprites so fast, it can test it pretty quickly though
-
-	//this is not really precise, it is off by a constant factor
-	u32 cache_size;
-
-	void list_remove(TexCacheItem* item)
-	{
-		index.erase(item->iterator);
-		cache_size -= item->decode_len;
-	}
-
-	void list_push_front(TexCacheItem* item)
-	{
-		item->iterator = index.insert(std::make_pair(item->texformat,item));
-		cache_size += item->decode_len;
-	}
+	#ifdef WORDS_BIGENDIAN
+		mspal.dump16(pal);
+	#else
+		mspal.dump(pal);
+	#endif
+}
 
-	template<TexCache_TexFormat TEXFORMAT>
-	TexCacheItem* scan(u32 format, u32 texpal)
+//where a texture's data lives in vram as it is currently mapped, and which vram pages that involves
+struct TexLayout
+{
+	TexLayout(u32 format, u32 texpal)
 	{
 		//for each texformat, number of palette entries
 		static const int palSizes[] = {0, 32, 4, 16, 256, 0, 8, 0};
@@ -242,18 +245,11 @@ public:
 		//for each texformat, multiplier from numtexels to numbytes (fixed point 30.2)
 		static const int texSizes[] = {0, 4, 1, 2, 4, 1, 4, 8};
 
-		//used to hold a copy of the palette specified for this texture
-		u16 pal[256];
-
-		u32 textureMode = (unsigned short)((format>>26)&0x07);
-		u32 sizeX=(8 << ((format>>20)&0x07));
-		u32 sizeY=(8 << ((format>>23)&0x07));
+		textureMode = (unsigned short)((format>>26)&0x07);
+		sizeX=(8 << ((format>>20)&0x07));
+		sizeY=(8 << ((format>>23)&0x07));
 		u32 imageSize = sizeX*sizeY;
 
-		u8 *adr;
-
-		u32 paletteAddress;
-
 		switch (textureMode)
 		{
 		case TEXMODE_I2:
@@ -271,10 +267,10 @@ public:
 		}
 
 		//analyze the texture memory mapping and the specifications of this texture
-		int palSize = palSizes[textureMode];
+		palSize = palSizes[textureMode];
 		int texSize = (imageSize*texSizes[textureMode])>>2; //shifted because the texSizes multiplier is fixed point
-		MemSpan ms = MemSpan_TexMem((format&0xFFFF)<<3,texSize);
-		MemSpan mspal = MemSpan_TexPalette(paletteAddress,palSize*2,false);
+		ms = MemSpan_TexMem((format&0xFFFF)<<3,texSize);
+		mspal = MemSpan_TexPalette(paletteAddress,palSize*2,false);
 
 		//determine the location for 4x4 index data
 		u32 indexBase;
@@ -283,389 +279,749 @@ public:
 
 		u32 indexOffset = (format&0x3FFF)<<2;
 
-		int indexSize = 0;
-		MemSpan msIndex;
 		if(textureMode == TEXMODE_4X4)
 		{
-			indexSize = imageSize>>3;
+			int indexSize = imageSize>>3;
 			msIndex = MemSpan_TexMem(indexOffset+indexBase,indexSize);
 		}
 
+		//gather the vram pages this texture depends on, as they are currently mapped.
+		//writes to those pages (and remapping the texture onto other pages) will change these.
+		ms.addVramDeps(texDeps);
+		if(textureMode == TEXMODE_4X4)
+		{
+			msIndex.addVramDeps(texDeps);
+
+			//4x4 textures can reference nearly any palette entry, so they depend on all of palette memory
+			for(int i=0;i<6;i++)
+				palDeps.addPage(MMU_VRAM_page(MMU.texInfo.texPalSlot[i]));
+		}
+		else
+			mspal.addVramDeps(palDeps);
+	}
+
+	//whether any of the texture data is in a slot which has no vram mapped to it
+	bool isUnmapped() const
+	{
+		for(int i=0;i<ms.numItems;i++)
+			if(ms.items[i].ptr - ms.items[i].start == MMU.blank_memory) return true;
+		for(int i=0;i<msIndex.numItems;i++)
+			if(msIndex.items[i].ptr - msIndex.items[i].start == MMU.blank_memory) return true;
+		return false;
+	}
 
-		//dump the palette to a temp buffer, so that we don't have to worry about memory mapping.
-		//this isnt such a problem with texture memory, because we read sequentially from it.
-		//however, we read randomly from palette memory, so the mapping is more costly.
-		#ifdef WORDS_BIGENDIAN
-			mspal.dump16(pal);
-		#else
-			mspal.dump(pal);
-		#endif
-
-			//TODO - as a special optimization, keep the last item returned and check it first
-
-		for(std::pair<TTexCacheItemMultimap::iterator,TTexCacheItemMultimap::iterator>
-			iters = index.equal_range(format);
-			iters.first != iters.second;
-			++iters.first)
+	u32 textureMode;
+	u32 sizeX, sizeY;
+	u32 paletteAddress;
+	int palSize;
+	MemSpan ms, mspal, msIndex;
+	TexCacheVramDeps texDeps, palDeps;
+};
+
+//what a texture gets decoded from: either vram itself, or the pre-decoder's private copy of it
+struct TexDecodeSource
+{
+	const MemSpan* ms; //texture data
+	const u16* pal; //palette for the paletted formats, in host byte order
+	const u32* map4x4; //4x4 texel blocks
+	const u16* index4x4; //4x4 palette index data
+	u32 limit4x4;
+	u32 paletteAddress4x4;
+	u8* const* palSlots4x4; //the 4x4 block colors are read through these (see TexDecode_4x4)
+};
+
+template<TexCache_TexFormat TEXFORMAT>
+static void DecodeTexture(const TexCacheItem* item, const TexDecodeSource& src)
+{
+	const MemSpan& ms = *src.ms;
+	const u16* pal = src.pal;
+	u32 *dwdst = (u32*)item->decoded;
+
+	const u8 opaqueColor = (TEXFORMAT == TexFormat_32bpp) ? 0xFF : 0x1F;
+	const u8 palZeroTransparent = ( 1 - ((item->texformat>>29) & 1) ) * opaqueColor;
+
+	switch (item->mode)
+	{
+	case TEXMODE_A3I5:
+		for(int j=0;j<ms.numItems;j++)
+			dwdst = TexDecode_A3I5<TEXFORMAT>(ms.items[j].ptr,ms.items[j].len,pal,dwdst);
+		break;
+	case TEXMODE_I2:
+		for(int j=0;j<ms.numItems;j++)
+			dwdst = TexDecode_I2<TEXFORMAT>(ms.items[j].ptr,ms.items[j].len,pal,palZeroTransparent,dwdst);
+		break;
+	case TEXMODE_I4:
+		for(int j=0;j<ms.numItems;j++)
+			dwdst = TexDecode_I4<TEXFORMAT>(ms.items[j].ptr,ms.items[j].len,pal,palZeroTransparent,dwdst);
+		break;
+	case TEXMODE_I8:
+		for(int j=0;j<ms.numItems;j++)
+			dwdst = TexDecode_I8<TEXFORMAT>(ms.items[j].ptr,ms.items[j].len,pal,palZeroTransparent,dwdst);
+		break;
+	case TEXMODE_4X4:
+		TexDecode_4x4<TEXFORMAT>(src.map4x4,src.index4x4,src.limit4x4,item->sizeX,item->sizeY,src.paletteAddress4x4,src.palSlots4x4,dwdst);
+		break;
+	case TEXMODE_A5I3:
+		for(int j=0;j<ms.numItems;j++)
+			dwdst = TexDecode_A5I3<TEXFORMAT>(ms.items[j].ptr,ms.items[j].len,pal,dwdst);
+		break;
+	case TEXMODE_16BPP:
+		for(int j=0;j<ms.numItems;j++)
+			dwdst = TexDecode_16bpp<TEXFORMAT>(ms.items[j].ptr,ms.items[j].len,dwdst);
+		break;
+	} //switch(texture format)
+}
+
+//a texture for the pre-decode thread. the item is complete except for its decoded texels, and isnt in the cache yet.
+//everything the thread reads is owned by the job, so it never has to look at vram (which the emulator keeps changing underneath it).
+struct TexPreDecodeJob
+{
+	TexCacheItem* item;
+	u8* palette4x4; //copy of the range of palette memory which a 4x4 texture's blocks refer to
+	u32 palette4x4Size;
+};
+
+template<TexCache_TexFormat TEXFORMAT>
+static void PreDecodeTexture(const TexPreDecodeJob& job)
+{
+	TexCacheItem* item = job.item;
+
+	//the dump is one contiguous copy of the texture data, with the 4x4 index data after it
+	MemSpan ms;
+	ms.numItems = 1;
+	ms.size = item->dump.textureSize;
+	ms.items[0].start = 0;
+	ms.items[0].len = item->dump.textureSize;
+	ms.items[0].ptr = item->dump.texture;
+	ms.items[0].ofs = 0;
+
+	//the palette copy starts at the texture's palette address, so it is addressed from 0 in 16KB slot sized pieces
+	u8* palSlots[8];
+	for(u32 i=0;i<8;i++)
+		palSlots[i] = (i*0x4000 < job.palette4x4Size) ? job.palette4x4 + i*0x4000 : job.palette4x4;
+
+	TexDecodeSource src;
+	src.ms = &ms;
+	src.pal = (const u16*)item->dump.palette;
+	src.map4x4 = (const u32*)item->dump.texture;
+	src.index4x4 = (const u16*)(item->dump.texture + item->dump.textureSize);
+	src.limit4x4 = item->dump.textureSize<<2;
+	src.paletteAddress4x4 = 0;
+	src.palSlots4x4 = palSlots;
+	DecodeTexture<TEXFORMAT>(item,src);
+}
+
+//runs texture decoding on a thread of its own, so that the renderer finds textures already decoded when it gets to them.
+//jobs go in and out through lock-free queues; the emulator thread never waits on the decoding thread.
+class TexPreDecoder
+{
+public:
+	//how many jobs can be in flight at once
+	static const u32 QUEUE_SIZE = 32;
+
+	TexPreDecoder()
+		: numInFlight(0)
+		, running(false)
+		, quit(false)
+	{}
+
+	~TexPreDecoder() { stop(); }
+
+	bool isFull() const { return numInFlight == QUEUE_SIZE; }
+
+	bool isInFlight(u32 format, u32 texpal, TexCache_TexFormat cacheFormat) const
+	{
+		for(u32 i=0;i<numInFlight;i++)
 		{
-			TexCacheItem* curr = iters.first->second;
-			
-			//conditions where we reject matches:
-			//when the teximage or texpal params dont match 
-			//(this is our key for identifying textures in the cache)
-			//NEW: due to using format as a key we dont need to check this anymore
-			//if(curr->texformat != format) continue;
-			if(curr->texpal != texpal) continue;
+			const TexCacheItem* item = inFlight[i].item;
+			if(item->texformat == format && item->texpal == texpal && item->cacheFormat == cacheFormat)
+				return true;
+		}
+		return false;
+	}
 
-			//we're being asked for a different format than what we had cached.
-			//TODO - this could be done at the entire cache level instead of checking repeatedly
-			if(curr->cacheFormat != TEXFORMAT) goto REJECT;
+	//queue a job, starting the thread if necessary. check isFull() first
+	void submit(const TexPreDecodeJob& job)
+	{
+		if(!running)
+		{
+			sem_init(&wake,0,0);
+			quit = false;
+			task.start(false);
+			task.execute(threadProc,this);
+			running = true;
+		}
+		inFlight[numInFlight++] = job;
+		requests.push(job);
+		sem_post(&wake);
+	}
 
-			//if the texture is assumed invalid, reject it
-			if(curr->assumedInvalid) goto REJECT; 
+	//fetch a finished job, if there is one
+	bool receive(TexPreDecodeJob& job)
+	{
+		if(!results.pop(job)) return false;
+		for(u32 i=0;i<numInFlight;i++)
+			if(inFlight[i].item == job.item)
+			{
+				inFlight[i] = inFlight[--numInFlight];
+				break;
+			}
+		return true;
+	}
 
-			//the texture matches params, but isnt suspected invalid. accept it.
-			if(!curr->suspectedInvalid) return curr;
+	//waits for the thread to exit. the jobs which were in flight are left in inFlight for the caller to dispose of
+	void stop()
+	{
+		if(!running) return;
+		__atomic_store_n(&quit,true,__ATOMIC_RELEASE);
+		sem_post(&wake);
+		task.finish();
+		task.shutdown();
+		sem_destroy(&wake);
+		requests.clear();
+		results.clear();
+		running = false;
+	}
 
-			//we suspect the texture may be invalid. we need to do a byte-for-byte comparison to re-establish that it is valid:
+	//jobs which were submitted and not received yet (only touched by the emulator thread)
+	TexPreDecodeJob inFlight[QUEUE_SIZE];
+	u32 numInFlight;
 
-			//when the palettes dont match:
-			//note that we are considering 4x4 textures to have a palette size of 0.
-			//they really have a potentially HUGE palette, too big for us to handle like a normal palette,
-			//so they go through a different system
-			if(mspal.size != 0 && memcmp(curr->dump.palette,pal,mspal.size)) goto REJECT;
+private:
+	static void* threadProc(void* param)
+	{
+		TexPreDecoder* self = (TexPreDecoder*)param;
+		for(;;)
+		{
+			while(sem_wait(&self->wake) != 0) {} //retry when interrupted
+			if(__atomic_load_n(&self->quit,__ATOMIC_ACQUIRE)) break;
+
+			TexPreDecodeJob job;
+			while(self->requests.pop(job))
+			{
+				if(job.item->cacheFormat == TexFormat_32bpp)
+					PreDecodeTexture<TexFormat_32bpp>(job);
+				else
+					PreDecodeTexture<TexFormat_15bpp>(job);
+
+				//this can't fail, since there are never more than QUEUE_SIZE jobs in flight
+				self->results.push(job);
+			}
+		}
+		return NULL;
+	}
+
+	SPSCRing<TexPreDecodeJob,QUEUE_SIZE> requests, results;
+	Task task;
+	sem_t wake;
+	bool running;
+	bool quit;
+};
+
+//a size-class allocator for decoded texels and texture dumps.
+//texture dimensions are powers of two, so blocks come in power of two size classes. small ones are carved out of slabs
+//holding a single class each, and freed blocks go back on their slab's free list for the next texture of that size.
+//a slab goes back to the heap as soon as nothing in it is used, and big blocks go straight to the heap and back,
+//so what the arena holds (footprint()) follows what the cache holds instead of the most it ever held of each size.
+class TexCacheArena
+{
+public:
+	static const int MIN_SHIFT = 4; //16 bytes
+	static const int MAX_SHIFT = 22; //4MB, a 1024x1024 texture at 32bpp
+	static const int SLAB_SHIFT = 16;
+	static const u32 SLAB_SIZE = 1<<SLAB_SHIFT;
+	static const int MAX_SLAB_SHIFT = SLAB_SHIFT-4; //classes with at least 15 blocks to a slab
+	static const int NUM_SLAB_CLASSES = MAX_SLAB_SHIFT-MIN_SHIFT+1;
+	static const u32 SLAB_HEADER = 64;
+
+	TexCacheArena()
+		: heldBytes(0)
+	{
+		memset(slabs,0,sizeof(slabs));
+	}
+
+	~TexCacheArena() { reset(); }
 
-			//when the texture data doesn't match
-			if(ms.memcmp(&curr->dump.texture[0],curr->dump.textureSize)) goto REJECT;
+	//returns the number of bytes actually reserved for a request of the given size
+	static u32 blockSize(u32 size) { return 1<<sizeClass(size); }
 
-			//if the texture is 4x4 then the index data must match
-			if(textureMode == TEXMODE_4X4)
+	//bytes taken from the heap, including slab space which isnt handed out
+	u32 footprint() const { return heldBytes; }
+
+	//blocks are always at least 16 byte aligned
+	u8* alloc(u32 size)
+	{
+		const int shift = sizeClass(size);
+		if(shift > MAX_SLAB_SHIFT)
+		{
+			void* ret;
+			if(posix_memalign(&ret,16,1<<shift) != 0) return NULL;
+			heldBytes += 1<<shift;
+			return (u8*)ret;
+		}
+
+		//slabs with free blocks are kept ahead of the full ones
+		Slab* &head = slabs[shift-MIN_SHIFT];
+		Slab* slab = head;
+		if(!slab || !slab->freeList)
+		{
+			slab = newSlab(shift);
+			if(!slab) return NULL;
+		}
+
+		FreeBlock* block = slab->freeList;
+		slab->freeList = block->next;
+		slab->live++;
+		if(!slab->freeList && slab->next)
+		{
+			//full now, so to the back
+			unlink(slab);
+			Slab* tail = head;
+			if(!tail) head = slab;
+			else
 			{
-				if(msIndex.memcmp(curr->dump.texture + curr->dump.textureSize,curr->dump.indexSize)) goto REJECT; 
+				while(tail->next) tail = tail->next;
+				tail->next = slab;
+				slab->prev = tail;
 			}
+		}
+		return (u8*)block;
+	}
 
-			//we found a match. just return it
-			//REMINDER to make it primary/newest when we have smarter code
-			//list_remove(curr);
-			//list_push_front(curr);
-			curr->suspectedInvalid = false;
-			return curr;
+	void free(u8* ptr, u32 size)
+	{
+		if(!ptr) return;
+		const int shift = sizeClass(size);
+		if(shift > MAX_SLAB_SHIFT)
+		{
+			::free(ptr);
+			heldBytes -= 1<<shift;
+			return;
+		}
 
-		REJECT:
-			//we found a cached item for the current address, but the data is stale.
-			//for a variety of complicated reasons, we need to throw it out right this instant.
-			list_remove(curr);
-			delete curr;
-			break;
+		Slab* slab = (Slab*)((uintptr_t)ptr & ~(uintptr_t)(SLAB_SIZE-1));
+		FreeBlock* block = (FreeBlock*)ptr;
+		const bool wasFull = !slab->freeList;
+		block->next = slab->freeList;
+		slab->freeList = block;
+		if(--slab->live == 0)
+		{
+			unlink(slab);
+			::free(slab);
+			heldBytes -= SLAB_SIZE;
 		}
+		else if(wasFull)
+		{
+			//has room again, so to the front
+			unlink(slab);
+			pushFront(slab);
+		}
+	}
 
-		//item was not found. recruit an existing one (the oldest), or create a new one
-		//evict(); //reduce the size of the cache if necessary
-		//TODO - as a peculiarity of the texcache, eviction must happen after the entire 3d frame runs
-		//to support separate cache and read passes
+	//gives all slabs back to the heap. only do this when nothing is allocated anymore
+	//(by then they should all be gone already)
+	void reset()
+	{
+		for(int i=0;i<NUM_SLAB_CLASSES;i++)
+			while(Slab* slab = slabs[i])
+			{
+				slabs[i] = slab->next;
+				::free(slab);
+				heldBytes -= SLAB_SIZE;
+			}
+	}
+
+private:
+	struct FreeBlock { FreeBlock* next; };
+
+	//lives at the start of its slab, which is aligned to SLAB_SIZE so blocks can find it
+	struct Slab
+	{
+		Slab *prev, *next;
+		FreeBlock* freeList;
+		u32 live;
+		int shift;
+	};
+
+	static int sizeClass(u32 size)
+	{
+		int shift = MIN_SHIFT;
+		while((1u<<shift) < size) shift++;
+		assert(shift <= MAX_SHIFT);
+		return shift;
+	}
+
+	Slab* newSlab(int shift)
+	{
+		void* mem;
+		if(posix_memalign(&mem,SLAB_SIZE,SLAB_SIZE) != 0) return NULL;
+		heldBytes += SLAB_SIZE;
+
+		Slab* slab = (Slab*)mem;
+		slab->shift = shift;
+		slab->live = 0;
+		slab->freeList = NULL;
+		const u32 len = 1<<shift;
+		for(u32 ofs = SLAB_SIZE-len; ofs >= SLAB_HEADER; ofs -= len)
+		{
+			FreeBlock* block = (FreeBlock*)((u8*)mem + ofs);
+			block->next = slab->freeList;
+			slab->freeList = block;
+		}
+		pushFront(slab);
+		return slab;
+	}
+
+	void pushFront(Slab* slab)
+	{
+		Slab* &head = slabs[slab->shift-MIN_SHIFT];
+		slab->prev = NULL;
+		slab->next = head;
+		if(head) head->prev = slab;
+		head = slab;
+	}
+
+	void unlink(Slab* slab)
+	{
+		if(slab->prev) slab->prev->next = slab->next;
+		else slabs[slab->shift-MIN_SHIFT] = slab->next;
+		if(slab->next) slab->next->prev = slab->prev;
+		slab->prev = slab->next = NULL;
+	}
+
+	Slab* slabs[NUM_SLAB_CLASSES]; //every slab of each class, the ones with free blocks first
+	u32 heldBytes;
+};
+
+//used to mark deleted slots in the hash table, so that probe sequences running through them stay intact
+static TexCacheItem tombstoneItem;
+#define TOMBSTONE (&tombstoneItem)
+
+class TexCache
+{
+public:
+	TexCache()
+		: table(NULL)
+		, tableCapacity(0)
+		, tableCount(0)
+		, tableUsed(0)
+		, lruHead(NULL)
+		, lruTail(NULL)
+		, cache_size(0)
+		, frameCounter(0)
+		, lastCacheFormat(TexFormat_None)
+	{
+		memset(&stats,0,sizeof(stats));
+	}
+
+	//this ought to be enough for anyone
+	//static const u32 kMaxCacheSize = 64*1024*1024; 
+	//changed by zeromus on 15-dec. I couldnt find any games that were getting anywhere NEAR 64
+	//(this is now only the default for CommonSettings.GFX3D_TexCacheBudgetMB)
+	static const u32 kMaxCacheSize = 16*1024*1024; 
+	//metal slug burns through sprites so fast, it can test it pretty quickly though
+
+	//open addressing hash table (linear probing) of every cached item, keyed by texture params and cache format.
+	//the capacity is always a power of two. tableUsed counts tombstones as well as items
+	TexCacheItem** table;
+	u32 tableCapacity, tableCount, tableUsed;
+
+	//all items, most recently used first
+	TexCacheItem *lruHead, *lruTail;
+
+	//bytes of arena blocks held by the items (rounded up to their size class)
+	u32 cache_size;
+
+	TexCacheArena arena;
+	TexCacheStats stats;
+
+	//counts calls to TexCache_EvictFrame, to tell which items were used recently
+	u32 frameCounter;
+
+	//the format the renderer asked for last. the pre-decoder produces this one
+	TexCache_TexFormat lastCacheFormat;
+
+	TexPreDecoder preDecoder;
+
+	static u32 hashKey(u32 format, u32 texpal, TexCache_TexFormat cacheFormat)
+	{
+		u32 h = format * 0x9E3779B1;
+		h ^= (texpal ^ ((u32)cacheFormat<<24)) * 0x85EBCA6B;
+		return h ^ (h>>15);
+	}
+
+	TexCacheItem* find(u32 format, u32 texpal, TexCache_TexFormat cacheFormat)
+	{
+		if(!table) return NULL;
+		const u32 mask = tableCapacity-1;
+		for(u32 i = hashKey(format,texpal,cacheFormat)&mask;;i=(i+1)&mask)
+		{
+			TexCacheItem* item = table[i];
+			if(!item) return NULL;
+			if(item == TOMBSTONE) continue;
+			if(item->texformat == format && item->texpal == texpal && item->cacheFormat == cacheFormat)
+				return item;
+		}
+	}
+
+	void rehash(u32 newCapacity)
+	{
+		TexCacheItem** oldTable = table;
+		const u32 oldCapacity = tableCapacity;
+
+		table = new TexCacheItem*[newCapacity];
+		memset(table,0,sizeof(TexCacheItem*)*newCapacity);
+		tableCapacity = newCapacity;
+		tableUsed = tableCount;
+
+		const u32 mask = newCapacity-1;
+		for(u32 j=0;j<oldCapacity;j++)
+		{
+			TexCacheItem* item = oldTable[j];
+			if(!item || item == TOMBSTONE) continue;
+			u32 i = hashKey(item->texformat,item->texpal,item->cacheFormat)&mask;
+			while(table[i]) i=(i+1)&mask;
+			table[i] = item;
+			item->tableSlot = i;
+		}
+		delete[] oldTable;
+	}
+
+	void table_insert(TexCacheItem* item)
+	{
+		//keep the load (including tombstones) under 3/4. grow if the items themselves need it, otherwise just sweep the tombstones
+		if((tableUsed+1)*4 > tableCapacity*3)
+		{
+			u32 newCapacity = tableCapacity ? tableCapacity : 1024;
+			while((tableCount+1)*2 > newCapacity) newCapacity *= 2;
+			rehash(newCapacity);
+		}
+
+		const u32 mask = tableCapacity-1;
+		u32 i = hashKey(item->texformat,item->texpal,item->cacheFormat)&mask;
+		while(table[i] && table[i] != TOMBSTONE) i=(i+1)&mask;
+		if(!table[i]) tableUsed++;
+		table[i] = item;
+		item->tableSlot = i;
+		tableCount++;
+	}
+
+	void lru_unlink(TexCacheItem* item)
+	{
+		if(item->lruPrev) item->lruPrev->lruNext = item->lruNext;
+		else lruHead = item->lruNext;
+		if(item->lruNext) item->lruNext->lruPrev = item->lruPrev;
+		else lruTail = item->lruPrev;
+		item->lruPrev = item->lruNext = NULL;
+	}
+
+	void lru_push_front(TexCacheItem* item)
+	{
+		item->lruPrev = NULL;
+		item->lruNext = lruHead;
+		if(lruHead) lruHead->lruPrev = item;
+		else lruTail = item;
+		lruHead = item;
+	}
+
+	//marks the item as the most recently used
+	void touch(TexCacheItem* item)
+	{
+		item->lastUsed = frameCounter;
+		if(lruHead == item) return;
+		lru_unlink(item);
+		lru_push_front(item);
+	}
+
+	void list_remove(TexCacheItem* item)
+	{
+		table[item->tableSlot] = TOMBSTONE;
+		tableCount--;
+		lru_unlink(item);
+		cache_size -= charge(item);
+	}
+
+	void list_push_front(TexCacheItem* item)
+	{
+		table_insert(item);
+		lru_push_front(item);
+		cache_size += charge(item);
+	}
+
+	//what an item counts for against the budget: the blocks the arena reserved for it
+	static u32 charge(const TexCacheItem* item)
+	{
+		u32 bytes = TexCacheArena::blockSize(item->decode_len);
+		if(item->dump.texture) bytes += TexCacheArena::blockSize(item->dump.textureSize+item->dump.indexSize);
+		return bytes;
+	}
+
+	//removes an item from the cache and frees it
+	void destroy(TexCacheItem* item)
+	{
+		list_remove(item);
+		arena.free(item->decoded,item->decode_len);
+		arena.free(item->dump.texture,item->dump.textureSize+item->dump.indexSize);
+		delete item;
+	}
+
+	//creates an item for a texture as it is laid out right now, and dumps its data for cache keying.
+	//the item is not decoded yet, and not in the cache yet.
+	TexCacheItem* createItem(u32 format, u32 texpal, TexCache_TexFormat cacheFormat, TexLayout& layout, const u16* pal)
+	{
 		TexCacheItem* newitem = new TexCacheItem();
-		newitem->suspectedInvalid = false;
+		newitem->texDeps = layout.texDeps;
+		newitem->palDeps = layout.palDeps;
 		newitem->texformat = format;
-		newitem->cacheFormat = TEXFORMAT;
+		newitem->cacheFormat = cacheFormat;
 		newitem->texpal = texpal;
-		newitem->sizeX=sizeX;
-		newitem->sizeY=sizeY;
-		newitem->invSizeX=1.0f/((float)(sizeX));
-		newitem->invSizeY=1.0f/((float)(sizeY));
-		newitem->decode_len = sizeX*sizeY*4;
-		newitem->mode = textureMode;
-		newitem->decoded = new u8[newitem->decode_len];
-		list_push_front(newitem);
-		//printf("allocating: up to %d with %d items\n",cache_size,index.size());
+		newitem->sizeX=layout.sizeX;
+		newitem->sizeY=layout.sizeY;
+		newitem->invSizeX=1.0f/((float)(layout.sizeX));
+		newitem->invSizeY=1.0f/((float)(layout.sizeY));
+		newitem->decode_len = layout.sizeX*layout.sizeY*4;
+		newitem->mode = layout.textureMode;
+		newitem->decoded = arena.alloc(newitem->decode_len);
+		newitem->lastUsed = frameCounter;
 
-		u32 *dwdst = (u32*)newitem->decoded;
-		
 		//dump palette data for cache keying
-		if(palSize)
+		if(layout.palSize)
 		{
-			memcpy(newitem->dump.palette, pal, palSize*2);
+			memcpy(newitem->dump.palette, pal, layout.palSize*2);
 		}
 
-		//dump texture and 4x4 index data for cache keying
-		const int texsize = newitem->dump.textureSize = ms.size;
-		const int indexsize = newitem->dump.indexSize = msIndex.size;
-		newitem->dump.texture = new u8[texsize+indexsize];
-		ms.dump(&newitem->dump.texture[0],newitem->dump.maxTextureSize); //dump texture
-		if(textureMode == TEXMODE_4X4)
-			msIndex.dump(newitem->dump.texture+newitem->dump.textureSize,newitem->dump.indexSize); //dump 4x4
+		//dump texture and 4x4 index data for cache keying.
+		//all of it, so that the pre-decoder can decode from the dump
+		const int texsize = newitem->dump.textureSize = layout.ms.size;
+		const int indexsize = newitem->dump.indexSize = layout.msIndex.size;
+		newitem->dump.texture = arena.alloc(texsize+indexsize);
+		layout.ms.dump(newitem->dump.texture); //dump texture
+		if(layout.textureMode == TEXMODE_4X4)
+			layout.msIndex.dump(newitem->dump.texture+texsize); //dump 4x4
 
+		return newitem;
+	}
 
-		//============================================================================ 
-		//Texture conversion
-		//============================================================================ 
+	template<TexCache_TexFormat TEXFORMAT>
+	TexCacheItem* scan(u32 format, u32 texpal)
+	{
+		lastCacheFormat = TEXFORMAT;
+
+		//pick up whatever the pre-decoder finished since the last lookup
+		adoptPreDecoded();
 
-		const u8 opaqueColor = (TEXFORMAT == TexFormat_32bpp) ? 0xFF : 0x1F;
-		const u8 palZeroTransparent = ( 1 - ((format>>29) & 1) ) * opaqueColor;
+		//used to hold a copy of the palette specified for this texture
+		u16 pal[256];
 
-		switch (newitem->mode)
+		TexLayout layout(format,texpal);
+		const u32 textureMode = layout.textureMode;
+		MemSpan &ms = layout.ms, &mspal = layout.mspal, &msIndex = layout.msIndex;
+		const TexCacheVramDeps &texDeps = layout.texDeps, &palDeps = layout.palDeps;
+
+		//dump the palette to a temp buffer, so that we don't have to worry about memory mapping.
+		//this isnt such a problem with texture memory, because we read sequentially from it.
+		//however, we read randomly from palette memory, so the mapping is more costly.
+		//this is only needed for decoding and for verifying textures whose vram was touched, so it is done lazily
+		bool palDumped = false;
+
+		TexCacheItem* curr = find(format,texpal,TEXFORMAT);
+		if(curr)
 		{
-		case TEXMODE_A3I5:
+			//none of the vram this texture came from has been touched since we last looked at it. accept it.
+			if(curr->texDeps == texDeps && curr->palDeps == palDeps)
 			{
-				for(int j=0;j<ms.numItems;j++) {
-					adr = ms.items[j].ptr;
-					for(u32 x = 0; x < ms.items[j].len; x++)
-					{
-						u16 c = pal[*adr&31];
-						u8 alpha = *adr>>5;
-						if(TEXFORMAT == TexFormat_15bpp)
-							*dwdst++ = RGB15TO6665(c,material_3bit_to_5bit[alpha]);
-						else
-							*dwdst++ = RGB15TO32(c,material_3bit_to_8bit[alpha]);
-						adr++;
-					}
-				}
-				break;
+				touch(curr);
+				stats.hits++;
+				return curr;
 			}
 
-		case TEXMODE_I2:
-			{
-				for(int j=0;j<ms.numItems;j++) {
-					adr = ms.items[j].ptr;
-					for(u32 x = 0; x < ms.items[j].len; x++)
-					{
-						u8 bits;
-						u16 c;
-
-						bits = (*adr)&0x3;
-						c = pal[bits];
-						*dwdst++ = CONVERT(c,(bits == 0) ? palZeroTransparent : opaqueColor);
-
-						bits = ((*adr)>>2)&0x3;
-						c = pal[bits];
-						*dwdst++ = CONVERT(c,(bits == 0) ? palZeroTransparent : opaqueColor);
-
-						bits = ((*adr)>>4)&0x3;
-						c = pal[bits];
-						*dwdst++ = CONVERT(c,(bits == 0) ? palZeroTransparent : opaqueColor);
-
-						bits = ((*adr)>>6)&0x3;
-						c = pal[bits];
-						*dwdst++ = CONVERT(c,(bits == 0) ? palZeroTransparent : opaqueColor);
-
-						adr++;
-					}
-				}
-				break;
-			}
-		case TEXMODE_I4:
+			//the texture's vram was written to or remapped, but it may well still contain the same data.
+			//we need to do a byte-for-byte comparison to re-establish that it is valid:
+
+			//when the palettes dont match:
+			//note that we are considering 4x4 textures to have a palette size of 0.
+			//they really have a potentially HUGE palette, too big for us to handle like a normal palette,
+			//so if any of palette memory changed we have to assume they are invalid
+			if(curr->palDeps != palDeps)
 			{
-				for(int j=0;j<ms.numItems;j++) {
-					adr = ms.items[j].ptr;
-					for(u32 x = 0; x < ms.items[j].len; x++)
-					{
-						u8 bits;
-						u16 c;
-
-						bits = (*adr)&0xF;
-						c = pal[bits];
-						*dwdst++ = CONVERT(c,(bits == 0) ? palZeroTransparent : opaqueColor);
-
-						bits = ((*adr)>>4);
-						c = pal[bits];
-						*dwdst++ = CONVERT(c,(bits == 0) ? palZeroTransparent : opaqueColor);
-						adr++;
-					}
+				if(textureMode == TEXMODE_4X4) goto REJECT;
+				if(!palDumped)
+				{
+					DumpPalette(mspal,pal);
+					palDumped = true;
 				}
-				break;
+				if(mspal.size != 0 && memcmp(curr->dump.palette,pal,mspal.size)) goto REJECT;
 			}
-		case TEXMODE_I8:
+
+			if(curr->texDeps != texDeps)
 			{
-				for(int j=0;j<ms.numItems;j++) {
-					adr = ms.items[j].ptr;
-					for(u32 x = 0; x < ms.items[j].len; ++x)
-					{
-						u16 c = pal[*adr];
-						*dwdst++ = CONVERT(c,(*adr == 0) ? palZeroTransparent : opaqueColor);
-						adr++;
-					}
+				//when the texture data doesn't match
+				if(ms.memcmp(&curr->dump.texture[0],curr->dump.textureSize)) goto REJECT;
+
+				//if the texture is 4x4 then the index data must match
+				if(textureMode == TEXMODE_4X4)
+				{
+					if(msIndex.memcmp(curr->dump.texture + curr->dump.textureSize,curr->dump.indexSize)) goto REJECT; 
 				}
 			}
-			break;
-		case TEXMODE_4X4:
-			{
-				if(ms.numItems != 1) {
-					PROGINFO("Your 4x4 texture has overrun its texture slot.\n");
-				}
-				//this check isnt necessary since the addressing is tied to the texture data which will also run out:
-				//if(msIndex.numItems != 1) PROGINFO("Your 4x4 texture index has overrun its slot.\n");
 
-	#define PAL4X4(offset) LE_TO_LOCAL_16( *(u16*)( MMU.texInfo.texPalSlot[((paletteAddress + (offset)*2)>>14)&0x7] + ((paletteAddress + (offset)*2)&0x3FFF) ) )
+			//we found a match. remember the vram state it was validated against and return it
+			curr->texDeps = texDeps;
+			curr->palDeps = palDeps;
+			touch(curr);
+			stats.hits++;
+			stats.revalidations++;
+			return curr;
 
-				u16* slot1;
-				u32* map = (u32*)ms.items[0].ptr;
-				u32 limit = ms.items[0].len<<2;
-				u32 d = 0;
-				if ( (format & 0xc000) == 0x8000)
-					// texel are in slot 2
-					slot1=(u16*)&MMU.texInfo.textureSlotAddr[1][((format & 0x3FFF)<<2)+0x010000];
-				else 
-					slot1=(u16*)&MMU.texInfo.textureSlotAddr[1][(format & 0x3FFF)<<2];
+		REJECT:
+			//we found a cached item for the current key, but the data is stale.
+			//for a variety of complicated reasons, we need to throw it out right this instant.
+			destroy(curr);
+		}
 
-				u16 yTmpSize = (sizeY>>2);
-				u16 xTmpSize = (sizeX>>2);
+		stats.misses++;
 
-				//this is flagged whenever a 4x4 overruns its slot.
-				//i am guessing we just generate black in that case
-				bool dead = false;
+		//item was not found. recruit an existing one (the oldest), or create a new one
+		//evict(); //reduce the size of the cache if necessary
+		//TODO - as a peculiarity of the texcache, eviction must happen after the entire 3d frame runs
+		//to support separate cache and read passes
+		if(!palDumped)
+			DumpPalette(mspal,pal);
 
-				for (int y = 0; y < yTmpSize; y ++)
-				{
-					u32 tmpPos[4]={(y<<2)*sizeX,((y<<2)+1)*sizeX,
-						((y<<2)+2)*sizeX,((y<<2)+3)*sizeX};
-					for (int x = 0; x < xTmpSize; x ++, d++)
-					{
-						if(d >= limit)
-							dead = true;
-
-						if(dead) {
-							for (int sy = 0; sy < 4; sy++)
-							{
-								u32 currentPos = (x<<2) + tmpPos[sy];
-								dwdst[currentPos] = dwdst[currentPos+1] = dwdst[currentPos+2] = dwdst[currentPos+3] = 0;
-							}
-							continue;
-						}
-
-						u32 currBlock	= LE_TO_LOCAL_32(map[d]);
-						u16 pal1		= LE_TO_LOCAL_16(slot1[d]);
-						u16 pal1offset	= (pal1 & 0x3FFF)<<1;
-						u8  mode		= pal1>>14;
-						u32 tmp_col[4];
-						
-						tmp_col[0] = RGB15TO32( PAL4X4(pal1offset), 0xFF );
-						tmp_col[1] = RGB15TO32( PAL4X4(pal1offset+1), 0xFF );
-
-						switch (mode) 
-						{
-							case 0:
-								tmp_col[2] = RGB15TO32( PAL4X4(pal1offset+2), 0xFF );
-								tmp_col[3] = RGB15TO32(0x7FFF, 0x00);
-								break;
-								
-							case 1:
-#ifdef LOCAL_BE
-								tmp_col[2]	= ( (((tmp_col[0] & 0xFF000000) >> 1)+((tmp_col[1] & 0xFF000000)  >> 1)) & 0xFF000000 ) |
-											  ( (((tmp_col[0] & 0x00FF0000)      + (tmp_col[1] & 0x00FF0000)) >> 1)  & 0x00FF0000 ) |
-											  ( (((tmp_col[0] & 0x0000FF00)      + (tmp_col[1] & 0x0000FF00)) >> 1)  & 0x0000FF00 ) |
-											  0x000000FF;
-								tmp_col[3]	= 0xFFFFFF00;
-#else
-								tmp_col[2]	= ( (((tmp_col[0] & 0x00FF00FF) + (tmp_col[1] & 0x00FF00FF)) >> 1) & 0x00FF00FF ) |
-											  ( (((tmp_col[0] & 0x0000FF00) + (tmp_col[1] & 0x0000FF00)) >> 1) & 0x0000FF00 ) |
-											  0xFF000000;
-								tmp_col[3]	= 0x00FFFFFF;
-#endif
-								break;
-								
-							case 2:
-								tmp_col[2] = RGB15TO32( PAL4X4(pal1offset+2), 0xFF );
-								tmp_col[3] = RGB15TO32( PAL4X4(pal1offset+3), 0xFF );
-								break;
-								
-							case 3:
-							{
-#ifdef LOCAL_BE
-								const u32 r0	= (tmp_col[0]>>24) & 0x000000FF;
-								const u32 r1	= (tmp_col[1]>>24) & 0x000000FF;
-								const u32 g0	= (tmp_col[0]>>16) & 0x000000FF;
-								const u32 g1	= (tmp_col[1]>>16) & 0x000000FF;
-								const u32 b0	= (tmp_col[0]>> 8) & 0x000000FF;
-								const u32 b1	= (tmp_col[1]>> 8) & 0x000000FF;
-#else
-								const u32 r0	=  tmp_col[0]      & 0x000000FF;
-								const u32 r1	=  tmp_col[1]      & 0x000000FF;
-								const u32 g0	= (tmp_col[0]>> 8) & 0x000000FF;
-								const u32 g1	= (tmp_col[1]>> 8) & 0x000000FF;
-								const u32 b0	= (tmp_col[0]>>16) & 0x000000FF;
-								const u32 b1	= (tmp_col[1]>>16) & 0x000000FF;
-#endif
+		TexCacheItem* newitem = createItem(format,texpal,TEXFORMAT,layout,pal);
+		list_push_front(newitem);
+		//printf("allocating: up to %d with %d items\n",cache_size,tableCount);
 
-								const u16 tmp1	= (  (r0*5 + r1*3)>>6) |
-												  ( ((g0*5 + g1*3)>>6) <<  5 ) |
-												  ( ((b0*5 + b1*3)>>6) << 10 );
-								const u16 tmp2	= (  (r0*3 + r1*5)>>6) |
-												  ( ((g0*3 + g1*5)>>6) <<  5 ) |
-												  ( ((b0*3 + b1*5)>>6) << 10 );
-
-								tmp_col[2] = RGB15TO32(tmp1, 0xFF);
-								tmp_col[3] = RGB15TO32(tmp2, 0xFF);
-								break;
-							}
-						}
-
-						if(TEXFORMAT==TexFormat_15bpp)
-						{
-							for (size_t i = 0; i < 4; i++)
-							{
-#ifdef LOCAL_BE
-								const u32 a = (tmp_col[i] >> 3) & 0x0000001F;
-								tmp_col[i] >>= 2;
-								tmp_col[i] &= 0x3F3F3F00;
-								tmp_col[i] |= a;
-#else
-								const u32 a = (tmp_col[i] >> 3) & 0x1F000000;
-								tmp_col[i] >>= 2;
-								tmp_col[i] &= 0x003F3F3F;
-								tmp_col[i] |= a;
-#endif
-							}
-						}
-
-						//TODO - this could be more precise for 32bpp mode (run it through the color separation table)
-
-						//set all 16 texels
-						for (size_t sy = 0; sy < 4; sy++)
-						{
-							// Texture offset
-							u32 currentPos = (x<<2) + tmpPos[sy];
-							u8 currRow = (u8)((currBlock>>(sy<<3))&0xFF);
-
-							dwdst[currentPos  ] = tmp_col[ currRow    &3];
-							dwdst[currentPos+1] = tmp_col[(currRow>>2)&3];
-							dwdst[currentPos+2] = tmp_col[(currRow>>4)&3];
-							dwdst[currentPos+3] = tmp_col[(currRow>>6)&3];
-						}
-					}
-				}
-				break;
-			}
-		case TEXMODE_A5I3:
-			{
-				for(int j=0;j<ms.numItems;j++) {
-					adr = ms.items[j].ptr;
-					for(u32 x = 0; x < ms.items[j].len; ++x)
-					{
-						u16 c = pal[*adr&0x07];
-						u8 alpha = (*adr>>3);
-						if(TEXFORMAT == TexFormat_15bpp)
-							*dwdst++ = RGB15TO6665(c,alpha);
-						else
-							*dwdst++ = RGB15TO32(c,material_5bit_to_8bit[alpha]);
-						adr++;
-					}
-				}
-				break;
-			}
-		case TEXMODE_16BPP:
-			{
-				for(int j=0;j<ms.numItems;j++) {
-					u16* map = (u16*)ms.items[j].ptr;
-					int len = ms.items[j].len>>1;
-					for(int x = 0; x < len; ++x)
-					{
-						u16 c = map[x];
-						int alpha = ((c&0x8000)?opaqueColor:0);
-						*dwdst++ = CONVERT(c&0x7FFF,alpha);
-					}
-				}
-				break;
+
+		//============================================================================ 
+		//Texture conversion
+		//============================================================================ 
+
+		TexDecodeSource src;
+		src.ms = &ms;
+		src.pal = pal;
+		if(textureMode == TEXMODE_4X4)
+		{
+			if(ms.numItems != 1) {
+				PROGINFO("Your 4x4 texture has overrun its texture slot.\n");
 			}
-		} //switch(texture format)
+			//this check isnt necessary since the addressing is tied to the texture data which will also run out:
+			//if(msIndex.numItems != 1) PROGINFO("Your 4x4 texture index has overrun its slot.\n");
+
+			u16* slot1;
+			if ( (format & 0xc000) == 0x8000)
+				// texel are in slot 2
+				slot1=(u16*)&MMU.texInfo.textureSlotAddr[1][((format & 0x3FFF)<<2)+0x010000];
+			else 
+				slot1=(u16*)&MMU.texInfo.textureSlotAddr[1][(format & 0x3FFF)<<2];
+
+			src.map4x4 = (u32*)ms.items[0].ptr;
+			src.index4x4 = slot1;
+			src.limit4x4 = ms.items[0].len<<2;
+			src.paletteAddress4x4 = layout.paletteAddress;
+			src.palSlots4x4 = MMU.texInfo.texPalSlot;
+		}
+		DecodeTexture<TEXFORMAT>(newitem,src);
 
 #ifdef DO_DEBUG_DUMP_TEXTURE
 	DebugDumpTexture(newitem);
@@ -674,62 +1030,172 @@ public:
 		return newitem;
 	} //scan()
 
-	static const int PALETTE_DUMP_SIZE = (64+16+16)*1024;
-	u8 paletteDump[PALETTE_DUMP_SIZE];
+	bool preDecodeEnabled() const
+	{
+		return CommonSettings.GFX3D_TexPreDecode && !CommonSettings.single_core();
+	}
 
-	void invalidate()
+	//hands a texture to the pre-decoder, unless it is already cached and valid
+	void preDecode(u32 format, u32 texpal, TexCache_TexFormat cacheFormat)
 	{
-		//check whether the palette memory changed
-		//TODO - we should handle this instead by setting dirty flags in the vram memory mapping and noting whether palette memory was dirty.
-		//but this will work for now
-		MemSpan mspal = MemSpan_TexPalette(0,PALETTE_DUMP_SIZE,true);
-		bool paletteDirty = mspal.memcmp(paletteDump);
-		if(paletteDirty)
+		if(cacheFormat == TexFormat_None) return;
+		if(preDecoder.isFull() || preDecoder.isInFlight(format,texpal,cacheFormat)) return;
+
+		TexLayout layout(format,texpal);
+
+		//the texture's vram is most likely mapped away for an upload right now.
+		//it will come up again once the vram is mapped back (see invalidate())
+		if(layout.isUnmapped()) return;
+
+		TexCacheItem* curr = find(format,texpal,cacheFormat);
+		if(curr && curr->texDeps == layout.texDeps && curr->palDeps == layout.palDeps) return;
+
+		TexPreDecodeJob job;
+		job.palette4x4 = NULL;
+		job.palette4x4Size = 0;
+
+		if(layout.textureMode == TEXMODE_4X4)
 		{
-			mspal.dump(paletteDump);
+			//4x4 textures which overrun their slots are left to scan()
+			if(layout.ms.numItems != 1 || layout.msIndex.numItems != 1) return;
+
+			//copy the part of palette memory which the blocks refer to. that is at most 65540 bytes
+			//(the furthest a block can point is 0x3FFF*4 bytes in, and it uses up to 4 colors from there), and usually far less
+			const u16* index = (const u16*)layout.msIndex.items[0].ptr;
+			const u32 numBlocks = layout.msIndex.size>>1;
+			u32 maxOffset = 0;
+			for(u32 i=0;i<numBlocks;i++)
+				maxOffset = max(maxOffset,(u32)(LE_TO_LOCAL_16(index[i])&0x3FFF));
+			job.palette4x4Size = ((maxOffset<<1)+4)*2;
+
+			//and so are 4x4 textures whose palette runs past the last palette slot
+			if(layout.paletteAddress + job.palette4x4Size > 6*0x4000) return;
+
+			job.palette4x4 = arena.alloc(job.palette4x4Size);
+			MemSpan_TexPalette(layout.paletteAddress,job.palette4x4Size,true).dump(job.palette4x4);
 		}
 
-		for(TTexCacheItemMultimap::iterator it(index.begin()); it != index.end(); ++it)
+		u16 pal[256];
+		DumpPalette(layout.mspal,pal);
+		job.item = createItem(format,texpal,cacheFormat,layout,pal);
+		preDecoder.submit(job);
+	}
+
+	//frees a pre-decoded item which isnt going into the cache
+	void discard(TexCacheItem* item)
+	{
+		arena.free(item->decoded,item->decode_len);
+		arena.free(item->dump.texture,item->dump.textureSize+item->dump.indexSize);
+		delete item;
+	}
+
+	//moves finished pre-decoded textures into the cache, if they are still current
+	void adoptPreDecoded()
+	{
+		TexPreDecodeJob job;
+		while(preDecoder.receive(job))
 		{
-			it->second->suspectedInvalid = true;
-			
-			//when the palette changes, we assume all 4x4 textures are dirty.
-			//this is because each 4x4 item doesnt carry along with it a copy of the entire palette, for verification
-			//instead, we just use the one paletteDump for verifying of all 4x4 textures; and if paletteDirty is set, verification has failed
-			if(it->second->getTextureMode() == TEXMODE_4X4 && paletteDirty)
+			arena.free(job.palette4x4,job.palette4x4Size);
+
+			TexCacheItem* item = job.item;
+			TexLayout layout(item->texformat,item->texpal);
+
+			//vram changed while it was being decoded. the renderer will sort it out
+			if(item->texDeps != layout.texDeps || item->palDeps != layout.palDeps)
 			{
-				it->second->assumedInvalid = true;
+				discard(item);
+				continue;
+			}
+
+			TexCacheItem* curr = find(item->texformat,item->texpal,item->cacheFormat);
+			if(curr)
+			{
+				//the renderer got to it first
+				if(curr->texDeps == layout.texDeps && curr->palDeps == layout.palDeps)
+				{
+					discard(item);
+					continue;
+				}
+
+				//the vram was rewritten with the same data. keep the cached item, which the renderer may have uploaded already
+				const bool samePalette = (layout.textureMode == TEXMODE_4X4) ? (curr->palDeps == layout.palDeps) : !memcmp(curr->dump.palette,item->dump.palette,layout.palSize*2);
+				if(samePalette
+					&& curr->dump.textureSize == item->dump.textureSize && curr->dump.indexSize == item->dump.indexSize
+					&& !memcmp(curr->dump.texture,item->dump.texture,item->dump.textureSize+item->dump.indexSize))
+				{
+					curr->texDeps = layout.texDeps;
+					curr->palDeps = layout.palDeps;
+					discard(item);
+					continue;
+				}
+
+				destroy(curr);
 			}
+
+			list_push_front(item);
+			stats.preDecoded++;
 		}
 	}
 
-	void evict(u32 target = kMaxCacheSize)
+	//stops the pre-decode thread and throws away whatever it was working on
+	void stopPreDecoder()
 	{
-		//debug print
-		//printf("%d %d/%d\n",index.size(),cache_size/1024,target/1024);
+		preDecoder.stop();
+		for(u32 i=0;i<preDecoder.numInFlight;i++)
+		{
+			arena.free(preDecoder.inFlight[i].palette4x4,preDecoder.inFlight[i].palette4x4Size);
+			discard(preDecoder.inFlight[i].item);
+		}
+		preDecoder.numInFlight = 0;
+	}
 
-		//dont do anything unless we're over the target
-		if(cache_size<target) return;
+	void invalidate()
+	{
+		//every lookup resolves the texture's vram pages through the current mapping and checks their generation counters,
+		//so remapping is caught the same way as writes are, and nothing needs to be thrown out here.
+		//however, mapping vram back to the texture slots is how games finish uploading textures.
+		//so this is a good time to have the textures used in the last couple of frames decoded again, if they changed.
+		if(!preDecodeEnabled()) return;
+		for(TexCacheItem* item = lruHead; item && item->lastUsed+1 >= frameCounter; item = item->lruNext)
+		{
+			if(preDecoder.isFull()) break;
+			preDecode(item->texformat,item->texpal,item->cacheFormat);
+		}
+	}
 
-		//aim at cutting the cache to half of the max size
-		target/=2;
+	//throws out the least recently used items until the cache fits in the target size.
+	//what the arena holds from the heap counts as well, since slabs kept by a few items can hold more than those items
+	void evict(u32 target)
+	{
+		//debug print
+		//printf("%d %d/%d\n",tableCount,cache_size/1024,target/1024);
 
-		//evicts items in an arbitrary order until it is less than the max cache size
-		//TODO - do this based on age and not arbitrarily
-		while(cache_size > target)
+		while((cache_size > target || arena.footprint() > target) && lruTail)
 		{
-			if(index.size()==0) break; //just in case.. doesnt seem possible, cache_size wouldve been 0
+			destroy(lruTail);
+			stats.evictions++;
+		}
 
-			TexCacheItem* item = index.begin()->second;
-			list_remove(item);
-			//printf("evicting! totalsize:%d\n",cache_size);
-			delete item;
+		if(tableCount == 0 && preDecoder.numInFlight == 0)
+		{
+			//nothing is left, so give the memory back
+			arena.reset();
+			delete[] table;
+			table = NULL;
+			tableCapacity = tableUsed = 0;
 		}
 	}
+
+	u32 budget() const
+	{
+		if(CommonSettings.GFX3D_TexCacheBudgetMB <= 0) return kMaxCacheSize;
+		return (u32)CommonSettings.GFX3D_TexCacheBudgetMB*1024*1024;
+	}
 } texCache;
 
 void TexCache_Reset()
 {
+	texCache.stopPreDecoder();
 	texCache.evict(0);
 }
 
@@ -749,8 +1215,29 @@ TexCacheItem* TexCache_SetTexture(TexCache_TexFormat TEXFORMAT, u32 format, u32
 	}
 }
 
+void TexCache_PreDecode(u32 format, u32 texpal)
+{
+	if(!texCache.preDecodeEnabled()) return;
+	texCache.preDecode(format,texpal,texCache.lastCacheFormat);
+}
+
 //call this periodically to keep the tex cache clean
 void TexCache_EvictFrame()
 {
-	texCache.evict();
+	texCache.adoptPreDecoded();
+	texCache.evict(texCache.budget());
+	texCache.frameCounter++;
+}
+
+TexCacheStats TexCache_GetStats()
+{
+	TexCacheStats ret = texCache.stats;
+	ret.numItems = texCache.tableCount;
+	ret.memoryUsed = texCache.arena.footprint();
+	return ret;
+}
+
+void TexCache_ResetStats()
+{
+	memset(&texCache.stats,0,sizeof(texCache.stats));
 }
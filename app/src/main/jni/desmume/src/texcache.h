@@ -20,7 +20,7 @@
 #ifndef _TEXCACHE_H_
 #define _TEXCACHE_H_
 
-#include <map>
+#include <stddef.h>
 
 #include "types.h"
 
@@ -33,7 +33,20 @@ enum TexCache_TexFormat
 
 class TexCacheItem;
 
-typedef std::multimap<u32,TexCacheItem*> TTexCacheItemMultimap;
+//the vram pages a texture was decoded from, along with the state of their generation counters at that time.
+//when these still match, the texture is known to be valid without looking at its data.
+struct TexCacheVramDeps
+{
+	TexCacheVramDeps() : pageMask(0), genSum(0) {}
+
+	u64 pageMask; //one bit for each vram page involved
+	u64 genSum; //sum of those pages' generation counters. they only ever count up, so this changes whenever one of them does
+
+	void addPage(u32 page);
+
+	bool operator==(const TexCacheVramDeps& other) const { return pageMask == other.pageMask && genSum == other.genSum; }
+	bool operator!=(const TexCacheVramDeps& other) const { return !(*this == other); }
+};
 
 class TexCacheItem
 {
@@ -41,21 +54,27 @@ public:
 	TexCacheItem() 
 		: decode_len(0)
 		, decoded(NULL)
-		, suspectedInvalid(false)
-		, assumedInvalid(false)
+		, tableSlot(0)
+		, lruPrev(NULL)
+		, lruNext(NULL)
 		, deleteCallback(NULL)
 		, cacheFormat(TexFormat_None)
-	{}
+		, lastUsed(0)
+	{
+		dump.texture = NULL;
+		dump.textureSize = dump.indexSize = 0;
+	}
 	~TexCacheItem() {
-		delete[] decoded;
 		if(deleteCallback) deleteCallback(this);
 	}
 	u32 decode_len;
 	u32 mode;
-	u8* decoded; //decoded texture data
-	bool suspectedInvalid;
-	bool assumedInvalid;
-	TTexCacheItemMultimap::iterator iterator;
+	u8* decoded; //decoded texture data (owned by the texcache's allocator)
+	TexCacheVramDeps texDeps, palDeps; //texture and 4x4 index pages; palette pages
+
+	//bookkeeping for the texcache's hash table and LRU list
+	u32 tableSlot;
+	TexCacheItem *lruPrev, *lruNext;
 
 	int getTextureMode() const { return (int)((texformat>>26)&0x07); }
 
@@ -68,21 +87,38 @@ public:
 
 	TexCache_TexFormat cacheFormat;
 
+	u32 lastUsed; //the texcache's frame count when this was last looked up
+
 	struct Dump {
-		~Dump() {
-			delete[] texture;
-		}
 		int textureSize, indexSize;
-		static const int maxTextureSize=128*1024;
-		u8* texture;
+		u8* texture; //texture and 4x4 index data (owned by the texcache's allocator)
 		u8 palette[256*2];
 	} dump;
 };
 
+struct TexCacheStats
+{
+	u32 hits; //lookups satisfied from the cache
+	u32 revalidations; //hits which had to compare texture data because their vram was touched
+	u32 misses; //lookups which had to decode the texture
+	u32 evictions; //items thrown out to stay within the memory budget
+	u32 preDecoded; //items decoded ahead of time on the pre-decode thread and taken into the cache
+	u32 numItems;
+	u32 memoryUsed; //bytes the cache holds from the heap for decoded texels and texture dumps
+};
+
 void TexCache_Invalidate();
 void TexCache_Reset();
 void TexCache_EvictFrame();
 
+TexCacheStats TexCache_GetStats();
+void TexCache_ResetStats();
+
 TexCacheItem* TexCache_SetTexture(TexCache_TexFormat TEXFORMAT, u32 format, u32 texpal);
 
+//hints that a texture is about to be used, so that it can be decoded ahead of time on another thread.
+//this never waits for anything; the texture is picked up by TexCache_SetTexture if it is ready by then.
+//does nothing unless CommonSettings.GFX3D_TexPreDecode is set
+void TexCache_PreDecode(u32 format, u32 texpal);
+
 #endif
@@ -0,0 +1,789 @@
+/*
+	Copyright (C) 2006 yopyop
+	Copyright (C) 2006-2007 shash
+	Copyright (C) 2008-2015 DeSmuME team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "texdecode.h"
+
+#include "bits.h"
+#include "gfx3d.h"
+
+//the vectorized decoders build texels bytewise, so they assume a little endian host
+#if defined(ENABLE_SSSE3) && !defined(WORDS_BIGENDIAN)
+	#define TEXDECODE_SSSE3
+	#include <tmmintrin.h>
+#elif defined(ENABLE_NEON) && !defined(WORDS_BIGENDIAN)
+	#define TEXDECODE_NEON
+	#include <arm_neon.h>
+#endif
+
+#define CONVERT(color,alpha) ((TEXFORMAT == TexFormat_32bpp)?(RGB15TO32(color,alpha)):RGB15TO6665(color,alpha))
+
+//converts count palette entries to texels. the given alpha is used for color 0, and the rest are opaque.
+//entries up to padTo are zeroed, so that the result can be used as a full lookup table
+template<TexCache_TexFormat TEXFORMAT>
+static FORCEINLINE void ExpandPalette(const u16* pal, int count, u8 palZeroAlpha, u32* out, int padTo)
+{
+	const u8 opaqueColor = (TEXFORMAT == TexFormat_32bpp) ? 0xFF : 0x1F;
+	out[0] = CONVERT(pal[0],palZeroAlpha);
+	for(int i=1;i<count;i++)
+		out[i] = CONVERT(pal[i],opaqueColor);
+	for(int i=count;i<padTo;i++)
+		out[i] = 0;
+}
+
+//converts count palette entries to texels with no alpha, for the formats which carry their own alpha bits
+template<TexCache_TexFormat TEXFORMAT>
+static FORCEINLINE void ExpandPaletteColors(const u16* pal, int count, u32* out, int padTo)
+{
+	for(int i=0;i<count;i++)
+		out[i] = CONVERT(pal[i],0);
+	for(int i=count;i<padTo;i++)
+		out[i] = 0;
+}
+
+#ifdef TEXDECODE_SSSE3
+
+//splits 16 texels into four 16 byte lookup tables, one for each byte of the texel, for use with pshufb
+static FORCEINLINE void SplitPlanes(const u32* texels, __m128i* planes)
+{
+	CACHE_ALIGN u8 bytes[4][16];
+	for(int i=0;i<16;i++)
+		for(int b=0;b<4;b++)
+			bytes[b][i] = (u8)(texels[i]>>(b*8));
+	for(int b=0;b<4;b++)
+		planes[b] = _mm_load_si128((const __m128i*)bytes[b]);
+}
+
+//interleaves four planes of 16 bytes into 16 texels
+static FORCEINLINE void WriteTexels16(const __m128i p0, const __m128i p1, const __m128i p2, const __m128i p3, u32* dst)
+{
+	const __m128i lo01 = _mm_unpacklo_epi8(p0,p1);
+	const __m128i hi01 = _mm_unpackhi_epi8(p0,p1);
+	const __m128i lo23 = _mm_unpacklo_epi8(p2,p3);
+	const __m128i hi23 = _mm_unpackhi_epi8(p2,p3);
+	_mm_storeu_si128((__m128i*)dst+0, _mm_unpacklo_epi16(lo01,lo23));
+	_mm_storeu_si128((__m128i*)dst+1, _mm_unpackhi_epi16(lo01,lo23));
+	_mm_storeu_si128((__m128i*)dst+2, _mm_unpacklo_epi16(hi01,hi23));
+	_mm_storeu_si128((__m128i*)dst+3, _mm_unpackhi_epi16(hi01,hi23));
+}
+
+//looks up 16 palette indices (0-15) and writes the resulting texels
+static FORCEINLINE void Lookup16(const __m128i* planes, const __m128i idx, u32* dst)
+{
+	WriteTexels16(
+		_mm_shuffle_epi8(planes[0],idx),
+		_mm_shuffle_epi8(planes[1],idx),
+		_mm_shuffle_epi8(planes[2],idx),
+		_mm_shuffle_epi8(planes[3],idx),
+		dst);
+}
+
+#endif //TEXDECODE_SSSE3
+
+#ifdef TEXDECODE_NEON
+
+//splits count texels (8, 16 or 32) into four lookup tables, one for each byte of the texel, for use with vtbl
+static FORCEINLINE void SplitPlanes(const u32* texels, int count, u8 (*bytes)[32])
+{
+	for(int i=0;i<count;i++)
+		for(int b=0;b<4;b++)
+			bytes[b][i] = (u8)(texels[i]>>(b*8));
+}
+
+//looks up 8 palette indices (0-15) and writes the resulting texels
+static FORCEINLINE void Lookup8(const uint8x8x2_t* planes, const uint8x8_t idx, u32* dst)
+{
+	uint8x8x4_t out;
+	out.val[0] = vtbl2_u8(planes[0],idx);
+	out.val[1] = vtbl2_u8(planes[1],idx);
+	out.val[2] = vtbl2_u8(planes[2],idx);
+	out.val[3] = vtbl2_u8(planes[3],idx);
+	vst4_u8((u8*)dst,out);
+}
+
+static FORCEINLINE void LoadPlanes16(u8 (*bytes)[32], uint8x8x2_t* planes)
+{
+	for(int b=0;b<4;b++)
+	{
+		planes[b].val[0] = vld1_u8(bytes[b]);
+		planes[b].val[1] = vld1_u8(bytes[b]+8);
+	}
+}
+
+#endif //TEXDECODE_NEON
+
+//------------------------------------------------------------
+//reference decoders
+
+template<TexCache_TexFormat TEXFORMAT>
+u32* TexDecode_I2_Reference(const u8* adr, u32 len, const u16* pal, u8 palZeroTransparent, u32* dwdst)
+{
+	const u8 opaqueColor = (TEXFORMAT == TexFormat_32bpp) ? 0xFF : 0x1F;
+	for(u32 x = 0; x < len; x++)
+	{
+		u8 bits;
+		u16 c;
+
+		bits = (*adr)&0x3;
+		c = pal[bits];
+		*dwdst++ = CONVERT(c,(bits == 0) ? palZeroTransparent : opaqueColor);
+
+		bits = ((*adr)>>2)&0x3;
+		c = pal[bits];
+		*dwdst++ = CONVERT(c,(bits == 0) ? palZeroTransparent : opaqueColor);
+
+		bits = ((*adr)>>4)&0x3;
+		c = pal[bits];
+		*dwdst++ = CONVERT(c,(bits == 0) ? palZeroTransparent : opaqueColor);
+
+		bits = ((*adr)>>6)&0x3;
+		c = pal[bits];
+		*dwdst++ = CONVERT(c,(bits == 0) ? palZeroTransparent : opaqueColor);
+
+		adr++;
+	}
+	return dwdst;
+}
+
+template<TexCache_TexFormat TEXFORMAT>
+u32* TexDecode_I4_Reference(const u8* adr, u32 len, const u16* pal, u8 palZeroTransparent, u32* dwdst)
+{
+	const u8 opaqueColor = (TEXFORMAT == TexFormat_32bpp) ? 0xFF : 0x1F;
+	for(u32 x = 0; x < len; x++)
+	{
+		u8 bits;
+		u16 c;
+
+		bits = (*adr)&0xF;
+		c = pal[bits];
+		*dwdst++ = CONVERT(c,(bits == 0) ? palZeroTransparent : opaqueColor);
+
+		bits = ((*adr)>>4);
+		c = pal[bits];
+		*dwdst++ = CONVERT(c,(bits == 0) ? palZeroTransparent : opaqueColor);
+		adr++;
+	}
+	return dwdst;
+}
+
+template<TexCache_TexFormat TEXFORMAT>
+u32* TexDecode_I8_Reference(const u8* adr, u32 len, const u16* pal, u8 palZeroTransparent, u32* dwdst)
+{
+	const u8 opaqueColor = (TEXFORMAT == TexFormat_32bpp) ? 0xFF : 0x1F;
+	for(u32 x = 0; x < len; ++x)
+	{
+		u16 c = pal[*adr];
+		*dwdst++ = CONVERT(c,(*adr == 0) ? palZeroTransparent : opaqueColor);
+		adr++;
+	}
+	return dwdst;
+}
+
+template<TexCache_TexFormat TEXFORMAT>
+u32* TexDecode_A3I5_Reference(const u8* adr, u32 len, const u16* pal, u32* dwdst)
+{
+	for(u32 x = 0; x < len; x++)
+	{
+		u16 c = pal[*adr&31];
+		u8 alpha = *adr>>5;
+		if(TEXFORMAT == TexFormat_15bpp)
+			*dwdst++ = RGB15TO6665(c,material_3bit_to_5bit[alpha]);
+		else
+			*dwdst++ = RGB15TO32(c,material_3bit_to_8bit[alpha]);
+		adr++;
+	}
+	return dwdst;
+}
+
+template<TexCache_TexFormat TEXFORMAT>
+u32* TexDecode_A5I3_Reference(const u8* adr, u32 len, const u16* pal, u32* dwdst)
+{
+	for(u32 x = 0; x < len; ++x)
+	{
+		u16 c = pal[*adr&0x07];
+		u8 alpha = (*adr>>3);
+		if(TEXFORMAT == TexFormat_15bpp)
+			*dwdst++ = RGB15TO6665(c,alpha);
+		else
+			*dwdst++ = RGB15TO32(c,material_5bit_to_8bit[alpha]);
+		adr++;
+	}
+	return dwdst;
+}
+
+template<TexCache_TexFormat TEXFORMAT>
+u32* TexDecode_16bpp_Reference(const u8* src, u32 len, u32* dwdst)
+{
+	const u8 opaqueColor = (TEXFORMAT == TexFormat_32bpp) ? 0xFF : 0x1F;
+	const u16* map = (const u16*)src;
+	const int count = len>>1;
+	for(int x = 0; x < count; ++x)
+	{
+		u16 c = map[x];
+		int alpha = ((c&0x8000)?opaqueColor:0);
+		*dwdst++ = CONVERT(c&0x7FFF,alpha);
+	}
+	return dwdst;
+}
+
+//------------------------------------------------------------
+//vectorized decoders
+
+template<TexCache_TexFormat TEXFORMAT>
+u32* TexDecode_I2(const u8* src, u32 len, const u16* pal, u8 palZeroAlpha, u32* dst)
+{
+	u32 palTexels[16];
+	ExpandPalette<TEXFORMAT>(pal,4,palZeroAlpha,palTexels,16);
+
+	u32 x = 0;
+#if defined(TEXDECODE_SSSE3)
+	__m128i planes[4];
+	SplitPlanes(palTexels,planes);
+	const __m128i mask = _mm_set1_epi8(0x03);
+	for(;x+4<=len;x+=4)
+	{
+		u32 bits;
+		memcpy(&bits,src+x,4);
+		const __m128i a = _mm_cvtsi32_si128(bits);
+		const __m128i i0 = _mm_and_si128(a,mask);
+		const __m128i i1 = _mm_and_si128(_mm_srli_epi16(a,2),mask);
+		const __m128i i2 = _mm_and_si128(_mm_srli_epi16(a,4),mask);
+		const __m128i i3 = _mm_and_si128(_mm_srli_epi16(a,6),mask);
+		const __m128i idx = _mm_unpacklo_epi16(_mm_unpacklo_epi8(i0,i1),_mm_unpacklo_epi8(i2,i3));
+		Lookup16(planes,idx,dst);
+		dst += 16;
+	}
+#elif defined(TEXDECODE_NEON)
+	u8 bytes[4][32];
+	uint8x8x2_t planes[4];
+	SplitPlanes(palTexels,16,bytes);
+	LoadPlanes16(bytes,planes);
+	const uint8x8_t mask = vdup_n_u8(0x03);
+	for(;x+4<=len;x+=4)
+	{
+		u32 bits;
+		memcpy(&bits,src+x,4);
+		const uint8x8_t a = vreinterpret_u8_u32(vdup_n_u32(bits));
+		const uint8x8x2_t z01 = vzip_u8(vand_u8(a,mask),vand_u8(vshr_n_u8(a,2),mask));
+		const uint8x8x2_t z23 = vzip_u8(vand_u8(vshr_n_u8(a,4),mask),vshr_n_u8(a,6));
+		const uint16x4x2_t idx = vzip_u16(vreinterpret_u16_u8(z01.val[0]),vreinterpret_u16_u8(z23.val[0]));
+		Lookup8(planes,vreinterpret_u8_u16(idx.val[0]),dst);
+		Lookup8(planes,vreinterpret_u8_u16(idx.val[1]),dst+8);
+		dst += 16;
+	}
+#endif
+
+	for(;x<len;x++)
+	{
+		const u8 bits = src[x];
+		*dst++ = palTexels[bits&3];
+		*dst++ = palTexels[(bits>>2)&3];
+		*dst++ = palTexels[(bits>>4)&3];
+		*dst++ = palTexels[bits>>6];
+	}
+	return dst;
+}
+
+template<TexCache_TexFormat TEXFORMAT>
+u32* TexDecode_I4(const u8* src, u32 len, const u16* pal, u8 palZeroAlpha, u32* dst)
+{
+	u32 palTexels[16];
+	ExpandPalette<TEXFORMAT>(pal,16,palZeroAlpha,palTexels,16);
+
+	u32 x = 0;
+#if defined(TEXDECODE_SSSE3)
+	__m128i planes[4];
+	SplitPlanes(palTexels,planes);
+	const __m128i mask = _mm_set1_epi8(0x0F);
+	for(;x+8<=len;x+=8)
+	{
+		const __m128i a = _mm_loadl_epi64((const __m128i*)(src+x));
+		const __m128i lo = _mm_and_si128(a,mask);
+		const __m128i hi = _mm_and_si128(_mm_srli_epi16(a,4),mask);
+		Lookup16(planes,_mm_unpacklo_epi8(lo,hi),dst);
+		dst += 16;
+	}
+#elif defined(TEXDECODE_NEON)
+	u8 bytes[4][32];
+	uint8x8x2_t planes[4];
+	SplitPlanes(palTexels,16,bytes);
+	LoadPlanes16(bytes,planes);
+	const uint8x8_t mask = vdup_n_u8(0x0F);
+	for(;x+8<=len;x+=8)
+	{
+		const uint8x8_t a = vld1_u8(src+x);
+		const uint8x8x2_t idx = vzip_u8(vand_u8(a,mask),vshr_n_u8(a,4));
+		Lookup8(planes,idx.val[0],dst);
+		Lookup8(planes,idx.val[1],dst+8);
+		dst += 16;
+	}
+#endif
+
+	for(;x<len;x++)
+	{
+		const u8 bits = src[x];
+		*dst++ = palTexels[bits&0xF];
+		*dst++ = palTexels[bits>>4];
+	}
+	return dst;
+}
+
+template<TexCache_TexFormat TEXFORMAT>
+u32* TexDecode_I8(const u8* src, u32 len, const u16* pal, u8 palZeroAlpha, u32* dst)
+{
+	//a 256 color palette is too big for the vector table lookups, but converting it up front
+	//turns each texel into a single load. that only pays off when there are more texels than colors.
+	if(len < 256)
+		return TexDecode_I8_Reference<TEXFORMAT>(src,len,pal,palZeroAlpha,dst);
+
+	u32 palTexels[256];
+	ExpandPalette<TEXFORMAT>(pal,256,palZeroAlpha,palTexels,256);
+
+	u32 x = 0;
+	for(;x+4<=len;x+=4)
+	{
+		dst[0] = palTexels[src[x]];
+		dst[1] = palTexels[src[x+1]];
+		dst[2] = palTexels[src[x+2]];
+		dst[3] = palTexels[src[x+3]];
+		dst += 4;
+	}
+	for(;x<len;x++)
+		*dst++ = palTexels[src[x]];
+	return dst;
+}
+
+template<TexCache_TexFormat TEXFORMAT>
+u32* TexDecode_A3I5(const u8* src, u32 len, const u16* pal, u32* dst)
+{
+	const u8* alphaTable = (TEXFORMAT == TexFormat_15bpp) ? material_3bit_to_5bit : material_3bit_to_8bit;
+
+	u32 palTexels[32];
+	ExpandPaletteColors<TEXFORMAT>(pal,32,palTexels,32);
+
+	u32 x = 0;
+#if defined(TEXDECODE_SSSE3)
+	__m128i lo[4], hi[4];
+	SplitPlanes(palTexels,lo);
+	SplitPlanes(palTexels+16,hi);
+	CACHE_ALIGN u8 alphaBytes[16] = {0};
+	memcpy(alphaBytes,alphaTable,8);
+	const __m128i alphaPlane = _mm_load_si128((const __m128i*)alphaBytes);
+	const __m128i mask0F = _mm_set1_epi8(0x0F);
+	const __m128i mask10 = _mm_set1_epi8(0x10);
+	const __m128i mask07 = _mm_set1_epi8(0x07);
+	for(;x+16<=len;x+=16)
+	{
+		const __m128i a = _mm_loadu_si128((const __m128i*)(src+x));
+		const __m128i idx = _mm_and_si128(a,mask0F);
+		const __m128i useHi = _mm_cmpeq_epi8(_mm_and_si128(a,mask10),mask10);
+		const __m128i alphaIdx = _mm_and_si128(_mm_srli_epi16(a,5),mask07);
+		__m128i p[3];
+		for(int b=0;b<3;b++)
+			p[b] = _mm_or_si128(
+				_mm_and_si128(useHi,_mm_shuffle_epi8(hi[b],idx)),
+				_mm_andnot_si128(useHi,_mm_shuffle_epi8(lo[b],idx)));
+		WriteTexels16(p[0],p[1],p[2],_mm_shuffle_epi8(alphaPlane,alphaIdx),dst);
+		dst += 16;
+	}
+#elif defined(TEXDECODE_NEON)
+	u8 bytes[4][32];
+	SplitPlanes(palTexels,32,bytes);
+	uint8x8x4_t planes[3];
+	for(int b=0;b<3;b++)
+		for(int i=0;i<4;i++)
+			planes[b].val[i] = vld1_u8(bytes[b]+i*8);
+	const uint8x8_t alphaPlane = vld1_u8(alphaTable);
+	const uint8x8_t mask = vdup_n_u8(0x1F);
+	for(;x+8<=len;x+=8)
+	{
+		const uint8x8_t a = vld1_u8(src+x);
+		const uint8x8_t idx = vand_u8(a,mask);
+		uint8x8x4_t out;
+		out.val[0] = vtbl4_u8(planes[0],idx);
+		out.val[1] = vtbl4_u8(planes[1],idx);
+		out.val[2] = vtbl4_u8(planes[2],idx);
+		out.val[3] = vtbl1_u8(alphaPlane,vshr_n_u8(a,5));
+		vst4_u8((u8*)dst,out);
+		dst += 8;
+	}
+#endif
+
+	for(;x<len;x++)
+	{
+		const u8 bits = src[x];
+		*dst++ = palTexels[bits&31] | ((u32)alphaTable[bits>>5]<<24);
+	}
+	return dst;
+}
+
+template<TexCache_TexFormat TEXFORMAT>
+u32* TexDecode_A5I3(const u8* src, u32 len, const u16* pal, u32* dst)
+{
+	u32 palTexels[16];
+	ExpandPaletteColors<TEXFORMAT>(pal,8,palTexels,16);
+
+	//the alpha is 5 bits in the top of the byte. 5 to 8 bit expansion is the same as material_5bit_to_8bit,
+	//which works out to (alpha<<3)|(alpha>>2), or (bits&0xF8)|(bits>>5) in terms of the texel byte
+	u32 x = 0;
+#if defined(TEXDECODE_SSSE3)
+	__m128i planes[4];
+	SplitPlanes(palTexels,planes);
+	const __m128i mask07 = _mm_set1_epi8(0x07);
+	const __m128i maskF8 = _mm_set1_epi8((char)0xF8);
+	const __m128i mask1F = _mm_set1_epi8(0x1F);
+	for(;x+16<=len;x+=16)
+	{
+		const __m128i a = _mm_loadu_si128((const __m128i*)(src+x));
+		const __m128i idx = _mm_and_si128(a,mask07);
+		__m128i alpha;
+		if(TEXFORMAT == TexFormat_15bpp)
+			alpha = _mm_and_si128(_mm_srli_epi16(a,3),mask1F);
+		else
+			alpha = _mm_or_si128(_mm_and_si128(a,maskF8),_mm_and_si128(_mm_srli_epi16(a,5),mask07));
+		WriteTexels16(
+			_mm_shuffle_epi8(planes[0],idx),
+			_mm_shuffle_epi8(planes[1],idx),
+			_mm_shuffle_epi8(planes[2],idx),
+			alpha,
+			dst);
+		dst += 16;
+	}
+#elif defined(TEXDECODE_NEON)
+	u8 bytes[4][32];
+	SplitPlanes(palTexels,8,bytes);
+	const uint8x8_t plane0 = vld1_u8(bytes[0]);
+	const uint8x8_t plane1 = vld1_u8(bytes[1]);
+	const uint8x8_t plane2 = vld1_u8(bytes[2]);
+	const uint8x8_t mask07 = vdup_n_u8(0x07);
+	const uint8x8_t maskF8 = vdup_n_u8(0xF8);
+	for(;x+8<=len;x+=8)
+	{
+		const uint8x8_t a = vld1_u8(src+x);
+		const uint8x8_t idx = vand_u8(a,mask07);
+		uint8x8x4_t out;
+		out.val[0] = vtbl1_u8(plane0,idx);
+		out.val[1] = vtbl1_u8(plane1,idx);
+		out.val[2] = vtbl1_u8(plane2,idx);
+		if(TEXFORMAT == TexFormat_15bpp)
+			out.val[3] = vshr_n_u8(a,3);
+		else
+			out.val[3] = vorr_u8(vand_u8(a,maskF8),vshr_n_u8(a,5));
+		vst4_u8((u8*)dst,out);
+		dst += 8;
+	}
+#endif
+
+	for(;x<len;x++)
+	{
+		const u8 bits = src[x];
+		const u8 alpha = (TEXFORMAT == TexFormat_15bpp) ? (bits>>3) : material_5bit_to_8bit[bits>>3];
+		*dst++ = palTexels[bits&7] | ((u32)alpha<<24);
+	}
+	return dst;
+}
+
+template<TexCache_TexFormat TEXFORMAT>
+u32* TexDecode_16bpp(const u8* src, u32 len, u32* dst)
+{
+	//the color tables which the reference decoder uses boil down to (x<<3)|(x>>2) per channel for 32bpp,
+	//and (x<<1)+1 for 6665, so these are computed directly
+	u32 x = 0;
+#if defined(TEXDECODE_SSSE3)
+	const __m128i mask1F = _mm_set1_epi16(0x1F);
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i opaqueColor = _mm_set1_epi16((TEXFORMAT == TexFormat_32bpp) ? 0xFF : 0x1F);
+	for(;x+16<=len;x+=16)
+	{
+		const __m128i c = _mm_loadu_si128((const __m128i*)(src+x));
+		__m128i r = _mm_and_si128(c,mask1F);
+		__m128i g = _mm_and_si128(_mm_srli_epi16(c,5),mask1F);
+		__m128i b = _mm_and_si128(_mm_srli_epi16(c,10),mask1F);
+		const __m128i a = _mm_and_si128(_mm_srai_epi16(c,15),opaqueColor);
+		if(TEXFORMAT == TexFormat_32bpp)
+		{
+			r = _mm_or_si128(_mm_slli_epi16(r,3),_mm_srli_epi16(r,2));
+			g = _mm_or_si128(_mm_slli_epi16(g,3),_mm_srli_epi16(g,2));
+			b = _mm_or_si128(_mm_slli_epi16(b,3),_mm_srli_epi16(b,2));
+		}
+		else
+		{
+			r = _mm_add_epi16(_mm_slli_epi16(r,1),one);
+			g = _mm_add_epi16(_mm_slli_epi16(g,1),one);
+			b = _mm_add_epi16(_mm_slli_epi16(b,1),one);
+		}
+		const __m128i rg = _mm_or_si128(r,_mm_slli_epi16(g,8));
+		const __m128i ba = _mm_or_si128(b,_mm_slli_epi16(a,8));
+		_mm_storeu_si128((__m128i*)dst+0, _mm_unpacklo_epi16(rg,ba));
+		_mm_storeu_si128((__m128i*)dst+1, _mm_unpackhi_epi16(rg,ba));
+		dst += 8;
+	}
+#elif defined(TEXDECODE_NEON)
+	const uint16x8_t mask1F = vdupq_n_u16(0x1F);
+	const uint8x8_t one = vdup_n_u8(1);
+	const uint8x8_t opaqueColor = vdup_n_u8((TEXFORMAT == TexFormat_32bpp) ? 0xFF : 0x1F);
+	for(;x+16<=len;x+=16)
+	{
+		const uint16x8_t c = vld1q_u16((const u16*)(src+x));
+		const uint8x8_t r = vmovn_u16(vandq_u16(c,mask1F));
+		const uint8x8_t g = vmovn_u16(vandq_u16(vshrq_n_u16(c,5),mask1F));
+		const uint8x8_t b = vmovn_u16(vandq_u16(vshrq_n_u16(c,10),mask1F));
+		const uint8x8_t opaque = vmovn_u16(vreinterpretq_u16_s16(vshrq_n_s16(vreinterpretq_s16_u16(c),15)));
+		uint8x8x4_t out;
+		if(TEXFORMAT == TexFormat_32bpp)
+		{
+			out.val[0] = vorr_u8(vshl_n_u8(r,3),vshr_n_u8(r,2));
+			out.val[1] = vorr_u8(vshl_n_u8(g,3),vshr_n_u8(g,2));
+			out.val[2] = vorr_u8(vshl_n_u8(b,3),vshr_n_u8(b,2));
+		}
+		else
+		{
+			out.val[0] = vadd_u8(vshl_n_u8(r,1),one);
+			out.val[1] = vadd_u8(vshl_n_u8(g,1),one);
+			out.val[2] = vadd_u8(vshl_n_u8(b,1),one);
+		}
+		out.val[3] = vand_u8(opaque,opaqueColor);
+		vst4_u8((u8*)dst,out);
+		dst += 8;
+	}
+#endif
+
+	if(x<len)
+		dst = TexDecode_16bpp_Reference<TEXFORMAT>(src+x,len-x,dst);
+	return dst;
+}
+
+//------------------------------------------------------------
+//4x4 compressed textures
+
+#if defined(TEXDECODE_SSSE3) || defined(TEXDECODE_NEON)
+//for each possible row of 4 two-bit texel indices, a byte shuffle which picks those texels out of the block's 4 colors
+static struct Tex4x4RowShuffles
+{
+	Tex4x4RowShuffles()
+	{
+		for(int row=0;row<256;row++)
+			for(int t=0;t<4;t++)
+				for(int j=0;j<4;j++)
+					shuffles[row][t*4+j] = (u8)((((row>>(t*2))&3)<<2) + j);
+	}
+	CACHE_ALIGN u8 shuffles[256][16];
+} tex4x4RowShuffles;
+#endif
+
+template<TexCache_TexFormat TEXFORMAT, bool VECTORIZED>
+static void Decode4x4(const u32* map, const u16* slot1, u32 limit, u32 sizeX, u32 sizeY, u32 paletteAddress, u8* const* palSlots, u32* dwdst)
+{
+	#define PAL4X4(offset) LE_TO_LOCAL_16( *(u16*)( palSlots[((paletteAddress + (offset)*2)>>14)&0x7] + ((paletteAddress + (offset)*2)&0x3FFF) ) )
+
+	u32 d = 0;
+
+	u16 yTmpSize = (sizeY>>2);
+	u16 xTmpSize = (sizeX>>2);
+
+	//this is flagged whenever a 4x4 overruns its slot.
+	//i am guessing we just generate black in that case
+	bool dead = false;
+
+	for (int y = 0; y < yTmpSize; y ++)
+	{
+		u32 tmpPos[4]={(y<<2)*sizeX,((y<<2)+1)*sizeX,
+			((y<<2)+2)*sizeX,((y<<2)+3)*sizeX};
+		for (int x = 0; x < xTmpSize; x ++, d++)
+		{
+			if(d >= limit)
+				dead = true;
+
+			if(dead) {
+				for (int sy = 0; sy < 4; sy++)
+				{
+					u32 currentPos = (x<<2) + tmpPos[sy];
+					dwdst[currentPos] = dwdst[currentPos+1] = dwdst[currentPos+2] = dwdst[currentPos+3] = 0;
+				}
+				continue;
+			}
+
+			u32 currBlock	= LE_TO_LOCAL_32(map[d]);
+			u16 pal1		= LE_TO_LOCAL_16(slot1[d]);
+			u16 pal1offset	= (pal1 & 0x3FFF)<<1;
+			u8  mode		= pal1>>14;
+			CACHE_ALIGN u32 tmp_col[4];
+
+			tmp_col[0] = RGB15TO32( PAL4X4(pal1offset), 0xFF );
+			tmp_col[1] = RGB15TO32( PAL4X4(pal1offset+1), 0xFF );
+
+			switch (mode)
+			{
+				case 0:
+					tmp_col[2] = RGB15TO32( PAL4X4(pal1offset+2), 0xFF );
+					tmp_col[3] = RGB15TO32(0x7FFF, 0x00);
+					break;
+
+				case 1:
+#ifdef LOCAL_BE
+					tmp_col[2]	= ( (((tmp_col[0] & 0xFF000000) >> 1)+((tmp_col[1] & 0xFF000000)  >> 1)) & 0xFF000000 ) |
+								  ( (((tmp_col[0] & 0x00FF0000)      + (tmp_col[1] & 0x00FF0000)) >> 1)  & 0x00FF0000 ) |
+								  ( (((tmp_col[0] & 0x0000FF00)      + (tmp_col[1] & 0x0000FF00)) >> 1)  & 0x0000FF00 ) |
+								  0x000000FF;
+					tmp_col[3]	= 0xFFFFFF00;
+#else
+					tmp_col[2]	= ( (((tmp_col[0] & 0x00FF00FF) + (tmp_col[1] & 0x00FF00FF)) >> 1) & 0x00FF00FF ) |
+								  ( (((tmp_col[0] & 0x0000FF00) + (tmp_col[1] & 0x0000FF00)) >> 1) & 0x0000FF00 ) |
+								  0xFF000000;
+					tmp_col[3]	= 0x00FFFFFF;
+#endif
+					break;
+
+				case 2:
+					tmp_col[2] = RGB15TO32( PAL4X4(pal1offset+2), 0xFF );
+					tmp_col[3] = RGB15TO32( PAL4X4(pal1offset+3), 0xFF );
+					break;
+
+				case 3:
+				{
+#ifdef LOCAL_BE
+					const u32 r0	= (tmp_col[0]>>24) & 0x000000FF;
+					const u32 r1	= (tmp_col[1]>>24) & 0x000000FF;
+					const u32 g0	= (tmp_col[0]>>16) & 0x000000FF;
+					const u32 g1	= (tmp_col[1]>>16) & 0x000000FF;
+					const u32 b0	= (tmp_col[0]>> 8) & 0x000000FF;
+					const u32 b1	= (tmp_col[1]>> 8) & 0x000000FF;
+#else
+					const u32 r0	=  tmp_col[0]      & 0x000000FF;
+					const u32 r1	=  tmp_col[1]      & 0x000000FF;
+					const u32 g0	= (tmp_col[0]>> 8) & 0x000000FF;
+					const u32 g1	= (tmp_col[1]>> 8) & 0x000000FF;
+					const u32 b0	= (tmp_col[0]>>16) & 0x000000FF;
+					const u32 b1	= (tmp_col[1]>>16) & 0x000000FF;
+#endif
+
+					const u16 tmp1	= (  (r0*5 + r1*3)>>6) |
+									  ( ((g0*5 + g1*3)>>6) <<  5 ) |
+									  ( ((b0*5 + b1*3)>>6) << 10 );
+					const u16 tmp2	= (  (r0*3 + r1*5)>>6) |
+									  ( ((g0*3 + g1*5)>>6) <<  5 ) |
+									  ( ((b0*3 + b1*5)>>6) << 10 );
+
+					tmp_col[2] = RGB15TO32(tmp1, 0xFF);
+					tmp_col[3] = RGB15TO32(tmp2, 0xFF);
+					break;
+				}
+			}
+
+			if(TEXFORMAT==TexFormat_15bpp)
+			{
+				for (size_t i = 0; i < 4; i++)
+				{
+#ifdef LOCAL_BE
+					const u32 a = (tmp_col[i] >> 3) & 0x0000001F;
+					tmp_col[i] >>= 2;
+					tmp_col[i] &= 0x3F3F3F00;
+					tmp_col[i] |= a;
+#else
+					const u32 a = (tmp_col[i] >> 3) & 0x1F000000;
+					tmp_col[i] >>= 2;
+					tmp_col[i] &= 0x003F3F3F;
+					tmp_col[i] |= a;
+#endif
+				}
+			}
+
+			//TODO - this could be more precise for 32bpp mode (run it through the color separation table)
+
+			//set all 16 texels
+#if defined(TEXDECODE_SSSE3)
+			if(VECTORIZED)
+			{
+				//each row is a single shuffle of the block's 4 colors
+				const __m128i colors = _mm_load_si128((const __m128i*)tmp_col);
+				for (size_t sy = 0; sy < 4; sy++)
+				{
+					const u8 currRow = (u8)((currBlock>>(sy<<3))&0xFF);
+					const __m128i shuffle = _mm_load_si128((const __m128i*)tex4x4RowShuffles.shuffles[currRow]);
+					_mm_storeu_si128((__m128i*)(dwdst + (x<<2) + tmpPos[sy]), _mm_shuffle_epi8(colors,shuffle));
+				}
+				continue;
+			}
+#elif defined(TEXDECODE_NEON)
+			if(VECTORIZED)
+			{
+				uint8x8x2_t colors;
+				colors.val[0] = vld1_u8((const u8*)tmp_col);
+				colors.val[1] = vld1_u8((const u8*)tmp_col+8);
+				for (size_t sy = 0; sy < 4; sy++)
+				{
+					const u8 currRow = (u8)((currBlock>>(sy<<3))&0xFF);
+					const u8* shuffle = tex4x4RowShuffles.shuffles[currRow];
+					u8* rowdst = (u8*)(dwdst + (x<<2) + tmpPos[sy]);
+					vst1_u8(rowdst, vtbl2_u8(colors,vld1_u8(shuffle)));
+					vst1_u8(rowdst+8, vtbl2_u8(colors,vld1_u8(shuffle+8)));
+				}
+				continue;
+			}
+#endif
+			for (size_t sy = 0; sy < 4; sy++)
+			{
+				// Texture offset
+				u32 currentPos = (x<<2) + tmpPos[sy];
+				u8 currRow = (u8)((currBlock>>(sy<<3))&0xFF);
+
+				dwdst[currentPos  ] = tmp_col[ currRow    &3];
+				dwdst[currentPos+1] = tmp_col[(currRow>>2)&3];
+				dwdst[currentPos+2] = tmp_col[(currRow>>4)&3];
+				dwdst[currentPos+3] = tmp_col[(currRow>>6)&3];
+			}
+		}
+	}
+
+	#undef PAL4X4
+}
+
+template<TexCache_TexFormat TEXFORMAT>
+void TexDecode_4x4(const u32* map, const u16* indexData, u32 limit, u32 sizeX, u32 sizeY, u32 paletteAddress, u8* const* palSlots, u32* dst)
+{
+	Decode4x4<TEXFORMAT,true>(map,indexData,limit,sizeX,sizeY,paletteAddress,palSlots,dst);
+}
+
+template<TexCache_TexFormat TEXFORMAT>
+void TexDecode_4x4_Reference(const u32* map, const u16* indexData, u32 limit, u32 sizeX, u32 sizeY, u32 paletteAddress, u8* const* palSlots, u32* dst)
+{
+	Decode4x4<TEXFORMAT,false>(map,indexData,limit,sizeX,sizeY,paletteAddress,palSlots,dst);
+}
+
+//------------------------------------------------------------
+
+#define INSTANTIATE_TEXDECODERS(TEXFORMAT) \
+	template u32* TexDecode_I2<TEXFORMAT>(const u8*, u32, const u16*, u8, u32*); \
+	template u32* TexDecode_I4<TEXFORMAT>(const u8*, u32, const u16*, u8, u32*); \
+	template u32* TexDecode_I8<TEXFORMAT>(const u8*, u32, const u16*, u8, u32*); \
+	template u32* TexDecode_A3I5<TEXFORMAT>(const u8*, u32, const u16*, u32*); \
+	template u32* TexDecode_A5I3<TEXFORMAT>(const u8*, u32, const u16*, u32*); \
+	template u32* TexDecode_16bpp<TEXFORMAT>(const u8*, u32, u32*); \
+	template void TexDecode_4x4<TEXFORMAT>(const u32*, const u16*, u32, u32, u32, u32, u8* const*, u32*); \
+	template u32* TexDecode_I2_Reference<TEXFORMAT>(const u8*, u32, const u16*, u8, u32*); \
+	template u32* TexDecode_I4_Reference<TEXFORMAT>(const u8*, u32, const u16*, u8, u32*); \
+	template u32* TexDecode_I8_Reference<TEXFORMAT>(const u8*, u32, const u16*, u8, u32*); \
+	template u32* TexDecode_A3I5_Reference<TEXFORMAT>(const u8*, u32, const u16*, u32*); \
+	template u32* TexDecode_A5I3_Reference<TEXFORMAT>(const u8*, u32, const u16*, u32*); \
+	template u32* TexDecode_16bpp_Reference<TEXFORMAT>(const u8*, u32, u32*); \
+	template void TexDecode_4x4_Reference<TEXFORMAT>(const u32*, const u16*, u32, u32, u32, u32, u8* const*, u32*);
+
+INSTANTIATE_TEXDECODERS(TexFormat_15bpp)
+INSTANTIATE_TEXDECODERS(TexFormat_32bpp)
@@ -0,0 +1,53 @@
+/*
+	Copyright (C) 2006 yopyop
+	Copyright (C) 2006-2007 shash
+	Copyright (C) 2008-2015 DeSmuME team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _TEXDECODE_H_
+#define _TEXDECODE_H_
+
+#include "types.h"
+#include "texcache.h"
+
+//decoders from the NDS texture formats to the texcache formats (32bit texels, 6665 for TexFormat_15bpp and 8888 for TexFormat_32bpp).
+//the _Reference versions convert one texel at a time and are the definition of correct output.
+//the others use NEON or SSSE3 where available and must produce byte-identical results (android/texdecodetest.cpp checks this).
+//each one decodes len bytes of texture data from src and returns the texel after the last one written.
+
+//for the paletted formats, pal is the texture's palette (host byte order)
+//and palZeroAlpha is the alpha which color 0 gets (transparent or opaque, depending on the texture params)
+template<TexCache_TexFormat TEXFORMAT> u32* TexDecode_I2(const u8* src, u32 len, const u16* pal, u8 palZeroAlpha, u32* dst);
+template<TexCache_TexFormat TEXFORMAT> u32* TexDecode_I4(const u8* src, u32 len, const u16* pal, u8 palZeroAlpha, u32* dst);
+template<TexCache_TexFormat TEXFORMAT> u32* TexDecode_I8(const u8* src, u32 len, const u16* pal, u8 palZeroAlpha, u32* dst);
+template<TexCache_TexFormat TEXFORMAT> u32* TexDecode_A3I5(const u8* src, u32 len, const u16* pal, u32* dst);
+template<TexCache_TexFormat TEXFORMAT> u32* TexDecode_A5I3(const u8* src, u32 len, const u16* pal, u32* dst);
+template<TexCache_TexFormat TEXFORMAT> u32* TexDecode_16bpp(const u8* src, u32 len, u32* dst);
+
+template<TexCache_TexFormat TEXFORMAT> u32* TexDecode_I2_Reference(const u8* src, u32 len, const u16* pal, u8 palZeroAlpha, u32* dst);
+template<TexCache_TexFormat TEXFORMAT> u32* TexDecode_I4_Reference(const u8* src, u32 len, const u16* pal, u8 palZeroAlpha, u32* dst);
+template<TexCache_TexFormat TEXFORMAT> u32* TexDecode_I8_Reference(const u8* src, u32 len, const u16* pal, u8 palZeroAlpha, u32* dst);
+template<TexCache_TexFormat TEXFORMAT> u32* TexDecode_A3I5_Reference(const u8* src, u32 len, const u16* pal, u32* dst);
+template<TexCache_TexFormat TEXFORMAT> u32* TexDecode_A5I3_Reference(const u8* src, u32 len, const u16* pal, u32* dst);
+template<TexCache_TexFormat TEXFORMAT> u32* TexDecode_16bpp_Reference(const u8* src, u32 len, u32* dst);
+
+//4x4 compressed textures. map is the texel block data (limit blocks of it are valid), indexData is the per-block palette index data,
+//and palSlots are the texture palette slots (MMU.texInfo.texPalSlot) which the block colors are read from.
+//the whole sizeX*sizeY texture is written to dst
+template<TexCache_TexFormat TEXFORMAT> void TexDecode_4x4(const u32* map, const u16* indexData, u32 limit, u32 sizeX, u32 sizeY, u32 paletteAddress, u8* const* palSlots, u32* dst);
+template<TexCache_TexFormat TEXFORMAT> void TexDecode_4x4_Reference(const u32* map, const u16* indexData, u32 limit, u32 sizeX, u32 sizeY, u32 paletteAddress, u8* const* palSlots, u32* dst);
+
+#endif
@@ -67,6 +67,15 @@
 #ifdef __SSE2__
 #define ENABLE_SSE2
 #endif
+#ifdef __SSSE3__
+#define ENABLE_SSSE3
+#endif
+#ifdef __SSE4_1__
+#define ENABLE_SSE4_1
+#endif
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define ENABLE_NEON
+#endif
 #endif
 
 #ifdef NOSSE
@@ -75,6 +84,12 @@
 
 #ifdef NOSSE2
 #undef ENABLE_SSE2
+#undef ENABLE_SSSE3
+#undef ENABLE_SSE4_1
+#endif
+
+#ifdef NONEON
+#undef ENABLE_NEON
 #endif
 
 #ifdef _MSC_VER 
@@ -0,0 +1,178 @@
+/*
+	Copyright (C) 2009-2015 DeSmuME team
+
+	This file is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	This file is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _RINGBUFFER_H_
+#define _RINGBUFFER_H_
+
+#include <string.h>
+#include <algorithm>
+#include "types.h"
+
+//a fixed size queue for handing items from one thread (the producer) to exactly one other thread (the consumer).
+//neither side ever waits on the other: push fails when the queue is full, and pop fails when it is empty.
+//CAPACITY must be a power of two.
+template<typename T, u32 CAPACITY>
+class SPSCRing
+{
+public:
+	SPSCRing()
+		: head(0)
+		, tail(0)
+	{}
+
+	//producer only
+	bool push(const T& item)
+	{
+		const u32 h = head;
+		if(h - __atomic_load_n(&tail,__ATOMIC_ACQUIRE) == CAPACITY) return false;
+		items[h&(CAPACITY-1)] = item;
+		__atomic_store_n(&head,h+1,__ATOMIC_RELEASE);
+		return true;
+	}
+
+	//consumer only
+	bool pop(T& item)
+	{
+		const u32 t = tail;
+		if(__atomic_load_n(&head,__ATOMIC_ACQUIRE) == t) return false;
+		item = items[t&(CAPACITY-1)];
+		__atomic_store_n(&tail,t+1,__ATOMIC_RELEASE);
+		return true;
+	}
+
+	//number of items waiting. exact from either side's point of view as far as its own operations go
+	u32 size() const
+	{
+		return __atomic_load_n(&head,__ATOMIC_ACQUIRE) - __atomic_load_n(&tail,__ATOMIC_ACQUIRE);
+	}
+
+	bool empty() const { return size() == 0; }
+
+	//only when neither side is using the queue
+	void clear() { head = tail = 0; }
+
+private:
+	T items[CAPACITY];
+
+	//both count up forever (wrapping is fine, since CAPACITY divides 2^32).
+	//they are kept on separate cache lines so that the two threads dont fight over one
+	CACHE_ALIGN u32 head; //written by the producer
+	u8 pad[64];
+	CACHE_ALIGN u32 tail; //written by the consumer
+};
+
+//the same idea for streams such as audio: a capacity chosen at runtime (rounded up to a power of two),
+//and items moved in runs. the producer writes whatever it has and the consumer reads whatever it wants;
+//what doesnt fit (or isnt there) is left out, and counted as an overrun (or underrun)
+template<typename T>
+class SPSCStreamRing
+{
+public:
+	SPSCStreamRing()
+		: items(NULL)
+		, capacity(0)
+		, head(0)
+		, overruns(0)
+		, tail(0)
+		, underruns(0)
+	{}
+
+	~SPSCStreamRing() { delete[] items; }
+
+	//only when neither side is using the queue. empties it and resets the counters
+	void resize(u32 minCapacity)
+	{
+		u32 cap = 1;
+		while(cap < minCapacity) cap <<= 1;
+		if(cap != capacity)
+		{
+			delete[] items;
+			items = new T[cap];
+			capacity = cap;
+		}
+		clear();
+	}
+
+	//producer only. returns how many items were written
+	u32 write(const T* src, u32 count)
+	{
+		const u32 h = head;
+		const u32 space = capacity - (h - __atomic_load_n(&tail,__ATOMIC_ACQUIRE));
+		if(count > space)
+		{
+			__atomic_store_n(&overruns,overruns+1,__ATOMIC_RELAXED);
+			count = space;
+		}
+		const u32 at = h & (capacity-1);
+		const u32 first = std::min(count, capacity - at);
+		memcpy(items + at, src, first*sizeof(T));
+		memcpy(items, src + first, (count-first)*sizeof(T));
+		__atomic_store_n(&head,h+count,__ATOMIC_RELEASE);
+		return count;
+	}
+
+	//consumer only. returns how many items were read
+	u32 read(T* dst, u32 count)
+	{
+		const u32 t = tail;
+		const u32 avail = __atomic_load_n(&head,__ATOMIC_ACQUIRE) - t;
+		if(count > avail)
+		{
+			__atomic_store_n(&underruns,underruns+1,__ATOMIC_RELAXED);
+			count = avail;
+		}
+		const u32 at = t & (capacity-1);
+		const u32 first = std::min(count, capacity - at);
+		memcpy(dst, items + at, first*sizeof(T));
+		memcpy(dst + first, items, (count-first)*sizeof(T));
+		__atomic_store_n(&tail,t+count,__ATOMIC_RELEASE);
+		return count;
+	}
+
+	//consumer only. throws away everything waiting, and returns how much that was
+	u32 discard()
+	{
+		const u32 t = tail;
+		const u32 h = __atomic_load_n(&head,__ATOMIC_ACQUIRE);
+		__atomic_store_n(&tail,h,__ATOMIC_RELEASE);
+		return h - t;
+	}
+
+	//items waiting, and room left. each is exact for the side which would act on it
+	u32 size() const { return __atomic_load_n(&head,__ATOMIC_ACQUIRE) - __atomic_load_n(&tail,__ATOMIC_ACQUIRE); }
+	u32 space() const { return capacity - size(); }
+	u32 getCapacity() const { return capacity; }
+
+	//how many writes didnt fit, and how many reads came up short. readable from either side
+	u32 getOverruns() const { return __atomic_load_n(&overruns,__ATOMIC_RELAXED); }
+	u32 getUnderruns() const { return __atomic_load_n(&underruns,__ATOMIC_RELAXED); }
+
+	//only when neither side is using the queue
+	void clear() { head = tail = 0; overruns = underruns = 0; }
+
+private:
+	T* items;
+	u32 capacity;
+
+	CACHE_ALIGN u32 head; //written by the producer
+	u32 overruns; //written by the producer
+	u8 pad[64];
+	CACHE_ALIGN u32 tail; //written by the consumer
+	u32 underruns; //written by the consumer
+};
+
+#endif
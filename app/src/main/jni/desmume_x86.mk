@@ -19,8 +19,12 @@ LOCAL_SRC_FILES			:= 	android/mic.cpp \
                             android/OpenArchive.cpp \
                             android/7zip.cpp \
                             android/sndopensl.cpp \
+                            android/sndring.cpp \
+                            android/avcapture.cpp \
                             android/draw.cpp \
                             android/OGLESRender.cpp \
+                            android/texdecodetest.cpp \
+                            android/metaspubench.cpp \
                             desmume/src/addons/slot1_none.cpp \
 							desmume/src/addons/slot1_r4.cpp \
 							desmume/src/addons/slot1_retail_auto.cpp \
@@ -112,6 +116,7 @@ LOCAL_SRC_FILES			:= 	android/mic.cpp \
 							desmume/src/slot2.cpp \
 							desmume/src/SPU.cpp \
 							desmume/src/texcache.cpp \
+							desmume/src/texdecode.cpp \
 							desmume/src/thumb_instructions.cpp \
 							desmume/src/version.cpp \
 							desmume/src/wifi.cpp \
@@ -125,5 +130,11 @@ LOCAL_LDLIBS 			:= -llog -lz -lGLESv2 -lGLESv3 -lEGL -ljnigraphics -lOpenSLES -l
 #To check for speed improvements
 #LOCAL_CFLAGS += -DMEASURE_FIRST_FRAMES
 
+#To check the texture decoders and compare them against the reference versions
+#LOCAL_CFLAGS += -DTEXDECODE_BENCHMARK
+
+#To time the metaspu synchronizers
+#LOCAL_CFLAGS += -DMETASPU_BENCHMARK
+
 include $(BUILD_SHARED_LIBRARY)
 include $(MY_LOCAL_PATH)/desmume/src/utils/AsmJit/asmjit.mk